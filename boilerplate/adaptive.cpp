@@ -0,0 +1,151 @@
+// ==========================================================================
+// Adaptive Sampling
+// ==========================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#include "adaptive.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+// pixels darker than this are held to the absolute error of one this
+// bright; relative error in the dark is large, hard to see and slow to
+// bring down
+const float DARK_LUMINANCE = 0.05f;
+
+float luminanceOf(vec3 color)
+{
+	return 0.2126f*color.r + 0.7152f*color.g + 0.0722f*color.b;
+}
+
+bool running(const PixelEstimate &pixel, const AdaptiveOptions &options)
+{
+	return pixel.samples < options.maxSamples &&
+		(pixel.samples < options.minSamples || pixel.error() > options.threshold);
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+void PixelEstimate::add(vec3 color)
+{
+	samples++;
+	mean += (color - mean)/float(samples);
+	float value = luminanceOf(color);
+	float delta = value - luminance;
+	luminance += delta/samples;
+	m2 += delta*(value - luminance);
+}
+
+float PixelEstimate::error() const
+{
+	if (samples < 2) return INFINITY;
+	float variance = m2/(samples - 1);
+	return 1.96f*sqrt(variance/samples)/std::max(luminance, DARK_LUMINANCE);
+}
+
+void renderAdaptive(const vector<Tile> &tiles, int width, int height,
+		const AdaptiveOptions &requested, const AdaptivePass &pass,
+		const AdaptiveSample &sample, vector<PixelEstimate> *pixels,
+		AdaptiveStats *stats)
+{
+	AdaptiveOptions options = requested;
+	options.maxSamples = std::max(options.maxSamples, 1);
+	options.minSamples = std::min(std::max(options.minSamples, 2), options.maxSamples);
+	if ((int)pixels->size() != width*height)
+		pixels->assign(width*height, PixelEstimate());
+	*stats = AdaptiveStats();
+
+	auto start = chrono::steady_clock::now();
+	long long sampleBudget = (long long)(options.sampleBudget*width*height);
+	long long carried = 0;
+	for (const PixelEstimate &pixel : *pixels)
+		carried += pixel.samples;
+	atomic<long long> spent(carried);
+	atomic<bool> budgetSpent(false);
+	auto withinBudget = [&]() {
+		if (budgetSpent) return false;
+		bool over = (sampleBudget > 0 && spent >= sampleBudget) || (options.timeBudget > 0 &&
+			chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() >= options.timeBudget);
+		if (over) budgetSpent = true;
+		return !over;
+	};
+
+	// a pixel with n samples takes n more (minSamples in the first pass),
+	// at most up to maxSamples
+	auto renderTile = [&](const Tile &tile, bool first) {
+		long long taken = 0;
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			for (int x = tile.x; x < tile.x + tile.width; x++) {
+				PixelEstimate &pixel = (*pixels)[y*width + x];
+				if (!first && !running(pixel, options)) continue;
+				int begin = pixel.samples;
+				int end = first ? std::max(begin, options.minSamples) : std::min(2*begin, options.maxSamples);
+				for (int s = begin; s < end; s++)
+					pixel.add(sample(x, y, s));
+				taken += end - begin;
+			}
+		}
+		spent += taken;
+	};
+
+	// the first pass is over the tiles not yet started, all of them unless
+	// the estimates were carried over
+	vector<Tile> unstarted;
+	for (const Tile &tile : tiles) {
+		bool started = true;
+		for (int y = tile.y; y < tile.y + tile.height && started; y++)
+			for (int x = tile.x; x < tile.x + tile.width && started; x++)
+				started = (*pixels)[y*width + x].samples >= options.minSamples;
+		if (!started) unstarted.push_back(tile);
+	}
+	pass(unstarted, [&](const Tile &tile) { renderTile(tile, true); });
+	stats->passes = 1;
+
+	vector<pair<double, int>> order; // tile error, tile
+	for (;;) {
+		order.clear();
+		for (int t = 0; t < (int)tiles.size(); t++) {
+			const Tile &tile = tiles[t];
+			double error = 0;
+			bool active = false;
+			for (int y = tile.y; y < tile.y + tile.height; y++) {
+				for (int x = tile.x; x < tile.x + tile.width; x++) {
+					const PixelEstimate &pixel = (*pixels)[y*width + x];
+					if (running(pixel, options)) {
+						error += pixel.error();
+						active = true;
+					}
+				}
+			}
+			if (active) order.push_back(make_pair(error, t));
+		}
+		if (order.empty() || !withinBudget()) break;
+		sort(order.begin(), order.end(), [](const pair<double, int> &a, const pair<double, int> &b) {
+			return a.first > b.first;
+		});
+		vector<Tile> noisiest;
+		for (const pair<double, int> &entry : order)
+			noisiest.push_back(tiles[entry.second]);
+		pass(noisiest, [&](const Tile &tile) {
+			if (withinBudget()) renderTile(tile, false);
+		});
+		stats->passes++;
+	}
+
+	stats->budgetSpent = budgetSpent;
+	for (const PixelEstimate &pixel : *pixels) {
+		stats->samples += pixel.samples;
+		if (pixel.samples >= options.minSamples && pixel.error() <= options.threshold)
+			stats->converged++;
+		else if (pixel.samples >= options.maxSamples)
+			stats->capped++;
+	}
+}
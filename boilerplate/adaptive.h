@@ -0,0 +1,69 @@
+// ==========================================================================
+// Adaptive Sampling
+//  - every pixel keeps the running mean and variance of its samples
+//    (Welford), and stops once the 95% confidence interval of its mean
+//    luminance is within a relative threshold of it
+//  - after a first pass of a few samples everywhere, passes double the
+//    sample count of every pixel that has not stopped, so sobol and blue
+//    noise pixels always hold a power of two of their sequence
+//  - each pass takes tiles noisiest first (summed error of their pixels
+//    still running), and a time or sample budget stops handing tiles out,
+//    so what is left of it goes where the noise is
+// ==========================================================================
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "tiles.h"
+
+struct AdaptiveOptions
+{
+	float threshold = 0.05f; // relative half width of the confidence interval
+	int minSamples = 4;      // per pixel before any may stop
+	int maxSamples = 64;     // per pixel
+	double timeBudget = 0;   // milliseconds, 0 for none
+	double sampleBudget = 0; // average samples per pixel, 0 for none
+};
+
+struct PixelEstimate
+{
+	glm::vec3 mean = glm::vec3(0.0f);
+	float luminance = 0.0f; // mean luminance
+	float m2 = 0.0f;        // sum of squared luminance deviations
+	int samples = 0;
+
+	void add(glm::vec3 color);
+	// half width of the luminance confidence interval relative to the mean
+	float error() const;
+};
+
+struct AdaptiveStats
+{
+	int passes = 0;
+	long long samples = 0;
+	int converged = 0; // pixels that stopped on the threshold
+	int capped = 0;    // pixels that reached maxSamples without stopping
+	bool budgetSpent = false;
+};
+
+// renders the given tiles, calling render for each from worker threads;
+// supplied by the renderer, which knows its threads and counters
+typedef std::function<void(const std::vector<Tile> &tiles,
+		const std::function<void(const Tile &tile)> &render)> AdaptivePass;
+
+// the color of sample index of pixel (x, y)
+typedef std::function<glm::vec3(int x, int y, int index)> AdaptiveSample;
+
+// samples the image until every pixel has stopped or the budget is spent;
+// pixels is width*height estimates by row. Estimates already there, from a
+// checkpoint, are carried on from and count toward the sample budget;
+// otherwise every pixel starts with none. The first pass always completes
+void renderAdaptive(const std::vector<Tile> &tiles, int width, int height,
+		const AdaptiveOptions &options, const AdaptivePass &pass,
+		const AdaptiveSample &sample, std::vector<PixelEstimate> *pixels,
+		AdaptiveStats *stats);
+
+#endif // ADAPTIVE_H
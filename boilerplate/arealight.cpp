@@ -0,0 +1,119 @@
+// ==========================================================================
+// Area Lights and Adaptive Shadow Sampling
+//
+// The probes are the strata in the corners of the grid, which are the
+// furthest apart: an occluder edge that crosses the light seldom leaves all
+// of them on one side. When they agree the hit is taken to be fully lit or
+// fully shadowed; when they do not, every remaining stratum is traced once,
+// and the probes count among the samples. Two probes (opposite corners)
+// are cheaper but miss penumbrae cast by edges along their diagonal.
+// ==========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "arealight.h"
+
+using namespace std;
+using namespace glm;
+
+thread_local AreaLightStats areaStats;
+
+AABB lightBounds(const Light &light)
+{
+	AABB box;
+	switch (light.shape) {
+	case LIGHT_RECTANGLE:
+		for (int i = 0; i < 4; i++)
+			box.grow(light.origin + ((i & 1) ? 0.5f : -0.5f)*light.edge[0] + ((i & 2) ? 0.5f : -0.5f)*light.edge[1]);
+		break;
+	case LIGHT_SPHERE:
+		box.grow(light.origin - vec3(light.size));
+		box.grow(light.origin + vec3(light.size));
+		break;
+	default:
+		box.grow(light.origin);
+	}
+	return box;
+}
+
+vec3 lightSamplePoint(const Light &light, const vec3 &position, float u, float v)
+{
+	if (light.shape == LIGHT_RECTANGLE)
+		return light.origin + (u - 0.5f)*light.edge[0] + (v - 0.5f)*light.edge[1];
+	if (light.shape != LIGHT_SPHERE)
+		return light.origin;
+
+	vec3 w = position - light.origin;
+	float distanceSquared = dot(w, w);
+	if (distanceSquared <= light.size*light.size)
+		return light.origin;
+	w *= inversesqrt(distanceSquared);
+
+	// concentric map of the square onto the disc (Shirley and Chiu 1997),
+	// which keeps strata compact
+	float a = 2.0f*u - 1.0f, b = 2.0f*v - 1.0f, r, phi;
+	if (a == 0.0f && b == 0.0f) return light.origin;
+	if (fabs(a) > fabs(b)) {
+		r = a;
+		phi = 0.785398163f*(b/a);
+	} else {
+		r = b;
+		phi = 1.570796327f - 0.785398163f*(a/b);
+	}
+	vec3 t = fabs(w.x) > 0.5f ? normalize(cross(w, vec3(0.0f, 1.0f, 0.0f))) : normalize(cross(w, vec3(1.0f, 0.0f, 0.0f)));
+	vec3 s = cross(w, t);
+	return light.origin + light.size*r*(cos(phi)*t + sin(phi)*s);
+}
+
+namespace {
+
+// strata of an n by n grid with the four corners first
+const vector<int> &strataOrder(int n)
+{
+	static thread_local vector<int> order;
+	static thread_local int orderSize = 0;
+	if (orderSize == n) return order;
+	orderSize = n;
+	order.clear();
+	int corners[4] = {0, n*n - 1, n - 1, n*(n - 1)};
+	for (int corner : corners)
+		if (find(order.begin(), order.end(), corner) == order.end())
+			order.push_back(corner);
+	for (int k = 0; k < n*n; k++)
+		if (find(order.begin(), order.end(), k) == order.end())
+			order.push_back(k);
+	return order;
+}
+
+} // namespace
+
+float lightVisibility(const Light &light, const HitPoint &hit, LightOccluded occluded,
+		const AreaLightOptions &options, Random *random)
+{
+	if (light.shape == LIGHT_POINT)
+		return occluded(hit, light.origin) ? 0.0f : 1.0f;
+
+	areaStats.tests++;
+	int n = std::max(1, int(sqrt(float(options.samples)) + 0.5f));
+	const vector<int> &order = strataOrder(n);
+	int probes = std::min(std::max(options.probes, 1), n*n);
+
+	int visible = 0, traced = 0;
+	auto trace = [&](int stratum) {
+		float u = (stratum % n + random->nextFloat())/n;
+		float v = (stratum / n + random->nextFloat())/n;
+		visible += occluded(hit, lightSamplePoint(light, hit.position, u, v)) ? 0 : 1;
+		traced++;
+	};
+	for (int k = 0; k < probes; k++)
+		trace(order[k]);
+	if (visible != 0 && visible != traced) {
+		areaStats.refined++;
+		for (int k = probes; k < n*n; k++)
+			trace(order[k]);
+	}
+	areaStats.rays += traced;
+	return float(visible)/traced;
+}
@@ -0,0 +1,58 @@
+// ==========================================================================
+// Area Lights and Adaptive Shadow Sampling
+//  - rectangle and sphere lights are shaded from their centre like point
+//    lights; their area only softens the shadows they cast
+//  - visibility is the fraction of shadow rays, one per stratum of a grid
+//    over the light, that reach it
+//  - a few probe rays to strata far apart go first, and the rest of the
+//    grid is traced only when the probes disagree, so only penumbrae pay
+//    for the full grid
+// ==========================================================================
+#ifndef AREALIGHT_H
+#define AREALIGHT_H
+
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "bvh.h"
+#include "random.h"
+
+struct AreaLightOptions
+{
+	int probes = 4;   // shadow rays before deciding whether to refine
+	int samples = 16; // strata when refining, rounded to a square grid
+};
+
+struct AreaLightStats
+{
+	unsigned long long tests = 0;   // area light visibility queries
+	unsigned long long refined = 0; // of which the probes disagreed
+	unsigned long long rays = 0;
+
+	void add(const AreaLightStats &other)
+	{
+		tests += other.tests;
+		refined += other.refined;
+		rays += other.rays;
+	}
+};
+
+// one per thread, like bvhStats
+extern thread_local AreaLightStats areaStats;
+
+// whether something lies between hit and a point; supplied by the renderer
+typedef bool (*LightOccluded)(const HitPoint &hit, const glm::vec3 &lightPosition);
+
+// the box around all of the light's surface
+AABB lightBounds(const Light &light);
+
+// the point for (u, v) in [0, 1)^2 on the light as seen from position; a
+// sphere is sampled on its disc facing position
+glm::vec3 lightSamplePoint(const Light &light, const glm::vec3 &position, float u, float v);
+
+// fraction of the light that hit sees, 0 or 1 for point lights, which take
+// a single ray
+float lightVisibility(const Light &light, const HitPoint &hit, LightOccluded occluded,
+		const AreaLightOptions &options, Random *random);
+
+#endif // AREALIGHT_H
@@ -13,12 +13,22 @@
 // Date:    December 2015
 // ==========================================================================
 
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -29,6 +39,30 @@
 #include "texture.h"
 
 #include "imagebuffer.h"
+#include "savequeue.h"
+#include "scene.h"
+#include "bvh.h"
+#include "bvhcache.h"
+#include "sharedscene.h"
+#include "sampler.h"
+#include "adaptive.h"
+#include "denoise.h"
+#include "tonemap.h"
+#include "perfcounters.h"
+#include "lighttree.h"
+#include "restir.h"
+#include "arealight.h"
+#include "gbuffer.h"
+#include "footprint.h"
+#include "socketio.h"
+#include "farm.h"
+#include "lightcull.h"
+#include "tiles.h"
+#include "tilestream.h"
+#include "mappedframe.h"
+#include "tiffwriter.h"
+#include "checkpoint.h"
+#include "random.h"
 
 using namespace std;
 using namespace glm;
@@ -203,46 +237,33 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 }
 
 //---------------------------------------------------------------------------
-// calculate t, r, s?
-struct Ray
-{
-	vec3 origin;
-	vec3 dirVector;
-	float focalLength;
-};
-
-struct Light
-{
-	vec3 origin;
-	vec3 color;
-};
-
-struct Shape
-{
-	int type; // 0 means sphere, 1 means plane; 2 means triangle
-	vector<vec3> data;
-	float addition = .0f;
-	vec3 color;
-	int id;
-	vec3 specularColor;
-	vec3 specularHighLight;
-	float PEx;
-};
-
-struct IntersectionInfo
-{
-	float t;
-	Shape shape;	
-};
 
 vector<Ray> myRayList;
-vector<Shape> myShapeList;
+vector<Shape> myShapeStorage; // unless the shapes are in mySharedScene
+ShapeSpan myShapeList;
+SharedScene mySharedScene;
 vector<Shape> myShadowShapeList;
-vector<vec3> myLightList;
+vector<Light> myLightList;
 vector<vec3> colorList;
 vector<vec3> rayList;
-
-Ray generateRay(int x, int y, int width, int height, vec3 origin, float distance){
+BVH myBVH;
+LightTree myLightTree;
+LightCutOptions myLightCutOptions;
+bool myRestir = false;
+RestirOptions myRestirOptions;
+LightDistribution myLightDistribution;
+bool myLightCulling = false;
+LightGrid myLightGrid;
+AreaLightOptions myAreaLightOptions;
+vec3 myCameraOrigin = vec3(0,0,0);
+float myFocalLength = 2.0f;
+SamplerOptions mySamplerOptions;
+int mySampleDimensions = SAMPLE_DIMENSIONS; // that paths can use, see setLights
+vector<PixelGuide> myGuides; // for the denoiser and AOVs, by row; filled while rendering unless empty
+
+// the ray through (x, y) in pixel units, the corner of pixel (0, 0) at
+// the origin
+Ray generateRay(float x, float y, int width, int height, vec3 origin, float distance){
 	Ray aRay;
 	aRay.origin = origin;
 	aRay.focalLength = distance;
@@ -252,7 +273,7 @@ Ray generateRay(int x, int y, int width, int height, vec3 origin, float distance
 	return aRay;
 }
 
-void readFile(vector<Shape> &shapeList, Light *light, const char* filename){
+void readFile(vector<Shape> &shapeList, vector<Light> &lightList, const char* filename){
 		
 	ifstream f (filename);
 	
@@ -265,6 +286,8 @@ void readFile(vector<Shape> &shapeList, Light *light, const char* filename){
 		if(word.compare("#") ==0){
 			f.getline(buffer,BUFF_SIZE);
 		}else if(word.compare("light") ==0){
+			lightList.push_back(Light());
+			Light *light = &lightList.back();
 			f.getline(buffer,BUFF_SIZE);
 			
 			f.getline(buffer,BUFF_SIZE);
@@ -278,6 +301,71 @@ void readFile(vector<Shape> &shapeList, Light *light, const char* filename){
 				light->color = vec3(x,y,z);
 			}
 
+			// optional radius of influence, otherwise this is the closing brace
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f", &x)==1){
+				light->radius = x;
+			}
+
+		}else if(word.compare("rectlight") ==0){
+			lightList.push_back(Light());
+			Light *light = &lightList.back();
+			light->shape = LIGHT_RECTANGLE;
+			f.getline(buffer,BUFF_SIZE);
+			
+			f.getline(buffer,BUFF_SIZE);
+			float x,y,z;
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->origin = vec3(x,y,z);
+			}
+			
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->edge[0] = vec3(x,y,z);
+			}
+			
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->edge[1] = vec3(x,y,z);
+			}
+			
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->color = vec3(x,y,z);
+			}
+
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f", &x)==1){
+				light->radius = x;
+			}
+
+		}else if(word.compare("spherelight") ==0){
+			lightList.push_back(Light());
+			Light *light = &lightList.back();
+			light->shape = LIGHT_SPHERE;
+			f.getline(buffer,BUFF_SIZE);
+			
+			f.getline(buffer,BUFF_SIZE);
+			float x,y,z;
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->origin = vec3(x,y,z);
+			}
+			
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f", &x)==1){
+				light->size = x;
+			}
+			
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f %f %f", &x, &y, &z)==3){
+				light->color = vec3(x,y,z);
+			}
+
+			f.getline(buffer,BUFF_SIZE);
+			if(sscanf(buffer,"%f", &x)==1){
+				light->radius = x;
+			}
+
 		}else if(word.compare("sphere")==0){
 			Shape sphere;
 			sphere.type = 0;
@@ -402,7 +490,7 @@ void readFile(vector<Shape> &shapeList, Light *light, const char* filename){
 	f.close();
 }
 
-bool testIntersectSphere(Ray aRay, Shape aShape, IntersectionInfo *info){
+bool testIntersectSphere(const Ray &aRay, const Shape &aShape, IntersectionInfo *info){
 	bool hit = false;
 	vec3 e = aRay.origin;
 	vec3 d = aRay.dirVector;
@@ -416,13 +504,13 @@ bool testIntersectSphere(Ray aRay, Shape aShape, IntersectionInfo *info){
 		hit = true;
 		float t = (-(dot(d,e-c))-sqrt(discriminant))/dot(d,d);
 		info->t = t;
-		info->shape = aShape;
+		info->shape = &aShape;
 	}
 	
 	return hit;
 }
 
-bool testIntersectPlane(Ray aRay, Shape aShape, IntersectionInfo *info){
+bool testIntersectPlane(const Ray &aRay, const Shape &aShape, IntersectionInfo *info){
 	bool hit = false;
 	vec3 e = aRay.origin;
 	vec3 d = aRay.dirVector;
@@ -435,12 +523,12 @@ bool testIntersectPlane(Ray aRay, Shape aShape, IntersectionInfo *info){
 		hit = true;
 		float t = dot((q-e),n)/dot(d,n);
 		info->t = t;
-		info->shape = aShape;
+		info->shape = &aShape;
 	}
 	return hit;
 }
 
-bool testIntersectTriangle(Ray aRay, Shape aShape, IntersectionInfo *info){
+bool testIntersectTriangle(const Ray &aRay, const Shape &aShape, IntersectionInfo *info){
 	bool hit = false;
 	vec3 e = aRay.origin;
 	vec3 d = aRay.dirVector;
@@ -479,12 +567,12 @@ bool testIntersectTriangle(Ray aRay, Shape aShape, IntersectionInfo *info){
 
 	hit = true;
 	info->t = t;
-	info->shape = aShape;
+	info->shape = &aShape;
 	
 	return hit;
 }
 
-bool testIntersection(Ray aRay, Shape aShape, IntersectionInfo *info){ 
+bool testIntersection(const Ray &aRay, const Shape &aShape, IntersectionInfo *info){ 
 	bool hit = false;
 	if(aShape.type==0){
 		hit = testIntersectSphere(aRay, aShape, info);
@@ -498,10 +586,10 @@ bool testIntersection(Ray aRay, Shape aShape, IntersectionInfo *info){
 
 
 
-bool testIntersections(Ray aRay, vector<Shape> objectList, IntersectionInfo *resultInfo,float lowerBound,float upperBound){ 
+bool testIntersections(const Ray &aRay, const vector<Shape> &objectList, IntersectionInfo *resultInfo,float lowerBound,float upperBound){ 
 	bool hit = false;
 	float t = upperBound;
-	for(int i=0; i<objectList.size();i++){
+	for(int i=0; i<(int)objectList.size();i++){
 		IntersectionInfo aInfo;
 		if(testIntersection(aRay, objectList[i],&aInfo)){
 			if(aInfo.t>=lowerBound && aInfo.t<t){
@@ -509,6 +597,7 @@ bool testIntersections(Ray aRay, vector<Shape> objectList, IntersectionInfo *res
 				t = aInfo.t;
 				resultInfo->t=t;
 				resultInfo->shape=aInfo.shape;
+				resultInfo->index=i;
 			}
 		}
 	}
@@ -527,42 +616,124 @@ vec3 shadingEquation(vec3 intersectionPoint,vec3 view,vec3 surfaceColor, vec3 li
 	vec3 ka = surfaceColor;
 	vec3 Ia = vec3(.5f,.5f,.5f);
 	
-	return ka*Ia+kd*I*glm::max(.0f,dot(n,l))+ks*I*(float)(pow(glm::max(.0f,dot(n,h)),500));
+	return ka*Ia+kd*I*glm::max(.0f,dot(n,l))+ks*I*phongIntegerPower(glm::max(.0f,dot(n,h)),500);
+}
+
+vec3 surfaceNormalVector(const Ray &aRay, const IntersectionInfo &info){
+	if(info.shape->type == 0){
+		return normalize((aRay.origin + info.t*aRay.dirVector)-info.shape->data[0]);
+	}
+	return info.shape->normal;
+}
+
+// fills in the per-shape constants that shading would otherwise recompute
+// at every hit; call after the scene is loaded
+void precomputeShapes(vector<Shape> &shapeList){
+	for(Shape &shape : shapeList){
+		if(shape.type == 1){
+			shape.normal = normalize(shape.data[0]);
+		}else if(shape.type == 2){
+			shape.normal = normalize(cross(shape.data[1]-shape.data[0],shape.data[2]-shape.data[0]));
+		}
+		shape.phong = makePhongExponent(shape.PEx);
+	}
+}
+
+HitPoint makeHitPoint(const Ray &ray, const IntersectionInfo &info){
+	HitPoint hit;
+	hit.position = ray.origin+info.t*ray.dirVector;
+	hit.normal = surfaceNormalVector(ray,info);
+	hit.direction = ray.dirVector*inversesqrt(dot(ray.dirVector,ray.dirVector));
+	return hit;
+}
+
+// Blinn-Phong for a light of unit colour, shadows aside; toLight runs from
+// the hit to the light and need not be normalized
+vec3 surfaceResponse(const HitPoint &hit, const Shape &shape, vec3 toLight){
+	vec3 l = toLight*inversesqrt(dot(toLight,toLight));
+	vec3 kd = shape.color;
+	vec3 ks = shape.specularHighLight;
+	vec3 h = normalize(l-hit.direction);
+	return kd*glm::max(.0f,dot(hit.normal,l))+ks*evalPhong(shape.phong,glm::max(.0f,dot(hit.normal,h)));
+}
+
+vec3 ambientColor(const Shape &shape){
+	return shape.color*vec3(.4f,.4f,.4f);
 }
 
-vec3 surfaceNormalVector(Ray aRay, IntersectionInfo info){
-	vec3 result;
-	if(info.shape.type == 0){
-		result = (aRay.origin + info.t*aRay.dirVector)-info.shape.data[0];
-	}else if(info.shape.type == 1){
-		result = info.shape.data[0];
-	}else if(info.shape.type == 2){
-		result = cross(info.shape.data[1]-info.shape.data[0],info.shape.data[2]-info.shape.data[0]);
+// ambient plus, if the light is visible, Blinn-Phong
+vec3 shadeDirect(const HitPoint &hit, const Shape &shape, const Light &light, vec3 toLight, bool lit){
+	vec3 color = ambientColor(shape);
+	if(lit){
+		color += light.color*surfaceResponse(hit,shape,toLight);
 	}
-	return normalize(result);
+	return color;
+}
+
+bool lightOccluded(const HitPoint &hit, const vec3 &lightPosition){
+	Ray shadowRay;
+	shadowRay.origin = hit.position;
+	shadowRay.dirVector = lightPosition-hit.position;
+	return occludedBVH(myBVH,myShapeList,shadowRay,0.0001f,1.0f);
+}
+
+// the fraction of a light that is not shadowed at a hit
+float lightVisible(const HitPoint &hit, const Light &light, Random *random){
+	return lightVisibility(light,hit,lightOccluded,myAreaLightOptions,random);
+}
+
+// the light tree's view of a single light: its unit colour response, zero
+// when the light is out of range or something lies between it and the hit
+vec3 lightResponse(const HitPoint &hit, const Shape &shape, const Light &light, Random *random){
+	vec3 toLight = light.origin-hit.position;
+	float falloff = lightFalloff(light,dot(toLight,toLight));
+	if(falloff<=0)
+		return vec3(0,0,0);
+	float visibility = lightVisible(hit,light,random);
+	if(visibility<=0)
+		return vec3(0,0,0);
+	return falloff*visibility*surfaceResponse(hit,shape,toLight);
+}
+
+// direct light at a hit from the listed lights, with a shadow test for each
+// one in range
+vec3 shadeLightList(const HitPoint &hit, const Shape &shape, const int *lights, int count, Random *random){
+	lightStats.hits++;
+	vec3 color = vec3(0,0,0);
+	for(int k=0;k<count;k++){
+		const Light &light = myLightList[lights[k]];
+		vec3 toLight = light.origin-hit.position;
+		float falloff = lightFalloff(light,dot(toLight,toLight));
+		if(falloff<=0)
+			continue;
+		lightStats.lightsEvaluated++;
+		float visibility = lightVisible(hit,light,random);
+		if(visibility>0)
+			color += light.color*(falloff*visibility)*surfaceResponse(hit,shape,toLight);
+	}
+	return color;
 }
 
 vec3 raycolor(Ray ray, float lowerBound, float upperBound,Light light){
 		IntersectionInfo info;
-		if(testIntersections(ray,myShapeList,&info,lowerBound,upperBound)){
+		if(intersectBVH(myBVH,myShapeList,ray,&info,lowerBound,upperBound)){
 			vec3 d = ray.dirVector;
 			vec3 color = vec3(0,0,0);
 			vec3 n = surfaceNormalVector(ray,info);
 			vec3 v = normalize(-d);
 			vec3 intersectP = ray.origin+info.t*d;
-			color = info.shape.color*vec3(.5f,.5f,.5f);
+			color = info.shape->color*vec3(.5f,.5f,.5f);
 				
 			Ray shadowRay;
 			shadowRay.origin = intersectP;
 			shadowRay.dirVector = (light.origin-shadowRay.origin);
-			IntersectionInfo emptyInfo;
-			if(!testIntersections(shadowRay,myShapeList,&emptyInfo,0.0001f,1.0f)){				
+			if(!occludedBVH(myBVH,myShapeList,shadowRay,0.0001f,1.0f)){				
 				vec3 l = normalize(light.origin-intersectP);
-				vec3 kd = info.shape.color;
+				vec3 kd = info.shape->color;
 				vec3 I = light.color;					
 				vec3 ks = vec3(0.7,0.7,0.7);			
 				vec3 h = normalize(v+l);
-				color = color+kd*I*glm::max(.0f,dot(n,l))+ks*I*(float)(pow(glm::max(.0f,dot(n,h)),500));
+				color = color+kd*I*glm::max(.0f,dot(n,l))+ks*I*phongIntegerPower(glm::max(.0f,dot(n,h)),500);
 			}
 			return color;
 		}else{
@@ -571,48 +742,745 @@ vec3 raycolor(Ray ray, float lowerBound, float upperBound,Light light){
 	
 }
 
-vec3 raycolorRe(Ray ray, float lowerBound, float upperBound,Light light,int times){
+// direct light at a hit from all the lights, by the selected method
+vec3 directLight(const HitPoint &hit, const Shape &shape, vec3 ambient, Random *random){
+	if(myRestir){
+		Reservoir reservoir = sampleReservoir(myLightList,myLightDistribution,hit,shape,surfaceResponse,myRestirOptions,random);
+		return shadeReservoir(myLightList,hit,shape,reservoir,surfaceResponse,lightVisible,random);
+	}
+	if(myLightCulling){
+		const int *lights;
+		int count;
+		lightsAt(myLightGrid,hit.position,&lights,&count);
+		return shadeLightList(hit,shape,lights,count,random);
+	}
+	return shadeLightCut(myLightTree,hit,shape,ambient,lightResponse,myLightCutOptions,random);
+}
+
+// guide, if given, is set to what the ray hits first; left alone on a miss
+vec3 raycolorRe(Ray ray, float lowerBound, float upperBound,Random *random,int times,PixelGuide *guide=nullptr);
+
+// the denoiser's guide for a camera ray's hit
+PixelGuide hitGuide(const Shape &shape, const HitPoint &hit, float distance){
+	PixelGuide guide;
+	guide.albedo = shape.color;
+	guide.normal = hit.normal;
+	guide.depth = distance;
+	guide.shape = int(&shape-myShapeList.begin());
+	return guide;
+}
+
+// the mirror reflection at a hit, followed for up to times bounces; the
+// albedo of what it sees is added to guide's, if given, so that the
+// denoiser keeps the edges of reflections
+vec3 reflectedColor(const HitPoint &hit, const Shape &shape, Random *random, int times, PixelGuide *guide=nullptr){
+	if(shape.specularColor==vec3(0,0,0) || times<=0)
+		return vec3(0,0,0);
+	Ray reflectionRay;
+	reflectionRay.origin = hit.position;
+	reflectionRay.dirVector = hit.direction - 2*dot(hit.direction,hit.normal)*hit.normal;
+	PixelGuide reflected;
+	vec3 color = shape.specularColor*raycolorRe(reflectionRay,0.0001,99999.9f,random,times-1,guide ? &reflected : nullptr);
+	if(guide)
+		guide->albedo += shape.specularColor*reflected.albedo;
+	return color;
+}
+
+vec3 raycolorRe(Ray ray, float lowerBound, float upperBound,Random *random,int times,PixelGuide *guide){
 		IntersectionInfo info;
-		if(testIntersections(ray,myShapeList,&info,lowerBound,upperBound)){
-			vec3 d = ray.dirVector;
-			vec3 color = vec3(0,0,0);
-			vec3 n = surfaceNormalVector(ray,info);
-			vec3 v = normalize(-d);
-			vec3 intersectP = ray.origin+info.t*d;
-			color = info.shape.color*vec3(.4f,.4f,.4f);
-				
-			Ray shadowRay;
-			shadowRay.origin = intersectP;
-			shadowRay.dirVector = (light.origin-shadowRay.origin);
-			IntersectionInfo emptyInfo;
-			if(!testIntersections(shadowRay,myShapeList,&emptyInfo,0.0001f,1.0f)){				
-				vec3 l = normalize(light.origin-intersectP);
-				vec3 kd = info.shape.color;
-				vec3 I = light.color;					
-				vec3 ks = info.shape.specularHighLight;			
-				vec3 h = normalize(v+l);
-				color = color+kd*I*glm::max(.0f,dot(n,l))+ks*I*(float)(pow(glm::max(.0f,dot(n,h)),info.shape.PEx));
-			}
-			vec3 r = normalize(d) - 2*dot(normalize(d),n)*n;
-			vec3 km = info.shape.specularColor;
-			Ray reflectionRay;
-			reflectionRay.origin = intersectP;
-			reflectionRay.dirVector = r;
-			if(info.shape.specularColor==vec3(0,0,0))
-				times=0;
-			if(times>0){
-				times--;
-				return color+km*raycolorRe(reflectionRay,0.0001,99999.9f,light,times);
-			}else{
-				return color;
-			}
+		if(intersectBVH(myBVH,myShapeList,ray,&info,lowerBound,upperBound)){
+			HitPoint hit = makeHitPoint(ray,info);
+			if(guide)
+				*guide = hitGuide(*info.shape,hit,info.t*length(ray.dirVector));
+			vec3 ambient = ambientColor(*info.shape);
+			vec3 color = ambient+directLight(hit,*info.shape,ambient,random);
+			return color+reflectedColor(hit,*info.shape,random,times,guide);
 		}else{
 			return vec3(0,0,0);
 		}
 	
 }
 
+// samples taken per pixel
+int pixelSamples(){
+	return mySamplerOptions.type==SAMPLER_FIXED ? 1 : mySamplerOptions.samples;
+}
+
+// camera ray and random numbers for sample s of pixel (i, j): without a
+// sampler, the ray through the pixel corner; with one, the sample's first
+// two dimensions place the ray and the rest lead the random numbers, so
+// point must outlive random
+Ray sampleRay(int i, int j, int s, int width, int height, float *point){
+	if(mySamplerOptions.type==SAMPLER_FIXED)
+		return generateRay(i,j,width,height,myCameraOrigin,myFocalLength);
+	pixelSample(mySamplerOptions,i,j,s,point,mySampleDimensions);
+	return generateRay(i+point[0],j+point[1],width,height,myCameraOrigin,myFocalLength);
+}
+
+Random sampleRandom(int i, int j, int s, int height, const float *point){
+	Random random(i*height+j,(uint64_t(mySamplerOptions.seed)<<32)|s);
+	if(mySamplerOptions.type!=SAMPLER_FIXED){
+		random.leading = point+2;
+		random.leadingCount = mySampleDimensions-2;
+	}
+	return random;
+}
+
+// the color of sample s of pixel (i, j), and what it hit if guide is given
+vec3 renderSample(int i, int j, int s, int width, int height, PixelGuide *guide=nullptr){
+	float point[SAMPLE_DIMENSIONS];
+	Ray ray = sampleRay(i,j,s,width,height,point);
+	Random random = sampleRandom(i,j,s,height,point);
+	return raycolorRe(ray,.0f,9999.9f,&random,10,guide);
+}
+
+// copies a tile's guides, stored by column like its colours, into
+// myGuides a row at a time; writing them down the columns of the image
+// costs more than working them out
+void storeGuides(const Tile &tile, int width, const PixelGuide *guides){
+	for(int y=0;y<tile.height;y++){
+		PixelGuide *row = &myGuides[(tile.y+y)*width+tile.x];
+		for(int x=0;x<tile.width;x++)
+			row[x] = guides[x*tile.height+y];
+	}
+}
+
+// renders one tile a pixel at a time; colors are stored by column
+void renderTile(const Tile &tile, int width, int height, vec3 *colors){
+	int samples = pixelSamples();
+	bool guides = !myGuides.empty();
+	static thread_local vector<PixelGuide> tileGuides;
+	if(guides)
+		tileGuides.resize(tile.width*tile.height);
+	for(int x=0;x<tile.width;x++){
+		for(int y=0;y<tile.height;y++){
+			int i = tile.x+x, j = tile.y+y;
+			vec3 color = vec3(0,0,0);
+			GuideAccumulator guide;
+			for(int s=0;s<samples;s++){
+				PixelGuide sampleGuide;
+				color += renderSample(i,j,s,width,height,guides ? &sampleGuide : nullptr);
+				guide.add(sampleGuide);
+			}
+			if(guides)
+				tileGuides[x*tile.height+y] = guide.average();
+			colors[x*tile.height+y] = samples==1 ? color : color/float(samples);
+		}
+	}
+	if(guides)
+		storeGuides(tile,width,tileGuides.data());
+}
+
+// renders one tile with its own list of lights: the tile's primary hits are
+// found first and the lights that cannot reach any of them are dropped;
+// reflections take theirs from the world space light grid
+void renderTileCulled(const Tile &tile, int width, int height, vec3 *colors, int *lightCount){
+	int samples = pixelSamples();
+	int count = tile.width*tile.height*samples;
+	vector<Ray> rays(count);
+	vector<IntersectionInfo> infos(count);
+	vector<char> valid(count);
+	vector<float> points(count*SAMPLE_DIMENSIONS);
+	AABB bounds;
+	for(int x=0;x<tile.width;x++){
+		for(int y=0;y<tile.height;y++){
+			for(int s=0;s<samples;s++){
+				int k = (x*tile.height+y)*samples+s;
+				rays[k] = sampleRay(tile.x+x,tile.y+y,s,width,height,&points[k*SAMPLE_DIMENSIONS]);
+				valid[k] = intersectBVH(myBVH,myShapeList,rays[k],&infos[k],.0f,9999.9f);
+				if(valid[k])
+					bounds.grow(rays[k].origin+infos[k].t*rays[k].dirVector);
+			}
+		}
+	}
+
+	static thread_local vector<int> lights;
+	cullLights(myLightList,bounds,&lights);
+	*lightCount = lights.size();
+
+	bool guides = !myGuides.empty();
+	static thread_local vector<PixelGuide> tileGuides;
+	if(guides)
+		tileGuides.resize(tile.width*tile.height);
+	for(int x=0;x<tile.width;x++){
+		for(int y=0;y<tile.height;y++){
+			vec3 color = vec3(0,0,0);
+			GuideAccumulator guide;
+			for(int s=0;s<samples;s++){
+				int k = (x*tile.height+y)*samples+s;
+				if(!valid[k]){
+					guide.add(PixelGuide());
+				}else{
+					const Shape &shape = *infos[k].shape;
+					HitPoint hit = makeHitPoint(rays[k],infos[k]);
+					PixelGuide sampleGuide = hitGuide(shape,hit,infos[k].t*length(rays[k].dirVector));
+					Random random = sampleRandom(tile.x+x,tile.y+y,s,height,&points[k*SAMPLE_DIMENSIONS]);
+					color += ambientColor(shape)+shadeLightList(hit,shape,lights.data(),lights.size(),&random);
+					color += reflectedColor(hit,shape,&random,10,guides ? &sampleGuide : nullptr);
+					guide.add(sampleGuide);
+				}
+			}
+			colors[x*tile.height+y] = samples==1 ? color : color/float(samples);
+			if(guides)
+				tileGuides[x*tile.height+y] = guide.average();
+		}
+	}
+	if(guides)
+		storeGuides(tile,width,tileGuides.data());
+}
+
+// renders one tile with ReSTIR: reservoirs for all of the tile's primary
+// hits first, then each merges some of its neighbours', then shading with
+// one shadow ray per hit; reflections are resampled without reuse
+void renderTileRestir(const Tile &tile, int width, int height, vec3 *colors){
+	int x0 = tile.x, y0 = tile.y, tileWidth = tile.width, tileHeight = tile.height;
+	struct PrimaryHit{
+		bool valid;
+		const Shape *shape;
+		HitPoint hit;
+		float distance;
+		Reservoir reservoir;
+		Random random;
+	};
+	vector<PrimaryHit> hits(tileWidth*tileHeight);
+	for(int x=0;x<tileWidth;x++){
+		for(int y=0;y<tileHeight;y++){
+			int i = x0+x, j = y0+y;
+			PrimaryHit &p = hits[x*tileHeight+y];
+			p.random = Random(i*height+j,0);
+			Ray ray = generateRay(i,j,width,height,myCameraOrigin,myFocalLength);
+			IntersectionInfo info;
+			p.valid = intersectBVH(myBVH,myShapeList,ray,&info,.0f,9999.9f);
+			if(p.valid){
+				p.shape = info.shape;
+				p.hit = makeHitPoint(ray,info);
+				p.distance = info.t*length(ray.dirVector);
+				p.reservoir = sampleReservoir(myLightList,myLightDistribution,p.hit,*p.shape,surfaceResponse,myRestirOptions,&p.random);
+			}
+		}
+	}
+
+	vector<Reservoir> reused(hits.size());
+	vector<const Reservoir*> merged;
+	int radius = myRestirOptions.radius;
+	for(int x=0;x<tileWidth;x++){
+		for(int y=0;y<tileHeight;y++){
+			PrimaryHit &p = hits[x*tileHeight+y];
+			if(!p.valid) continue;
+			merged.assign(1,&p.reservoir);
+			for(int k=0;k<myRestirOptions.neighbors;k++){
+				int nx = x+int(p.random.nextUInt()%(2*radius+1))-radius;
+				int ny = y+int(p.random.nextUInt()%(2*radius+1))-radius;
+				if(nx<0 || ny<0 || nx>=tileWidth || ny>=tileHeight || (nx==x && ny==y)) continue;
+				const PrimaryHit &q = hits[nx*tileHeight+ny];
+				if(q.valid && similarSurfaces(p.hit,p.distance,q.hit,q.distance))
+					merged.push_back(&q.reservoir);
+			}
+			reused[x*tileHeight+y] = combineReservoirs(myLightList,p.hit,*p.shape,&merged[0],merged.size(),surfaceResponse,&p.random);
+		}
+	}
 
+	bool guides = !myGuides.empty();
+	vector<PixelGuide> tileGuides(guides ? hits.size() : 0);
+	for(int x=0;x<tileWidth;x++){
+		for(int y=0;y<tileHeight;y++){
+			PrimaryHit &p = hits[x*tileHeight+y];
+			vec3 color = vec3(0,0,0);
+			PixelGuide guide;
+			if(p.valid){
+				guide = hitGuide(*p.shape,p.hit,p.distance);
+				vec3 ambient = ambientColor(*p.shape);
+				color = ambient+shadeReservoir(myLightList,p.hit,*p.shape,reused[x*tileHeight+y],surfaceResponse,lightVisible,&p.random);
+				color = color+reflectedColor(p.hit,*p.shape,&p.random,10,guides ? &guide : nullptr);
+			}
+			colors[x*tileHeight+y] = color;
+			if(guides)
+				tileGuides[x*tileHeight+y] = guide;
+		}
+	}
+	if(guides)
+		storeGuides(tile,width,tileGuides.data());
+}
+
+// the first hit of a pixel's ray and its mirror reflections, found as
+// raycolorRe finds them, for the G-buffer
+void tracePixel(int i, int j, int width, int height, vector<GBufferHit> *chain){
+	float point[SAMPLE_DIMENSIONS];
+	Ray ray = sampleRay(i,j,0,width,height,point);
+	float lowerBound = .0f, upperBound = 9999.9f;
+	for(int times=10;;times--){
+		IntersectionInfo info;
+		if(!intersectBVH(myBVH,myShapeList,ray,&info,lowerBound,upperBound))
+			return;
+		GBufferHit hit;
+		hit.hit = makeHitPoint(ray,info);
+		hit.shape = info.index;
+		chain->push_back(hit);
+		if(info.shape->specularColor==vec3(0,0,0) || times<=0)
+			return;
+		ray.origin = hit.hit.position;
+		ray.dirVector = hit.hit.direction - 2*dot(hit.hit.direction,hit.hit.normal)*hit.hit.normal;
+		lowerBound = 0.0001f;
+		upperBound = 99999.9f;
+	}
+}
+
+// the denoiser's guides for a G-buffer tile, from each pixel's first hit
+// and, as reflectedColor adds them, its reflections' albedo
+void gbufferGuides(const GBuffer &gbuffer, int tileIndex, int width){
+	const Tile &tile = gbuffer.tiles[tileIndex];
+	const GBufferTile &data = gbuffer.data[tileIndex];
+	for(int y=0;y<tile.height;y++){
+		for(int x=0;x<tile.width;x++){
+			int k = x*tile.height+y;
+			PixelGuide guide;
+			if(data.start[k]<data.start[k+1]){
+				const GBufferHit &first = data.hits[data.start[k]];
+				guide = hitGuide(myShapeList[first.shape],first.hit,length(first.hit.position-myCameraOrigin));
+				vec3 weight = myShapeList[first.shape].specularColor;
+				for(int h=data.start[k]+1;h<data.start[k+1];h++){
+					const Shape &shape = myShapeList[data.hits[h].shape];
+					guide.albedo += weight*shape.color;
+					weight *= shape.specularColor;
+				}
+			}
+			myGuides[(tile.y+y)*width+tile.x+x] = guide;
+		}
+	}
+}
+
+// a G-buffer hit's own colour, as raycolorRe shades it before reflecting
+vec3 shadeHit(const GBufferHit &hit, Random *random){
+	const Shape &shape = myShapeList[hit.shape];
+	vec3 ambient = ambientColor(shape);
+	return ambient+directLight(hit.hit,shape,ambient,random);
+}
+
+// the random numbers of the one sample of pixel (i, j), for the G-buffer
+Random pixelRandom(int i, int j, int width, int height, float *point){
+	sampleRay(i,j,0,width,height,point);
+	return sampleRandom(i,j,0,height,point);
+}
+
+// makes lights the scene's lights, with everything the shading methods
+// build over them
+void setLights(const vector<Light> &lights){
+	myLightList = lights;
+	buildLightTree(&myLightTree,myLightList);
+	buildLightDistribution(&myLightDistribution,myLightList);
+	if(myLightCulling)
+		buildLightGrid(&myLightGrid,myLightList);
+
+	// paths draw random numbers only for area lights and stochastic choices
+	// of lights; otherwise a sampler need only place the camera ray
+	bool drawsNumbers = myRestir || myLightCutOptions.mode==LIGHT_CUT_STOCHASTIC;
+	for(const Light &light : myLightList)
+		drawsNumbers = drawsNumbers || light.shape!=LIGHT_POINT;
+	mySampleDimensions = drawsNumbers ? SAMPLE_DIMENSIONS : 2;
+}
+
+// renders every tile on workers threads and hands each one to deliver as
+// it is finished, one at a time; the threads' counters are summed into
+// this thread's once they are done
+void renderImage(const vector<Tile> &tiles, int workers,
+		const function<void(const Tile &tile, vec3 *colors)> &render,
+		const function<void(const Tile &tile, const vec3 *colors)> &deliver){
+	mutex deliverMutex;
+	TraversalStats traversalTotal;
+	LightCutStats lightTotal;
+	AreaLightStats areaTotal;
+	renderTiles(tiles, workers, [&](const Tile &tile, int worker) {
+		vector<vec3> colors(tile.width*tile.height);
+		render(tile, &colors[0]);
+		lock_guard<mutex> lock(deliverMutex);
+		deliver(tile, &colors[0]);
+	}, [&](int worker) {
+		lock_guard<mutex> lock(deliverMutex);
+		traversalTotal.add(bvhStats);
+		lightTotal.add(lightStats);
+		areaTotal.add(areaStats);
+	});
+	bvhStats = traversalTotal;
+	lightStats = lightTotal;
+	areaStats = areaTotal;
+}
+
+// samples the image adaptively; every pass goes through renderImage, and
+// the counters of all of them are summed into this thread's. passed, if
+// given, is called with each tile after every pass over it, one at a time
+void renderImageAdaptive(const vector<Tile> &tiles, int width, int height, int workers,
+		const AdaptiveOptions &options, vector<PixelEstimate> *pixels, AdaptiveStats *stats,
+		const function<void(const Tile &tile)> &passed){
+	TraversalStats traversalTotal;
+	LightCutStats lightTotal;
+	AreaLightStats areaTotal;
+	renderAdaptive(tiles,width,height,options,[&](const vector<Tile> &passTiles, const function<void(const Tile &tile)> &render){
+		bvhStats = TraversalStats();
+		lightStats = LightCutStats();
+		areaStats = AreaLightStats();
+		renderImage(passTiles,workers,[&](const Tile &tile, vec3 *colors){
+			render(tile);
+		},[&](const Tile &tile, const vec3 *colors){
+			if(passed) passed(tile);
+		});
+		traversalTotal.add(bvhStats);
+		lightTotal.add(lightStats);
+		areaTotal.add(areaStats);
+	},[&](int x, int y, int index){
+		// the guides come from each pixel's first sample
+		if(index>0 || myGuides.empty())
+			return renderSample(x,y,index,width,height);
+		PixelGuide guide;
+		vec3 color = renderSample(x,y,index,width,height,&guide);
+		myGuides[y*width+x] = guide;
+		return color;
+	},pixels,stats);
+	bvhStats = traversalTotal;
+	lightStats = lightTotal;
+	areaStats = areaTotal;
+}
+
+// a hash of the scene file and of every option that changes what the
+// tiles of a render hold, for checkpoints; options that only change how or
+// where the result is written, or how fast it is made, are left out
+uint64_t hashRenderSettings(const char *sceneFile, const BVHBuildOptions &bvhOptions, int argc, char *argv[]){
+	// the options left out, and how many values each takes
+	static const pair<const char *, int> unrelated[] = {
+		{"--headless",0}, {"--scene",1}, {"--output",1}, {"--png-level",1}, {"--exposure",1},
+		{"--tonemap",1}, {"--srgb",0}, {"--stream",1}, {"--save-queue",1}, {"--out-of-core",1},
+		{"--checkpoint",1}, {"--checkpoint-interval",1}, {"--resume",0}, {"--threads",1},
+		{"--accel-cache",1}, {"--shared-scene",1}, {"--sample-counts",1}, {"--bench-shading",1}
+	};
+	// the scene's path is left out, its contents are hashed instead
+	uint64_t hash = hashSceneFile(sceneFile, bvhOptions);
+	for(int i=1;i<argc;i++){
+		int values = -1;
+		for(const pair<const char *, int> &option : unrelated)
+			if(strcmp(argv[i],option.first)==0) values = option.second;
+		if(values>=0){
+			i += values;
+			continue;
+		}
+		hash = hashBytes(hash,argv[i],strlen(argv[i])+1);
+	}
+	return hash;
+}
+
+// renders a tile by the shading method selected on the command line;
+// lightCount is set to the size of the tile's light list when culling
+void renderTileByMode(const Tile &tile, int width, int height, vec3 *colors, int *lightCount){
+	*lightCount = 0;
+	if (myRestir)
+		renderTileRestir(tile, width, height, colors);
+	else if (myLightCulling)
+		renderTileCulled(tile, width, height, colors, lightCount);
+	else
+		renderTile(tile, width, height, colors);
+}
+
+// moves a shape by offset; its precomputed normal does not change
+void translateShape(Shape &shape, vec3 offset){
+	if(shape.type==2){
+		for(vec3 &vertex : shape.data)
+			vertex += offset;
+	}else if(shape.type==1){
+		shape.data[1] += offset; // the point, data[0] is the normal
+	}else{
+		shape.data[0] += offset;
+	}
+}
+
+// times hit setup and shadeDirect alone: primary hits are found once up
+// front and the shadow test is taken as passed, so no intersection work is
+// timed
+void benchmarkShading(const Light &light, int width, int height, int passes){
+	vector<Ray> rays;
+	vector<IntersectionInfo> infos;
+	for(int i=0;i<width;i++){
+		for(int j=0;j<height;j++){
+			Ray ray = generateRay(i,j,width,height,myCameraOrigin,myFocalLength);
+			IntersectionInfo info;
+			if(intersectBVH(myBVH,myShapeList,ray,&info,.0f,9999.9f)){
+				rays.push_back(ray);
+				infos.push_back(info);
+			}
+		}
+	}
+	if(rays.empty()){
+		cout << "Shading benchmark: no hits" << endl;
+		return;
+	}
+
+	vec3 sum = vec3(0,0,0);
+	auto start = chrono::steady_clock::now();
+	for(int pass=0;pass<passes;pass++){
+		for(size_t k=0;k<rays.size();k++){
+			HitPoint hit = makeHitPoint(rays[k],infos[k]);
+			sum += shadeDirect(hit,*infos[k].shape,light,light.origin-hit.position,true);
+		}
+	}
+	double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	cout << "Shading benchmark: " << rays.size()*passes << " hits, "
+		<< elapsed/(rays.size()*passes) << " ns per hit (checksum "
+		<< sum.x+sum.y+sum.z << ")" << endl;
+}
+
+// renders the scene with every sampler at 1, 2, 4, ... maxSamples samples
+// per pixel and writes each image's RMSE (in 8 bit steps, colours clamped
+// as they are saved) against a Sobol reference of 16*maxSamples samples
+// with another seed to file as CSV, one row per sample count
+void benchmarkSamplers(int maxSamples, const char *file, int width, int height, int workers, int tileSize){
+	const SamplerType samplers[] = {SAMPLER_RANDOM, SAMPLER_STRATIFIED, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE};
+	SamplerOptions saved = mySamplerOptions;
+	vector<Tile> tiles = makeTiles(width,height,tileSize);
+	vector<vec3> image(width*height);
+	auto render = [&](SamplerType type, int samples, uint32_t seed){
+		mySamplerOptions.type = type;
+		mySamplerOptions.samples = samples;
+		mySamplerOptions.seed = seed;
+		auto start = chrono::steady_clock::now();
+		renderImage(tiles,workers,[&](const Tile &tile, vec3 *colors){
+			int lightCount;
+			renderTileByMode(tile,width,height,colors,&lightCount);
+		},[&](const Tile &tile, const vec3 *colors){
+			for(int x=0;x<tile.width;x++)
+				for(int y=0;y<tile.height;y++)
+					image[(tile.y+y)*width+tile.x+x] = clamp(colors[x*tile.height+y],0.0f,1.0f);
+		});
+		return chrono::duration<double, milli>(chrono::steady_clock::now()-start).count();
+	};
+
+	int referenceSamples = 16*maxSamples;
+	double referenceTime = render(SAMPLER_SOBOL,referenceSamples,1);
+	vector<vec3> reference = image;
+	cout << "Sampler benchmark: reference of " << referenceSamples << " samples per pixel in " << referenceTime << " ms" << endl;
+
+	ofstream csv(file);
+	csv << "spp";
+	cout << "spp";
+	for(SamplerType type : samplers){
+		csv << "," << samplerName(type);
+		cout << "\t" << samplerName(type);
+	}
+	csv << endl;
+	cout << endl;
+	// least squares fit of log RMSE against log spp, the convergence rate
+	const int count = 4;
+	double sumX = 0, sumXX = 0, sumY[count] = {}, sumXY[count] = {};
+	int rows = 0;
+	for(int samples=1;samples<=maxSamples;samples*=2){
+		csv << samples;
+		cout << samples;
+		for(int t=0;t<count;t++){
+			render(samplers[t],samples,0);
+			double squares = 0;
+			for(int p=0;p<width*height;p++){
+				vec3 d = (image[p]-reference[p])*255.0f;
+				squares += dot(d,d);
+			}
+			double rmse = sqrt(squares/(3.0*width*height));
+			csv << "," << rmse;
+			cout << "\t" << rmse;
+			sumY[t] += log(rmse);
+			sumXY[t] += log(double(samples))*log(rmse);
+		}
+		sumX += log(double(samples));
+		sumXX += log(double(samples))*log(double(samples));
+		rows++;
+		csv << endl;
+		cout << endl;
+	}
+	if(rows>1){
+		cout << "RMSE ~ spp^k, k:";
+		for(int t=0;t<count;t++)
+			cout << " " << samplerName(samplers[t]) << " " << (rows*sumXY[t]-sumX*sumY[t])/(rows*sumXX-sumX*sumX);
+		cout << endl;
+	}
+	mySamplerOptions = saved;
+}
+
+// times turning an 8K frame of colours into bytes as saving does: first
+// the scalar clamp and cast per channel saving used to do, then
+// quantizeImage on one worker and on workers for every tone curve, with
+// and without sRGB. The colours are random up to 2, so half are clamped
+void benchmarkQuantize(int passes, int workers){
+	const int width = 7680, height = 4320;
+	vector<vec3> colors(width*height);
+	Random random(1, 0);
+	for(vec3 &color : colors)
+		color = 2.0f*vec3(random.nextFloat(), random.nextFloat(), random.nextFloat());
+	vector<unsigned char> reference(width*height*3), pixels(width*height*3);
+	double megapixels = double(width)*height/1e6;
+
+	auto start = chrono::steady_clock::now();
+	for(int pass=0;pass<passes;pass++){
+		for(int y=0;y<height;y++){
+			for(int x=0;x<width;x++){
+				const vec3 &color = colors[y*width+x];
+				int i = ((height-1-y)*width+x)*3;
+				reference[i] = (unsigned char)(255*clamp(color.r,0.f,1.f));
+				reference[i+1] = (unsigned char)(255*clamp(color.g,0.f,1.f));
+				reference[i+2] = (unsigned char)(255*clamp(color.b,0.f,1.f));
+			}
+		}
+	}
+	double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()/passes;
+	cout << "Quantize benchmark: " << width << "x" << height << ", scalar loop "
+		<< elapsed << " ms per frame (" << megapixels*1000/elapsed << " Mpixel/s)" << endl;
+
+	vector<int> workerCounts(1, 1);
+	if(workers > 1) workerCounts.push_back(workers);
+	for(int curve=TONE_CLAMP;curve<=TONE_ACES;curve++){
+		for(int srgb=0;srgb<2;srgb++){
+			for(int count : workerCounts){
+				ToneMapOptions options;
+				options.curve = ToneCurve(curve);
+				options.srgb = srgb;
+				options.workers = count;
+				start = chrono::steady_clock::now();
+				for(int pass=0;pass<passes;pass++)
+					quantizeImage(colors.data(), width, height, options, pixels.data());
+				elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()/passes;
+				cout << "Quantize benchmark: " << toneCurveName(options.curve) << (srgb ? ", sRGB" : "")
+					<< ", " << count << " worker" << (count > 1 ? "s " : " ") << elapsed << " ms per frame ("
+					<< megapixels*1000/elapsed << " Mpixel/s)";
+				if(curve == TONE_CLAMP && !srgb)
+					cout << (pixels == reference ? ", same bytes as the scalar loop" : ", DIFFERENT bytes from the scalar loop");
+				cout << endl;
+			}
+		}
+	}
+}
+
+
+
+// faults a daemon can be told to have, for trying out the coordinator
+struct ServeFaults{
+	int failAfterTiles = -1; // exit without a word after sending this many tiles
+	int tileDelay = 0;       // milliseconds added to every tile
+};
+
+// the render daemon: the scene and its BVH stay loaded while requests come
+// in over a socket, one line each (see the README); tiles are streamed
+// back as soon as they are done; false if it could not listen
+bool serveRequests(const char *socketPath, int workers, int tileSize, const BVHBuildOptions &bvhOptions,
+		const ServeFaults &faults){
+	int listener = listenAddress(socketPath);
+	if(listener<0){
+		cout << "cannot listen on " << socketPath << " (" << strerror(errno) << ")" << endl;
+		return false;
+	}
+	cout << "Serving on " << socketPath << endl;
+	bool serving = true;
+	int tilesSent = 0;
+	Connection client;
+	while(serving && acceptConnection(listener,&client)){
+		string line;
+		while(serving && client.readLine(&line)){
+			istringstream request(line);
+			string command;
+			request >> command;
+			if(command=="render"){
+				int width = 0, height = 0;
+				request >> width >> height;
+				if(!request || width<=0 || height<=0 || width>FARM_MAX_SIZE || height>FARM_MAX_SIZE){
+					client.writeLine("error render needs a width and height");
+					continue;
+				}
+				myCameraOrigin = vec3(0,0,0);
+				myFocalLength = 2.0f;
+				Tile region = {0,0,0,width,height};
+				string option;
+				while(request >> option){
+					if(option=="camera")
+						request >> myCameraOrigin.x >> myCameraOrigin.y >> myCameraOrigin.z;
+					else if(option=="focal")
+						request >> myFocalLength;
+					else if(option=="region")
+						request >> region.x >> region.y >> region.width >> region.height;
+				}
+				if(region.x<0 || region.y<0 || region.width<=0 || region.height<=0 ||
+						region.x+region.width>width || region.y+region.height>height){
+					client.writeLine("error region outside the image");
+					continue;
+				}
+
+				auto start = chrono::steady_clock::now();
+				vector<Tile> tiles = makeRegionTiles(region.x,region.y,region.width,region.height,tileSize);
+				client.writeLine("image "+to_string(width)+" "+to_string(height)+" "+to_string(tiles.size()));
+				vector<unsigned char> bytes;
+				renderImage(tiles,workers,[&](const Tile &tile, vec3 *colors){
+					int lightCount;
+					renderTileByMode(tile,width,height,colors,&lightCount);
+					if(faults.tileDelay>0)
+						this_thread::sleep_for(chrono::milliseconds(faults.tileDelay));
+				},[&](const Tile &tile, const vec3 *colors){
+					if(faults.failAfterTiles>=0 && tilesSent>=faults.failAfterTiles){
+						cout << "Failing on purpose after " << tilesSent << " tiles" << endl;
+						_exit(1);
+					}
+					tilesSent++;
+					// rows bottom up, quantized as ImageBuffer saves them
+					bytes.resize(tile.width*tile.height*3);
+					for(int y=0;y<tile.height;y++){
+						for(int x=0;x<tile.width;x++){
+							const vec3 &c = colors[x*tile.height+y];
+							unsigned char *pixel = &bytes[(y*tile.width+x)*3];
+							pixel[0] = (unsigned char)(255*glm::clamp(c.r,0.f,1.f));
+							pixel[1] = (unsigned char)(255*glm::clamp(c.g,0.f,1.f));
+							pixel[2] = (unsigned char)(255*glm::clamp(c.b,0.f,1.f));
+						}
+					}
+					client.writeLine("tile "+to_string(tile.x)+" "+to_string(tile.y)+" "+to_string(tile.width)+" "+to_string(tile.height));
+					client.write(&bytes[0],bytes.size());
+				});
+				double time = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+				client.writeLine("done "+to_string(time));
+				if(region.width<width || region.height<height)
+					cout << "Served: " << region.width << "x" << region.height << " of " << width << "x" << height << " in " << time << " ms" << endl;
+				else
+					cout << "Served: " << width << "x" << height << " in " << time << " ms" << endl;
+			}else if(command=="lights"){
+				string file;
+				request >> file;
+				if(!ifstream(file).good()){
+					client.writeLine("error cannot read "+file);
+					continue;
+				}
+				vector<Shape> ignoredShapes;
+				vector<Light> lights;
+				readFile(ignoredShapes,lights,file.c_str());
+				setLights(lights);
+				client.writeLine("ok "+to_string(lights.size()));
+			}else if(command=="scene"){
+				string file;
+				request >> file;
+				if(!ifstream(file).good()){
+					client.writeLine("error cannot read "+file);
+					continue;
+				}
+				vector<Shape> shapes;
+				vector<Light> lights;
+				readFile(shapes,lights,file.c_str());
+				precomputeShapes(shapes);
+				myShapeStorage = shapes;
+				myShapeList = myShapeStorage;
+				mySharedScene = SharedScene();
+				setLights(lights);
+				buildBVH(&myBVH,myShapeList,bvhOptions);
+				client.writeLine("ok "+to_string(myShapeList.size())+" "+to_string(myLightList.size()));
+			}else if(command=="quit"){
+				serving = false;
+			}else{
+				client.writeLine("error unknown request "+command);
+			}
+		}
+		client.close();
+	}
+	close(listener);
+	if(isSocketPath(socketPath)) removeSocketFile(socketPath);
+	return true;
+}
 
 vec3 reflectionEquation(){
 	return vec3(0,0,0);
@@ -639,71 +1507,816 @@ void printLines(const char* filename){
 
 int main(int argc, char *argv[])
 {
-	// initialize the GLFW windowing system
-	if (!glfwInit()) {
-		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
+	// parse command line options
+	const char *sceneFile = "scene3.txt";
+	const char *outputFile = "renderImage.png";
+	bool headless = false;
+	const char *accelCacheDir = 0;
+	const char *sharedSceneDir = 0;
+	int shadingBenchPasses = 0;
+	int samplerBenchSamples = 0;
+	const char *samplerBenchFile = 0;
+	bool samplerGiven = false;
+	bool samplesGiven = false;
+	bool adaptive = false;
+	AdaptiveOptions adaptiveOptions;
+	const char *sampleCountFile = 0;
+	bool denoise = false;
+	const char *aovPrefix = 0;
+	DenoiseOptions denoiseOptions;
+	PngOptions pngOptions;
+	ToneMapOptions toneMap;
+	int quantizeBenchPasses = 0;
+	int saveQueueLength = 2;
+	const char *streamPath = 0;
+	int imageWidth = 512, imageHeight = 512;
+	const char *framePath = 0;
+	const char *checkpointPath = 0;
+	double checkpointInterval = 30;
+	bool resume = false;
+	int workers = defaultWorkerCount();
+	int tileSize = 16;
+	vector<pair<string, string>> relights; // light file, output image
+	struct Move { int shape; vec3 offset; string output; };
+	vector<Move> moves;
+	const char *socketPath = 0;
+	ServeFaults serveFaults;
+	vector<string> farmWorkers;
+	FarmOptions farmOptions;
+	BVHBuildOptions bvhOptions;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--headless") {
+			headless = true;
+		} else if (arg == "--scene" && i + 1 < argc) {
+			sceneFile = argv[++i];
+		} else if (arg == "--output" && i + 1 < argc) {
+			outputFile = argv[++i];
+		} else if (arg == "--png-level" && i + 1 < argc) {
+			pngOptions.level = atoi(argv[++i]);
+		} else if (arg == "--exposure" && i + 1 < argc) {
+			toneMap.exposure = atof(argv[++i]);
+		} else if (arg == "--tonemap" && i + 1 < argc) {
+			if (!parseToneCurve(argv[++i], &toneMap.curve)) {
+				cout << "unknown tone curve " << argv[i] << endl;
+				return -1;
+			}
+		} else if (arg == "--srgb") {
+			toneMap.srgb = true;
+		} else if (arg == "--bench-quantize" && i + 1 < argc) {
+			quantizeBenchPasses = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--stream" && i + 1 < argc) {
+			streamPath = argv[++i];
+		} else if (arg == "--size" && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &imageWidth, &imageHeight) != 2 || imageWidth <= 0 || imageHeight <= 0) {
+				cout << "--size takes WIDTHxHEIGHT, not " << argv[i] << endl;
+				return -1;
+			}
+		} else if (arg == "--out-of-core" && i + 1 < argc) {
+			framePath = argv[++i];
+			headless = true;
+		} else if (arg == "--checkpoint" && i + 1 < argc) {
+			checkpointPath = argv[++i];
+		} else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+			checkpointInterval = std::max(0.1, atof(argv[++i]));
+		} else if (arg == "--resume") {
+			resume = true;
+		} else if (arg == "--save-queue" && i + 1 < argc) {
+			saveQueueLength = std::max(0, atoi(argv[++i]));
+		} else if (arg == "--split-budget" && i + 1 < argc) {
+			bvhOptions.splitBudget = atof(argv[++i]);
+		} else if (arg == "--bvh-layout" && i + 1 < argc) {
+			string layout = argv[++i];
+			if (layout == "depth-first") bvhOptions.layout = BVH_LAYOUT_DEPTH_FIRST;
+			else if (layout == "treelet") bvhOptions.layout = BVH_LAYOUT_TREELET;
+			else if (layout == "probe") bvhOptions.layout = BVH_LAYOUT_PROBE;
+			else {
+				cout << "unknown BVH layout " << layout << endl;
+				return -1;
+			}
+		} else if (arg == "--bench-shading" && i + 1 < argc) {
+			shadingBenchPasses = atoi(argv[++i]);
+		} else if (arg == "--accel-cache" && i + 1 < argc) {
+			accelCacheDir = argv[++i];
+		} else if (arg == "--shared-scene" && i + 1 < argc) {
+			sharedSceneDir = argv[++i];
+		} else if (arg == "--light-cut" && i + 1 < argc) {
+			string mode = argv[++i];
+			if (mode == "deterministic") myLightCutOptions.mode = LIGHT_CUT_DETERMINISTIC;
+			else if (mode == "stochastic") myLightCutOptions.mode = LIGHT_CUT_STOCHASTIC;
+			else {
+				cout << "unknown light cut mode " << mode << endl;
+				return -1;
+			}
+		} else if (arg == "--light-error" && i + 1 < argc) {
+			myLightCutOptions.errorRatio = atof(argv[++i]);
+		} else if (arg == "--light-cut-max" && i + 1 < argc) {
+			myLightCutOptions.maxCut = atoi(argv[++i]);
+		} else if (arg == "--light-samples" && i + 1 < argc) {
+			myLightCutOptions.samples = atoi(argv[++i]);
+		} else if (arg == "--light-culling") {
+			myLightCulling = true;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			workers = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--tile-size" && i + 1 < argc) {
+			tileSize = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--area-probes" && i + 1 < argc) {
+			myAreaLightOptions.probes = atoi(argv[++i]);
+		} else if (arg == "--area-samples" && i + 1 < argc) {
+			myAreaLightOptions.samples = atoi(argv[++i]);
+		} else if (arg == "--relight" && i + 2 < argc) {
+			relights.push_back(make_pair(string(argv[i + 1]), string(argv[i + 2])));
+			i += 2;
+		} else if (arg == "--move" && i + 5 < argc) {
+			Move move;
+			move.shape = atoi(argv[i + 1]);
+			move.offset = vec3(atof(argv[i + 2]), atof(argv[i + 3]), atof(argv[i + 4]));
+			move.output = argv[i + 5];
+			moves.push_back(move);
+			i += 5;
+		} else if (arg == "--serve" && i + 1 < argc) {
+			socketPath = argv[++i];
+			headless = true;
+		} else if (arg == "--fail-after" && i + 1 < argc) {
+			serveFaults.failAfterTiles = atoi(argv[++i]);
+		} else if (arg == "--tile-delay" && i + 1 < argc) {
+			serveFaults.tileDelay = atoi(argv[++i]);
+		} else if (arg == "--coordinate" && i + 1 < argc) {
+			stringstream list(argv[++i]);
+			string address;
+			while (getline(list, address, ','))
+				if (!address.empty()) farmWorkers.push_back(address);
+			headless = true;
+		} else if (arg == "--farm-tile-size" && i + 1 < argc) {
+			farmOptions.tileSize = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--farm-timeout" && i + 1 < argc) {
+			farmOptions.timeout = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--farm-camera" && i + 3 < argc) {
+			farmOptions.render += string(farmOptions.render.empty() ? "" : " ") + "camera " +
+				argv[i + 1] + " " + argv[i + 2] + " " + argv[i + 3];
+			i += 3;
+		} else if (arg == "--farm-focal" && i + 1 < argc) {
+			farmOptions.render += string(farmOptions.render.empty() ? "" : " ") + "focal " + argv[++i];
+		} else if (arg == "--samples" && i + 1 < argc) {
+			mySamplerOptions.samples = std::max(1, atoi(argv[++i]));
+			samplesGiven = true;
+		} else if (arg == "--sampler" && i + 1 < argc) {
+			if (!parseSamplerType(argv[++i], &mySamplerOptions.type)) {
+				cout << "unknown sampler " << argv[i] << endl;
+				return -1;
+			}
+			samplerGiven = true;
+		} else if (arg == "--sampler-seed" && i + 1 < argc) {
+			mySamplerOptions.seed = strtoul(argv[++i], 0, 10);
+		} else if (arg == "--sampler-benchmark" && i + 2 < argc) {
+			samplerBenchSamples = std::max(1, atoi(argv[++i]));
+			samplerBenchFile = argv[++i];
+			headless = true;
+		} else if (arg == "--adaptive" && i + 1 < argc) {
+			adaptiveOptions.threshold = atof(argv[++i]);
+			adaptive = true;
+		} else if (arg == "--adaptive-min" && i + 1 < argc) {
+			adaptiveOptions.minSamples = atoi(argv[++i]);
+		} else if (arg == "--adaptive-time" && i + 1 < argc) {
+			adaptiveOptions.timeBudget = atof(argv[++i]);
+		} else if (arg == "--adaptive-budget" && i + 1 < argc) {
+			adaptiveOptions.sampleBudget = atof(argv[++i]);
+		} else if (arg == "--sample-counts" && i + 1 < argc) {
+			sampleCountFile = argv[++i];
+		} else if (arg == "--aovs" && i + 1 < argc) {
+			aovPrefix = argv[++i];
+		} else if (arg == "--denoise") {
+			denoise = true;
+		} else if (arg == "--denoise-passes" && i + 1 < argc) {
+			denoiseOptions.passes = atoi(argv[++i]);
+		} else if (arg == "--denoise-color" && i + 1 < argc) {
+			denoiseOptions.colorSigma = atof(argv[++i]);
+		} else if (arg == "--restir") {
+			myRestir = true;
+		} else if (arg == "--restir-candidates" && i + 1 < argc) {
+			myRestirOptions.candidates = atoi(argv[++i]);
+		} else if (arg == "--restir-neighbors" && i + 1 < argc) {
+			myRestirOptions.neighbors = atoi(argv[++i]);
+		} else {
+			cout << "usage: " << argv[0] << " [--headless] [--scene FILE] [--output FILE] [--png-level N]"
+				<< " [--exposure STOPS] [--tonemap clamp|filmic|aces] [--srgb]"
+				<< " [--bench-quantize PASSES] [--save-queue N] [--stream PATH|-]"
+				<< " [--size WIDTHxHEIGHT] [--out-of-core FRAME_FILE]"
+				<< " [--checkpoint FILE] [--checkpoint-interval SECONDS] [--resume]"
+				<< " [--split-budget F] [--bvh-layout depth-first|treelet|probe]"
+				<< " [--accel-cache DIR] [--shared-scene DIR] [--bench-shading PASSES]"
+				<< " [--light-cut deterministic|stochastic] [--light-error F]"
+				<< " [--light-cut-max N] [--light-samples N]"
+				<< " [--restir] [--restir-candidates N] [--restir-neighbors N]"
+				<< " [--light-culling] [--threads N] [--tile-size N]"
+				<< " [--area-probes N] [--area-samples N]"
+				<< " [--samples N] [--sampler fixed|random|stratified|sobol|blue-noise]"
+				<< " [--sampler-seed N] [--sampler-benchmark MAX_SPP FILE.csv]"
+				<< " [--adaptive THRESHOLD] [--adaptive-min N] [--adaptive-time MS]"
+				<< " [--adaptive-budget SPP] [--sample-counts FILE]"
+				<< " [--denoise] [--denoise-passes N] [--denoise-color F] [--aovs PREFIX]"
+				<< " [--relight LIGHTS OUTPUT]..."
+				<< " [--move SHAPE DX DY DZ OUTPUT]..."
+				<< " [--serve SOCKET] [--fail-after N] [--tile-delay MS]"
+				<< " [--coordinate ADDRESS,...] [--farm-tile-size N] [--farm-timeout MS]" << endl;
+			return -1;
+		}
+	}
+	pngOptions.workers = workers;
+	toneMap.workers = workers;
+	if (streamPath && (socketPath || !farmWorkers.empty() || samplerBenchFile)) {
+		cout << "--stream cannot be combined with --serve, --coordinate or --sampler-benchmark" << endl;
 		return -1;
 	}
-	glfwSetErrorCallback(ErrorCallback);
-
-	// attempt to create a window with an OpenGL 4.1 core profile context
-	GLFWwindow *window = 0;
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	int width = 512, height = 512;
-	window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
-	if (!window) {
-		cout << "Program failed to create GLFW window, TERMINATING" << endl;
-		glfwTerminate();
+	// the tiles have stdout to themselves, messages go to stderr
+	if (streamPath && string(streamPath) == "-")
+		cout.rdbuf(cerr.rdbuf());
+	if (quantizeBenchPasses > 0) {
+		benchmarkQuantize(quantizeBenchPasses, workers);
+		return 0;
+	}
+	if (framePath) {
+		string output = outputFile;
+		bool tiff = output.size() > 4 && (output.compare(output.size() - 4, 4, ".tif") == 0 ||
+			output.compare(output.size() - 5, 5, ".tiff") == 0);
+		if (!tiff) {
+			cout << "--out-of-core writes a tiled TIFF, --output must end in .tif or .tiff" << endl;
+			return -1;
+		}
+		if (denoise || adaptive || aovPrefix || !relights.empty() || !moves.empty()) {
+			cout << "--out-of-core cannot be combined with --denoise, --adaptive, --aovs, --relight or --move,"
+				<< " they keep whole frames in memory" << endl;
+			return -1;
+		}
+		if (socketPath || !farmWorkers.empty() || samplerBenchFile) {
+			cout << "--out-of-core cannot be combined with --serve, --coordinate or --sampler-benchmark" << endl;
+			return -1;
+		}
+	}
+	if (!farmWorkers.empty()) {
+		if (imageWidth > FARM_MAX_SIZE || imageHeight > FARM_MAX_SIZE) {
+			cout << "--coordinate renders frames of up to " << FARM_MAX_SIZE << "x" << FARM_MAX_SIZE
+				<< ", the most a daemon takes" << endl;
+			return -1;
+		}
+		// the daemons send bytes, clamped and with no tone map
+		if (toneMap.exposure != 0.0f || toneMap.curve != TONE_CLAMP || toneMap.srgb ||
+				ImageBuffer::IsFloatFile(outputFile)) {
+			cout << "--coordinate gets 8 bit tiles from the daemons and cannot be combined with --exposure,"
+				<< " --tonemap, --srgb or a .pfm or .hdr --output" << endl;
+			return -1;
+		}
+	}
+	if (resume && !checkpointPath) {
+		cout << "--resume needs --checkpoint, the file to resume from" << endl;
 		return -1;
 	}
-
-	// set keyboard callback function and make our context current (active)
-	glfwSetKeyCallback(window, KeyCallback);
-	glfwMakeContextCurrent(window);
-
-	//Intialize GLAD
-	if (!gladLoadGL())
-	{
-		cout << "GLAD init failed" << endl;
+	if (checkpointPath && (denoise || aovPrefix || !relights.empty() || !moves.empty() ||
+			socketPath || !farmWorkers.empty() || samplerBenchFile)) {
+		cout << "--checkpoint keeps the tiles of one frame and cannot be combined with --denoise, --aovs,"
+			<< " --relight, --move, --serve, --coordinate or --sampler-benchmark" << endl;
 		return -1;
 	}
+	if (!relights.empty() && !moves.empty()) {
+		cout << "--relight and --move cannot be combined, the G-buffer would go stale" << endl;
+		return -1;
+	}
+	if (!relights.empty() && myRestir) {
+		cout << "--relight and --restir cannot be combined, the G-buffer is shaded hit by hit"
+			<< " without ReSTIR's spatial reuse" << endl;
+		return -1;
+	}
+	if (adaptive) {
+		// --samples is the most any pixel takes
+		if (samplesGiven)
+			adaptiveOptions.maxSamples = mySamplerOptions.samples;
+		mySamplerOptions.samples = adaptiveOptions.maxSamples;
+		if (samplerGiven && mySamplerOptions.type == SAMPLER_FIXED) {
+			cout << "--adaptive needs a sampler, every fixed sample is the same" << endl;
+			return -1;
+		}
+		if (myRestir || !relights.empty() || !moves.empty() || samplerBenchFile) {
+			cout << "--adaptive cannot be combined with --restir, --relight, --move or --sampler-benchmark" << endl;
+			return -1;
+		}
+	} else if (sampleCountFile) {
+		cout << "--sample-counts needs --adaptive" << endl;
+		return -1;
+	}
+	if (mySamplerOptions.samples > 1 && !samplerGiven)
+		mySamplerOptions.type = SAMPLER_SOBOL;
+	if ((pixelSamples() > 1 || samplerBenchFile) && (myRestir || !relights.empty())) {
+		cout << "--restir and --relight take one sample per pixel" << endl;
+		return -1;
+	}
+
+	// the coordinator needs no scene, its workers have it loaded
+	if (!farmWorkers.empty()) {
+		int width = imageWidth, height = imageHeight;
+		ImageBuffer image;
+		image.Initialize(width, height);
+		image.SetPngOptions(pngOptions);
+		FarmStats farmStats;
+		auto farmStart = chrono::steady_clock::now();
+		bool complete = renderOnFarm(farmWorkers, width, height, farmOptions,
+			[&](const Tile &tile, const unsigned char *rgb) {
+				// half a step up, so saving quantizes back to the same byte
+				for (int y = 0; y < tile.height; y++)
+					for (int x = 0; x < tile.width; x++) {
+						const unsigned char *pixel = &rgb[(y*tile.width + x)*3];
+						image.SetPixel(tile.x + x, tile.y + y, (vec3(pixel[0], pixel[1], pixel[2]) + 0.5f)/255.0f);
+					}
+			}, &farmStats);
+		double farmTime = chrono::duration<double, milli>(chrono::steady_clock::now() - farmStart).count();
+		cout << "Farm: " << width << "x" << height << " in " << farmTime << " ms, " << farmStats.tiles << " tiles, "
+			<< farmStats.reissued << " reissued, " << farmStats.duplicates << " duplicated, "
+			<< farmStats.failedWorkers << " of " << farmWorkers.size() << " workers failed" << endl;
+		for (int w = 0; w < (int)farmWorkers.size(); w++)
+			cout << "  " << farmWorkers[w] << ": " << farmStats.tilesPerWorker[w] << " tiles" << endl;
+		if (!complete) {
+			cout << "every worker failed before the frame was done" << endl;
+			return -1;
+		}
+		return image.SaveToFile(outputFile) ? 0 : -1;
+	}
+
+	int width = imageWidth, height = imageHeight;
+	GLFWwindow *window = 0;
+	if (!headless) {
+		// initialize the GLFW windowing system
+		if (!glfwInit()) {
+			cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
+			return -1;
+		}
+		glfwSetErrorCallback(ErrorCallback);
+
+		// attempt to create a window with an OpenGL 4.1 core profile context
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
+		if (!window) {
+			cout << "Program failed to create GLFW window, TERMINATING" << endl;
+			glfwTerminate();
+			return -1;
+		}
 
-	// query and print out information about our OpenGL environment
-	QueryGLVersion();
+		// set keyboard callback function and make our context current (active)
+		glfwSetKeyCallback(window, KeyCallback);
+		glfwMakeContextCurrent(window);
+
+		//Intialize GLAD
+		if (!gladLoadGL())
+		{
+			cout << "GLAD init failed" << endl;
+			return -1;
+		}
+
+		// query and print out information about our OpenGL environment
+		QueryGLVersion();
+	}
 	
-	Light light1;
-	readFile(myShapeList,&light1,"scene3.txt");
+	// map the scene another process on this host has already read and built,
+	// if there is one; otherwise read it and build the BVH as usual
+	auto sceneStart = chrono::steady_clock::now();
+	vector<Light> sceneLights;
+	uint64_t sharedSceneHash = 0;
+	bool sharedHit = false;
+	if (sharedSceneDir) {
+		sharedSceneHash = hashSceneFile(sceneFile, bvhOptions);
+		sharedHit = sharedSceneHash != 0 &&
+			loadSharedScene(&mySharedScene, &myBVH, sharedScenePath(sharedSceneDir, sharedSceneHash), sharedSceneHash);
+	}
+	if (sharedHit) {
+		myShapeList = mySharedScene.shapes;
+		sceneLights.assign(mySharedScene.lights, mySharedScene.lights + mySharedScene.lightCount);
+	} else {
+		readFile(myShapeStorage,sceneLights,sceneFile);
+		precomputeShapes(myShapeStorage);
+		myShapeList = myShapeStorage;
+	}
+	setLights(sceneLights);
 	cout<<myShapeList.size()<<endl;
+	cout << "Lights: " << myLightList.size() << " in a tree of " << myLightTree.nodes.size() << " nodes" << endl;
+
+	// reuse a hierarchy built by an earlier run of the same scene if we can
+	auto bvhStart = chrono::steady_clock::now();
+	bool cacheHit = false;
+	uint64_t sceneHash = 0;
+	if (accelCacheDir && !sharedHit) {
+		sceneHash = hashSceneGeometry(myShapeList, bvhOptions);
+		cacheHit = loadBVHCache(&myBVH, bvhCachePath(accelCacheDir, sceneHash), sceneHash, myShapeList);
+	}
+	if (!cacheHit && !sharedHit) {
+		buildBVH(&myBVH,myShapeList,bvhOptions);
+		if (bvhOptions.layout == BVH_LAYOUT_PROBE) {
+			// count node visits over every fourth pixel in each direction
+			vector<unsigned> visits(myBVH.nodeCount, 0);
+			bvhVisitCounts = &visits[0];
+			for(int i=0;i<width;i+=4){
+				for(int j=0;j<height;j+=4){
+					Ray ray = generateRay(i,j,width,height,myCameraOrigin,myFocalLength);
+					Random random(i*height+j,0);
+					raycolorRe(ray,.0f,9999.9f,&random,10);
+				}
+			}
+			bvhVisitCounts = 0;
+			layoutBVH(&myBVH, bvhOptions.treeletSize, &visits[0]);
+		}
+		if (accelCacheDir)
+			saveBVHCache(myBVH, accelCacheDir, sceneHash);
+	}
+	double bvhTime = chrono::duration<double, milli>(chrono::steady_clock::now() - bvhStart).count();
+	if (sharedSceneDir) {
+		if (!sharedHit && sharedSceneHash != 0)
+			saveSharedScene(myShapeList, sceneLights, myBVH, sharedSceneDir, sharedSceneHash);
+		double sceneTime = chrono::duration<double, milli>(chrono::steady_clock::now() - sceneStart).count();
+		cout << "Shared scene: " << (sharedHit ? "mapped " : "published ")
+			<< sharedScenePath(sharedSceneDir, sharedSceneHash) << " in " << sceneTime << " ms" << endl;
+	}
+	if (accelCacheDir && !sharedHit) {
+		cout << "BVH cache: " << (cacheHit ? "hit " : "miss ")
+			<< bvhCachePath(accelCacheDir, sceneHash) << endl;
+	}
+	cout << "BVH: " << (sharedHit ? "mapped in " : cacheHit ? "loaded in " : "built in ") << bvhTime << " ms, " << myBVH.primitiveCount << " primitives, "
+		<< myBVH.unbounded.size() << " unbounded, "
+		<< myBVH.nodeCount << " nodes, "
+		<< myBVH.refCount << " references, "
+		<< myBVH.spatialSplits << " spatial splits" << endl;
+
+
+	if (socketPath) {
+		if (!serveRequests(socketPath, workers, tileSize, bvhOptions, serveFaults))
+			return -1;
+		cout << "Goodbye!" << endl;
+		return 0;
+	}
 
+	if (shadingBenchPasses > 0 && !myLightList.empty())
+		benchmarkShading(myLightList[0], width, height, shadingBenchPasses);
+	if (samplerBenchFile) {
+		benchmarkSamplers(samplerBenchSamples, samplerBenchFile, width, height, workers, tileSize);
+		return 0;
+	}
 
+	// out of core, the frame is kept in a mapped file and the image buffer
+	// is never allocated
 	ImageBuffer image = ImageBuffer();
-	image.Initialize();
+	MappedFrame frame;
+	if (framePath) {
+		if (!openMappedFrame(&frame, framePath, width, height, tileSize)) {
+			cout << "cannot map a " << width << "x" << height << " frame in " << framePath << endl;
+			return -1;
+		}
+	} else if (headless)
+		image.Initialize(width, height);
+	else
+		image.Initialize();
+	image.SetPngOptions(pngOptions);
+	image.SetToneMap(toneMap);
+	// images are written while the next frame renders
+	SaveQueue saveQueue(saveQueueLength);
+	// and tiles are streamed the moment they are delivered
+	TileStream tileStream;
+	if (streamPath && !openTileStream(&tileStream, streamPath)) {
+		cout << "cannot open tile stream " << streamPath << endl;
+		return -1;
+	}
 	
-	for(int i=0;i<width;i++){
-		for(int j=0;j<height;j++){
-			Ray ray = generateRay(i,j,width,height,vec3(0,0,0),2.0f);
-			vec3 color = vec3(0,0,0);
+	// with --denoise, the image as rendered is kept apart from the one
+	// shown and saved, which is filtered from it
+	vector<vec3> beauty;
+	if (denoise)
+		beauty.assign(width*height, vec3(0.0f));
+	if (denoise || aovPrefix)
+		myGuides.assign(width*height, PixelGuide());
+
+	bvhStats = TraversalStats();
+	lightStats = LightCutStats();
+	areaStats = AreaLightStats();
+	CacheCounters cacheCounters;
+	bool countingCache = startCacheCounters(&cacheCounters);
+	auto renderStart = chrono::steady_clock::now();
+	atomic<unsigned long long> culledTiles(0), culledLights(0);
+	auto renderCounted = [&](const Tile &tile, vec3 *colors) {
+		int lightCount;
+		renderTileByMode(tile, width, height, colors, &lightCount);
+		culledTiles++;
+		culledLights += lightCount;
+	};
+	auto storePixel = [&](int x, int y, vec3 color) {
+		image.SetPixel(x, y, color);
+		if (denoise) beauty[y*width + x] = color;
+	};
+	auto toImage = [&](const Tile &tile, const vec3 *colors) {
+		if (framePath) {
+			storeFrameTile(&frame, tile, colors);
+		} else {
+			for (int x = 0; x < tile.width; x++)
+				for (int y = 0; y < tile.height; y++)
+					storePixel(tile.x + x, tile.y + y, colors[x*tile.height + y]);
+		}
+		if (streamPath)
+			streamTile(&tileStream, tile, &colors[0].x);
+	};
+	// images made after their tiles were delivered are streamed again whole
+	auto streamPixels = [&](const function<vec3(int x, int y)> &pixel) {
+		if (!streamPath) return;
+		vector<vec3> colors;
+		for (const Tile &tile : makeTiles(width, height, tileSize)) {
+			colors.resize(tile.width*tile.height);
+			for (int x = 0; x < tile.width; x++)
+				for (int y = 0; y < tile.height; y++)
+					colors[x*tile.height + y] = pixel(tile.x + x, tile.y + y);
+			streamTile(&tileStream, tile, &colors[0].x);
+		}
+	};
+	auto beginFrame = [&]() {
+		if (streamPath) beginStreamFrame(&tileStream, width, height);
+	};
+	auto endFrame = [&]() {
+		if (streamPath) endStreamFrame(&tileStream);
+	};
+	auto denoiseBeauty = [&]() {
+		if (!denoise) return;
+		auto denoiseStart = chrono::steady_clock::now();
+		vector<vec3> filtered = beauty;
+		denoiseImage(&filtered, myGuides, width, height, denoiseOptions, workers);
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				image.SetPixel(x, y, filtered[y*width + x]);
+		streamPixels([&](int x, int y) { return filtered[y*width + x]; });
+		double denoiseTime = chrono::duration<double, milli>(chrono::steady_clock::now() - denoiseStart).count();
+		cout << "Denoise: " << denoiseOptions.passes << " passes in " << denoiseTime << " ms" << endl;
+	};
+	beginFrame();
+	GBuffer gbuffer;
+	if (!relights.empty()) {
+		// keep the hits to relight from; the first image is shaded from
+		// them too
+		initGBuffer(&gbuffer, width, height, tileSize);
+		renderImage(gbuffer.tiles, workers, [&](const Tile &tile, vec3 *colors) {
+			traceGBufferTile(&gbuffer, tile.index, tracePixel);
+			if (!myGuides.empty())
+				gbufferGuides(gbuffer, tile.index, width);
+			shadeGBufferTile(gbuffer, tile.index, myShapeList, shadeHit, pixelRandom, colors);
+		}, toImage);
+	}
 
-			//color = raycolor(ray,.0f,99999.9f,light1);
-			color = raycolorRe(ray,.0f,9999.9f,light1,10);
-			
-			image.SetPixel(i,j,color);
+	// with edits to come, every tile notes where its rays went
+	vector<Tile> tiles = makeTiles(width, height, tileSize);
+	FootprintGrid footprintGrid;
+	vector<Footprint> footprints;
+	auto renderTileRecorded = [&](const Tile &tile, vec3 *colors) {
+		recordFootprint(&footprintGrid, &footprints[tile.index]);
+		renderCounted(tile, colors);
+		recordFootprint(&footprintGrid, nullptr);
+	};
+
+	// with --checkpoint, tiles go to the checkpoint as they are delivered
+	// (adaptive: each tile's estimates after every pass over it), and with
+	// --resume those already in it are taken from it rather than rendered
+	CheckpointWriter checkpoint(checkpointInterval);
+	vector<PixelEstimate> estimates;
+	vector<Tile> unfinished = tiles;
+	if (checkpointPath) {
+		CheckpointLayout layout;
+		layout.width = width;
+		layout.height = height;
+		layout.tileSize = tileSize;
+		layout.kind = adaptive ? CHECKPOINT_ESTIMATES : CHECKPOINT_COLORS;
+		layout.settingsHash = hashRenderSettings(sceneFile, bvhOptions, argc, argv);
+		long long keepBytes = 0;
+		if (resume) {
+			vector<bool> restored(tiles.size(), false);
+			if (adaptive)
+				estimates.assign(width*height, PixelEstimate());
+			CheckpointStatus status = loadCheckpoint(checkpointPath, layout, [&](const Tile &tile, const void *data) {
+				if (adaptive) {
+					const PixelEstimate *pixels = (const PixelEstimate *)data;
+					for (int y = 0; y < tile.height; y++)
+						copy(pixels + y*tile.width, pixels + (y + 1)*tile.width, &estimates[(tile.y + y)*width + tile.x]);
+				} else if (!restored[tile.index]) {
+					toImage(tile, (const vec3 *)data);
+				}
+				restored[tile.index] = true;
+			}, &keepBytes);
+			if (status == CHECKPOINT_MISMATCH) {
+				cout << checkpointPath << " is not a checkpoint of this scene, size and settings" << endl;
+				return -1;
+			}
+			unfinished.clear();
+			for (const Tile &tile : tiles)
+				if (!restored[tile.index]) unfinished.push_back(tile);
+			cout << "Checkpoint: " << tiles.size() - unfinished.size() << " of " << tiles.size()
+				<< " tiles resumed from " << checkpointPath << endl;
+		}
+		if (!checkpoint.open(checkpointPath, layout, keepBytes)) {
+			cout << "cannot write checkpoint " << checkpointPath << endl;
+			return -1;
+		}
+	}
+	auto toImageAndCheckpoint = [&](const Tile &tile, const vec3 *colors) {
+		toImage(tile, colors);
+		if (checkpointPath)
+			checkpoint.add(tile, colors, tile.width*tile.height*sizeof(vec3));
+	};
+	if (!moves.empty()) {
+		AABB sceneBounds;
+		for (const Shape &shape : myShapeList)
+			sceneBounds.grow(primitiveBounds(shape));
+		initFootprintGrid(&footprintGrid, sceneBounds, 32);
+		footprints.resize(tiles.size());
+		renderImage(tiles, workers, renderTileRecorded, toImage);
+	} else if (adaptive) {
+		AdaptiveStats adaptiveStats;
+		vector<PixelEstimate> tileEstimates;
+		renderImageAdaptive(tiles, width, height, workers, adaptiveOptions, &estimates, &adaptiveStats,
+			[&](const Tile &tile) {
+				if (!checkpointPath) return;
+				tileEstimates.resize(tile.width*tile.height);
+				for (int y = 0; y < tile.height; y++)
+					copy(&estimates[(tile.y + y)*width + tile.x], &estimates[(tile.y + y)*width + tile.x + tile.width],
+						&tileEstimates[y*tile.width]);
+				checkpoint.add(tile, tileEstimates.data(), tileEstimates.size()*sizeof(PixelEstimate));
+			});
+		int mostSamples = 1;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				storePixel(x, y, estimates[y*width + x].mean);
+				mostSamples = std::max(mostSamples, estimates[y*width + x].samples);
+			}
+		}
+		streamPixels([&](int x, int y) { return estimates[y*width + x].mean; });
+		int pixelCount = width*height;
+		cout << "Adaptive: " << (double)adaptiveStats.samples/pixelCount << " samples per pixel in "
+			<< adaptiveStats.passes << " passes, " << 100.0*adaptiveStats.converged/pixelCount << "% converged, "
+			<< 100.0*adaptiveStats.capped/pixelCount << "% at " << adaptiveOptions.maxSamples << " samples"
+			<< (adaptiveStats.budgetSpent ? ", budget spent" : "") << endl;
+		if (sampleCountFile) {
+			// white is the most samples any pixel took
+			ImageBuffer counts;
+			counts.Initialize(width, height);
+			counts.SetPngOptions(pngOptions);
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+					counts.SetPixel(x, y, vec3(float(estimates[y*width + x].samples)/mostSamples));
+			saveQueue.save(counts, sampleCountFile, false);
+			cout << "Sample counts: white is " << mostSamples << " samples" << endl;
+		}
+	} else if (relights.empty()) {
+		renderImage(unfinished, workers, renderCounted, toImageAndCheckpoint);
+	}
+
+	double renderTime = chrono::duration<double, milli>(chrono::steady_clock::now() - renderStart).count();
+	cout << "Render: " << width << "x" << height << " in " << renderTime << " ms" << endl;
+	// all that was rendered is in the checkpoint before the image is saved
+	checkpoint.finish();
+	unsigned long long cacheMisses = 0, cacheReferences = 0;
+	countingCache = countingCache && stopCacheCounters(&cacheCounters, &cacheMisses, &cacheReferences);
+
+	if (bvhStats.rays > 0) {
+		cout << "Traversal: " << bvhStats.rays << " rays, "
+			<< (double)bvhStats.nodesVisited/bvhStats.rays << " nodes visited per ray, "
+			<< (double)bvhStats.primitivesTested/bvhStats.rays << " primitives tested per ray" << endl;
+		if (countingCache) {
+			cout << "Cache: " << (double)cacheMisses/bvhStats.rays << " LLC misses per ray, "
+				<< (double)cacheReferences/bvhStats.rays << " LLC references per ray" << endl;
 		}
 	}
+	if (!relights.empty()) {
+		cout << "G-buffer: " << gbufferMemory(gbuffer)/1048576.0 << " MB" << endl;
+	}
+	if (myLightCulling && culledTiles > 0) {
+		cout << "Light culling: " << (double)culledLights/culledTiles << " of "
+			<< myLightList.size() << " lights per tile" << endl;
+	}
+	if (lightStats.hits > 0) {
+		cout << "Direct light: " << (double)lightStats.lightsEvaluated/lightStats.hits
+			<< " lights shadow tested per hit" << endl;
+	}
+	if (areaStats.tests > 0) {
+		cout << "Area lights: " << (double)areaStats.rays/areaStats.tests << " shadow rays per test, "
+			<< 100.0*areaStats.refined/areaStats.tests << "% refined" << endl;
+	}
+	if (aovPrefix) {
+		// what each pixel's camera rays hit, recorded while rendering
+		int depth = image.AddPlane("depth", 1);
+		int normal = image.AddPlane("normal", 3);
+		int albedo = image.AddPlane("albedo", 3);
+		int id = image.AddPlane("id", 1);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				const PixelGuide &guide = myGuides[y*width + x];
+				image.SetPlanePixel(depth, x, y, vec3(guide.depth));
+				image.SetPlanePixel(normal, x, y, guide.normal);
+				image.SetPlanePixel(albedo, x, y, guide.albedo);
+				image.SetPlanePixel(id, x, y, vec3(float(guide.shape)));
+			}
+		}
+		for (int plane = 0; plane < image.PlaneCount(); plane++)
+			image.SavePlane(plane, string(aovPrefix) + "." + image.PlaneName(plane) + ".pfm");
+	}
+	denoiseBeauty();
+	endFrame();
 	
 	//readData("scene2.txt");
 	
 	
 	image.Render();
 	
-	image.SaveToFile("renderImage.png");
+	if (framePath) {
+		// a tile at a time from the mapped frame, which goes once it is written
+		auto tiffStart = chrono::steady_clock::now();
+		TiffOptions tiffOptions;
+		tiffOptions.level = pngOptions.level;
+		tiffOptions.workers = workers;
+		bool written = writeTiledTIFF(outputFile, width, height, toneMap, tiffOptions,
+			[&](const Tile &tile, vec3 *colors) { return loadFrameRegion(frame, tile, colors); });
+		closeMappedFrame(&frame);
+		double tiffTime = chrono::duration<double, milli>(chrono::steady_clock::now() - tiffStart).count();
+		if (!written) {
+			cout << "cannot write " << outputFile << ", the frame is left in " << framePath << endl;
+			return -1;
+		}
+		remove(framePath);
+		cout << "Out of core: " << outputFile << " written in " << tiffTime << " ms" << endl;
+	} else {
+		// moves draw over the image they start from
+		saveQueue.save(image, outputFile, !moves.empty());
+	}
+
+	// light edits: the lights in each file replace the scene's, and the
+	// image is shaded again from the G-buffer without tracing camera or
+	// reflection rays
+	for (const pair<string, string> &relight : relights) {
+		vector<Shape> ignoredShapes;
+		vector<Light> lights;
+		readFile(ignoredShapes, lights, relight.first.c_str());
+		setLights(lights);
+		bvhStats = TraversalStats();
+		lightStats = LightCutStats();
+		areaStats = AreaLightStats();
+		auto relightStart = chrono::steady_clock::now();
+		beginFrame();
+		renderImage(gbuffer.tiles, workers, [&](const Tile &tile, vec3 *colors) {
+			shadeGBufferTile(gbuffer, tile.index, myShapeList, shadeHit, pixelRandom, colors);
+		}, toImage);
+		double relightTime = chrono::duration<double, milli>(chrono::steady_clock::now() - relightStart).count();
+		cout << "Relight: " << lights.size() << " lights from " << relight.first << " in " << relightTime << " ms, "
+			<< bvhStats.rays << " shadow rays" << endl;
+		denoiseBeauty();
+		endFrame();
+		image.Render();
+		saveQueue.save(image, relight.second, false);
+	}
+
+	// shape edits: only the tiles whose rays went where the shape was or
+	// now is are rendered again
+	for (const Move &move : moves) {
+		if (move.shape < 0 || move.shape >= (int)myShapeList.size()) {
+			cout << "no shape " << move.shape << " to move" << endl;
+			continue;
+		}
+		auto editStart = chrono::steady_clock::now();
+		beginFrame();
+		if (myShapeList.begin() != myShapeStorage.data()) {
+			// a mapped scene is read-only, edit a copy
+			myShapeStorage.assign(myShapeList.begin(), myShapeList.end());
+			myShapeList = myShapeStorage;
+		}
+		Shape &shape = myShapeStorage[move.shape];
+		AABB oldBounds = primitiveBounds(shape);
+		translateShape(shape, move.offset);
+		AABB newBounds = primitiveBounds(shape);
+		buildBVH(&myBVH, myShapeList, bvhOptions);
+
+		vector<Tile> dirty;
+		for (const Tile &tile : tiles)
+			if (footprintOverlaps(footprintGrid, footprints[tile.index], oldBounds) ||
+					footprintOverlaps(footprintGrid, footprints[tile.index], newBounds))
+				dirty.push_back(tile);
+		bvhStats = TraversalStats();
+		renderImage(dirty, workers, renderTileRecorded, toImage);
+		double editTime = chrono::duration<double, milli>(chrono::steady_clock::now() - editStart).count();
+		cout << "Move: shape " << move.shape << ", " << dirty.size() << " of " << tiles.size()
+			<< " tiles rendered again in " << editTime << " ms, " << bvhStats.rays << " rays" << endl;
+		denoiseBeauty();
+		endFrame();
+		image.Render();
+		saveQueue.save(image, move.output, &move != &moves.back());
+	}
+	bool saved = saveQueue.finish();
+	if (streamPath) {
+		cout << "Tile stream: " << tileStream.tiles << " tiles, " << tileStream.bytes/1048576.0 << " MB"
+			<< (tileStream.failed ? ", stopped early" : "") << endl;
+		closeTileStream(&tileStream);
+	}
 	
 	
 	// run an event-triggered main loop
-	while (!glfwWindowShouldClose(window))
+	while (window && !glfwWindowShouldClose(window))
 	{
 
 
@@ -713,11 +2326,13 @@ int main(int argc, char *argv[])
 	}
 
 	// clean up allocated resources before exit
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 
 	cout << "Goodbye!" << endl;
-	return 0;
+	return saved ? 0 : -1;
 }
 
 // ==========================================================================
@@ -0,0 +1,629 @@
+// ==========================================================================
+// Bounding Volume Hierarchy for the Ray Tracer
+//
+// The build follows "Spatial Splits in Bounding Volume Hierarchies" (Stich,
+// Friedrich, Dietrich 2009). Every node tries the best SAH object split; if
+// the two children of that split overlap noticeably, binned spatial splits
+// are tried too. A spatial split clips the references that straddle the
+// plane, so one primitive can end up in several leaves. The total number of
+// references is capped by BVHBuildOptions::splitBudget.
+// ==========================================================================
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <deque>
+#include <queue>
+
+#include "bvh.h"
+
+using namespace std;
+using namespace glm;
+
+thread_local TraversalStats bvhStats;
+unsigned *bvhVisitCounts = nullptr;
+thread_local RayHook bvhRayHook = nullptr;
+
+// --------------------------------------------------------------------------
+
+AABB::AABB() : lower(FLT_MAX), upper(-FLT_MAX)
+{
+}
+
+void AABB::grow(const vec3 &p)
+{
+	lower = min(lower, p);
+	upper = max(upper, p);
+}
+
+void AABB::grow(const AABB &box)
+{
+	lower = min(lower, box.lower);
+	upper = max(upper, box.upper);
+}
+
+void AABB::clip(const AABB &box)
+{
+	lower = max(lower, box.lower);
+	upper = min(upper, box.upper);
+}
+
+bool AABB::empty() const
+{
+	return lower.x > upper.x || lower.y > upper.y || lower.z > upper.z;
+}
+
+float AABB::area() const
+{
+	if (empty()) return 0.0f;
+	vec3 e = upper - lower;
+	return 2.0f*(e.x*e.y + e.y*e.z + e.z*e.x);
+}
+
+// --------------------------------------------------------------------------
+// Construction
+
+AABB primitiveBounds(const Shape &shape)
+{
+	AABB box;
+	if (shape.type == 0) {
+		box.grow(shape.data[0] - vec3(shape.addition));
+		box.grow(shape.data[0] + vec3(shape.addition));
+	} else if (shape.type == 2) {
+		box.grow(shape.data[0]);
+		box.grow(shape.data[1]);
+		box.grow(shape.data[2]);
+	}
+	return box;
+}
+
+namespace {
+
+const float TRAVERSAL_COST = 1.0f;
+const float INTERSECTION_COST = 1.0f;
+
+struct Reference
+{
+	AABB box;
+	int prim;
+};
+
+struct SplitCandidate
+{
+	float cost = FLT_MAX;
+	int axis = -1;
+	bool spatial = false;
+	int index = 0;          // object split: first reference on the right
+	float position = 0.0f;  // spatial split: plane position
+	int leftCount = 0, rightCount = 0;
+	AABB left, right;
+};
+
+struct Bin
+{
+	AABB box;
+	int enter = 0;
+	int exit = 0;
+};
+
+
+float centroid(const Reference &ref, int axis)
+{
+	return 0.5f*(ref.box.lower[axis] + ref.box.upper[axis]);
+}
+
+struct Builder
+{
+	ShapeSpan shapes;
+	const BVHBuildOptions &options;
+	BVH *bvh;
+	float rootArea;
+	int refBudget;
+
+	Builder(ShapeSpan s, const BVHBuildOptions &o, BVH *b)
+		: shapes(s), options(o), bvh(b), rootArea(0.0f), refBudget(0)
+	{}
+
+	// splits a reference at an axis aligned plane; triangles are clipped
+	// against the plane, spheres fall back to their bounding box
+	void splitReference(const Reference &ref, int axis, float position, AABB *left, AABB *right)
+	{
+		*left = AABB();
+		*right = AABB();
+		const Shape &shape = shapes[ref.prim];
+		if (shape.type == 2) {
+			for (int i = 0; i < 3; i++) {
+				vec3 v0 = shape.data[i];
+				vec3 v1 = shape.data[(i + 1) % 3];
+				if (v0[axis] <= position) left->grow(v0);
+				if (v0[axis] >= position) right->grow(v0);
+				if ((v0[axis] < position && v1[axis] > position) ||
+					(v0[axis] > position && v1[axis] < position)) {
+					float t = clamp((position - v0[axis])/(v1[axis] - v0[axis]), 0.0f, 1.0f);
+					vec3 p = mix(v0, v1, t);
+					p[axis] = position;
+					left->grow(p);
+					right->grow(p);
+				}
+			}
+		} else {
+			*left = ref.box;
+			*right = ref.box;
+		}
+		left->upper[axis] = std::min(left->upper[axis], position);
+		right->lower[axis] = std::max(right->lower[axis], position);
+		left->clip(ref.box);
+		right->clip(ref.box);
+	}
+
+	void findObjectSplit(vector<Reference> &refs, float nodeArea, SplitCandidate *best)
+	{
+		int n = refs.size();
+		vector<AABB> rightBoxes(n);
+		for (int axis = 0; axis < 3; axis++) {
+			sort(refs.begin(), refs.end(), [axis](const Reference &a, const Reference &b) {
+				float ca = centroid(a, axis), cb = centroid(b, axis);
+				return ca < cb || (ca == cb && a.prim < b.prim);
+			});
+
+			AABB box;
+			for (int i = n - 1; i > 0; i--) {
+				box.grow(refs[i].box);
+				rightBoxes[i] = box;
+			}
+
+			box = AABB();
+			for (int i = 1; i < n; i++) {
+				box.grow(refs[i - 1].box);
+				float cost = TRAVERSAL_COST + INTERSECTION_COST*
+					(box.area()*i + rightBoxes[i].area()*(n - i))/nodeArea;
+				if (cost < best->cost) {
+					best->cost = cost;
+					best->axis = axis;
+					best->spatial = false;
+					best->index = i;
+					best->leftCount = i;
+					best->rightCount = n - i;
+					best->left = box;
+					best->right = rightBoxes[i];
+				}
+			}
+		}
+	}
+
+	void findSpatialSplit(const vector<Reference> &refs, const AABB &nodeBox, float nodeArea, SplitCandidate *best)
+	{
+		int binCount = options.spatialBins;
+		vector<Bin> bins(binCount);
+		for (int axis = 0; axis < 3; axis++) {
+			float origin = nodeBox.lower[axis];
+			float binSize = (nodeBox.upper[axis] - origin)/binCount;
+			if (binSize <= 0.0f) continue;
+
+			for (int b = 0; b < binCount; b++)
+				bins[b] = Bin();
+
+			for (const Reference &ref : refs) {
+				int first = clamp(int((ref.box.lower[axis] - origin)/binSize), 0, binCount - 1);
+				int last = clamp(int((ref.box.upper[axis] - origin)/binSize), first, binCount - 1);
+				Reference rest = ref;
+				for (int b = first; b < last; b++) {
+					AABB left, right;
+					splitReference(rest, axis, origin + (b + 1)*binSize, &left, &right);
+					if (!left.empty()) bins[b].box.grow(left);
+					rest.box = right;
+				}
+				if (!rest.box.empty()) bins[last].box.grow(rest.box);
+				bins[first].enter++;
+				bins[last].exit++;
+			}
+
+			vector<AABB> rightBoxes(binCount);
+			vector<int> rightCounts(binCount);
+			AABB box;
+			int count = 0;
+			for (int b = binCount - 1; b > 0; b--) {
+				box.grow(bins[b].box);
+				count += bins[b].exit;
+				rightBoxes[b] = box;
+				rightCounts[b] = count;
+			}
+
+			box = AABB();
+			count = 0;
+			for (int b = 1; b < binCount; b++) {
+				box.grow(bins[b - 1].box);
+				count += bins[b - 1].enter;
+				if (count == 0 || rightCounts[b] == 0) continue;
+				float cost = TRAVERSAL_COST + INTERSECTION_COST*
+					(box.area()*count + rightBoxes[b].area()*rightCounts[b])/nodeArea;
+				if (cost < best->cost) {
+					best->cost = cost;
+					best->axis = axis;
+					best->spatial = true;
+					best->position = origin + b*binSize;
+					best->leftCount = count;
+					best->rightCount = rightCounts[b];
+					best->left = box;
+					best->right = rightBoxes[b];
+				}
+			}
+		}
+	}
+
+	// distributes references for a chosen spatial split; straddling
+	// references are split or, when cheaper, kept whole on one side
+	void performSpatialSplit(const vector<Reference> &refs, const SplitCandidate &split,
+			vector<Reference> *leftRefs, vector<Reference> *rightRefs)
+	{
+		int axis = split.axis;
+		AABB leftBox = split.left, rightBox = split.right;
+		int leftCount = split.leftCount, rightCount = split.rightCount;
+
+		for (const Reference &ref : refs) {
+			if (ref.box.upper[axis] <= split.position) {
+				leftRefs->push_back(ref);
+			} else if (ref.box.lower[axis] >= split.position) {
+				rightRefs->push_back(ref);
+			} else {
+				AABB toLeft = leftBox, toRight = rightBox;
+				toLeft.grow(ref.box);
+				toRight.grow(ref.box);
+				float splitCost = leftBox.area()*leftCount + rightBox.area()*rightCount;
+				float leftCost = toLeft.area()*leftCount + rightBox.area()*(rightCount - 1);
+				float rightCost = leftBox.area()*(leftCount - 1) + toRight.area()*rightCount;
+
+				if (leftCost < splitCost && leftCost <= rightCost) {
+					leftRefs->push_back(ref);
+					leftBox = toLeft;
+					rightCount--;
+				} else if (rightCost < splitCost) {
+					rightRefs->push_back(ref);
+					rightBox = toRight;
+					leftCount--;
+				} else {
+					Reference left = ref, right = ref;
+					splitReference(ref, axis, split.position, &left.box, &right.box);
+					if (!left.box.empty()) leftRefs->push_back(left);
+					if (!right.box.empty()) rightRefs->push_back(right);
+				}
+			}
+		}
+	}
+
+	int makeLeaf(const vector<Reference> &refs, const AABB &box)
+	{
+		BVHNode node;
+		node.lower = box.lower;
+		node.upper = box.upper;
+		node.a = bvh->refStorage.size();
+		node.b = ~int(refs.size());
+		for (const Reference &ref : refs)
+			bvh->refStorage.push_back(ref.prim);
+		bvh->nodeStorage.push_back(node);
+		return bvh->nodeStorage.size() - 1;
+	}
+
+	int build(vector<Reference> &refs, int depth)
+	{
+		AABB box;
+		for (const Reference &ref : refs)
+			box.grow(ref.box);
+
+		int n = refs.size();
+		if (n <= 1 || depth >= BVH_MAX_DEPTH)
+			return makeLeaf(refs, box);
+
+		float nodeArea = std::max(box.area(), FLT_MIN);
+		SplitCandidate best;
+		findObjectSplit(refs, nodeArea, &best);
+
+		// spatial splits only pay off when the object split children overlap
+		AABB overlap = best.left;
+		overlap.clip(best.right);
+		if (refBudget > 0 && overlap.area() > options.overlapThreshold*rootArea)
+			findSpatialSplit(refs, box, nodeArea, &best);
+
+		if (best.spatial && best.leftCount + best.rightCount - n > refBudget) {
+			best = SplitCandidate();
+			findObjectSplit(refs, nodeArea, &best);
+		}
+
+		float leafCost = INTERSECTION_COST*n;
+		if (n <= options.maxLeafSize && leafCost <= best.cost)
+			return makeLeaf(refs, box);
+
+		vector<Reference> leftRefs, rightRefs;
+		if (best.spatial) {
+			performSpatialSplit(refs, best, &leftRefs, &rightRefs);
+			if (leftRefs.empty() || rightRefs.empty())
+				return makeLeaf(refs, box);
+			refBudget -= leftRefs.size() + rightRefs.size() - n;
+			bvh->spatialSplits++;
+		} else {
+			int axis = best.axis;
+			sort(refs.begin(), refs.end(), [axis](const Reference &a, const Reference &b) {
+				float ca = centroid(a, axis), cb = centroid(b, axis);
+				return ca < cb || (ca == cb && a.prim < b.prim);
+			});
+			leftRefs.assign(refs.begin(), refs.begin() + best.index);
+			rightRefs.assign(refs.begin() + best.index, refs.end());
+		}
+		vector<Reference>().swap(refs);
+
+		int index = bvh->nodeStorage.size();
+		bvh->nodeStorage.push_back(BVHNode());
+		int left = build(leftRefs, depth + 1);
+		int right = build(rightRefs, depth + 1);
+
+		BVHNode &node = bvh->nodeStorage[index];
+		node.lower = box.lower;
+		node.upper = box.upper;
+		node.a = left;
+		node.b = right;
+		return index;
+	}
+};
+
+} // namespace
+
+void buildBVH(BVH *bvh, ShapeSpan shapeList, const BVHBuildOptions &options)
+{
+	*bvh = BVH();
+
+	vector<Reference> refs;
+	AABB root;
+	for (int i = 0; i < (int)shapeList.size(); i++) {
+		if (shapeList[i].type == 1) {
+			bvh->unbounded.push_back(i);
+			continue;
+		}
+		Reference ref;
+		ref.box = primitiveBounds(shapeList[i]);
+		ref.prim = i;
+		root.grow(ref.box);
+		refs.push_back(ref);
+	}
+	bvh->primitiveCount = refs.size();
+	if (refs.empty()) return;
+
+	Builder builder(shapeList, options, bvh);
+	builder.rootArea = root.area();
+	builder.refBudget = int(options.splitBudget*refs.size());
+	builder.build(refs, 0);
+
+	bvh->nodes = bvh->nodeStorage.data();
+	bvh->nodeCount = bvh->nodeStorage.size();
+	bvh->refs = bvh->refStorage.data();
+	bvh->refCount = bvh->refStorage.size();
+
+	if (options.layout == BVH_LAYOUT_TREELET)
+		layoutBVH(bvh, options.treeletSize, nullptr);
+}
+
+// --------------------------------------------------------------------------
+// Layout
+//
+// Treelets are grown greedily from a root: the sibling pair with the
+// highest weight on the frontier is appended next, until the treelet is
+// full. Pairs left on the frontier become roots of later treelets, so a
+// ray stays within one page for as long as possible, and every node
+// still comes after its parent.
+
+void layoutBVH(BVH *bvh, int treeletSize, const unsigned *weights)
+{
+	if (bvh->nodeCount == 0 || bvh->nodes != bvh->nodeStorage.data()) return;
+
+	const vector<BVHNode> &nodes = bvh->nodeStorage;
+	int n = nodes.size();
+	auto weight = [&](int i) {
+		if (weights) return float(weights[i]);
+		AABB box;
+		box.grow(nodes[i].lower);
+		box.grow(nodes[i].upper);
+		return box.area();
+	};
+
+	// a treelet root is a single node (the tree root) or a sibling pair
+	typedef pair<float, int> Entry; // weight, parent of the pair
+	vector<int> order;
+	order.reserve(n);
+	order.push_back(0);
+	deque<int> roots;
+	if (!nodes[0].isLeaf()) roots.push_back(0);
+
+	while (!roots.empty()) {
+		priority_queue<Entry> frontier;
+		frontier.push(Entry(0.0f, roots.front()));
+		roots.pop_front();
+
+		int size = 0;
+		while (!frontier.empty() && size < treeletSize) {
+			int parent = frontier.top().second;
+			frontier.pop();
+			for (int child : {nodes[parent].a, nodes[parent].b}) {
+				order.push_back(child);
+				if (!nodes[child].isLeaf())
+					frontier.push(Entry(weight(nodes[child].a) + weight(nodes[child].b), child));
+			}
+			size += 2;
+		}
+
+		vector<Entry> rest;
+		for (; !frontier.empty(); frontier.pop())
+			rest.push_back(frontier.top());
+		for (const Entry &entry : rest)
+			roots.push_back(entry.second);
+	}
+
+	vector<int> newIndex(n);
+	for (int i = 0; i < n; i++)
+		newIndex[order[i]] = i;
+
+	vector<BVHNode> reordered(n);
+	for (int i = 0; i < n; i++) {
+		BVHNode node = nodes[order[i]];
+		if (!node.isLeaf()) {
+			node.a = newIndex[node.a];
+			node.b = newIndex[node.b];
+		}
+		reordered[i] = node;
+	}
+
+	bvh->nodeStorage.swap(reordered);
+	bvh->nodes = bvh->nodeStorage.data();
+}
+
+// --------------------------------------------------------------------------
+// Traversal
+
+namespace {
+
+struct StackEntry
+{
+	int node;
+	float tnear;
+};
+
+// slab test; a zero direction component gives an infinite reciprocal, and
+// the NaN from 0*inf (ray in a slab plane) is ignored by the comparisons
+inline bool intersectBox(const BVHNode &node, const vec3 &origin, const vec3 &invDir,
+		float tmin, float tmax, float *tnear)
+{
+	float lo = tmin, hi = tmax;
+	for (int i = 0; i < 3; i++) {
+		float t0 = (node.lower[i] - origin[i])*invDir[i];
+		float t1 = (node.upper[i] - origin[i])*invDir[i];
+		if (invDir[i] < 0.0f) std::swap(t0, t1);
+		lo = t0 > lo ? t0 : lo;
+		hi = t1 < hi ? t1 : hi;
+	}
+	// widen slightly so hits on a box face are not lost to rounding
+	*tnear = lo;
+	return lo <= hi*1.0000004f;
+}
+
+// visits the leaves that may contain a hit in [lowerBound, *upperBound),
+// nearest child first; visitLeaf returns true to stop the traversal
+template <typename LeafFunc>
+void traverse(const BVH &bvh, const Ray &ray, float lowerBound, const float *upperBound, LeafFunc visitLeaf)
+{
+	if (bvh.nodeCount == 0) return;
+
+	vec3 invDir = 1.0f/ray.dirVector;
+	StackEntry stack[2*BVH_MAX_DEPTH + 2];
+	int top = 0;
+
+	float tnear;
+	if (!intersectBox(bvh.nodes[0], ray.origin, invDir, lowerBound, *upperBound, &tnear))
+		return;
+	stack[top++] = {0, tnear};
+
+	while (top > 0) {
+		StackEntry entry = stack[--top];
+		if (entry.tnear > *upperBound*1.0000004f) continue;
+
+		const BVHNode &node = bvh.nodes[entry.node];
+		bvhStats.nodesVisited++;
+		if (bvhVisitCounts) bvhVisitCounts[entry.node]++;
+		if (node.isLeaf()) {
+			if (visitLeaf(node)) return;
+			continue;
+		}
+
+		float tl, tr;
+		bool hitLeft = intersectBox(bvh.nodes[node.a], ray.origin, invDir, lowerBound, *upperBound, &tl);
+		bool hitRight = intersectBox(bvh.nodes[node.b], ray.origin, invDir, lowerBound, *upperBound, &tr);
+		if (hitLeft && hitRight) {
+			if (tl <= tr) {
+				stack[top++] = {node.b, tr};
+				stack[top++] = {node.a, tl};
+			} else {
+				stack[top++] = {node.a, tl};
+				stack[top++] = {node.b, tr};
+			}
+		} else if (hitLeft) {
+			stack[top++] = {node.a, tl};
+		} else if (hitRight) {
+			stack[top++] = {node.b, tr};
+		}
+	}
+}
+
+} // namespace
+
+bool intersectBVH(const BVH &bvh, ShapeSpan shapeList, const Ray &ray,
+		IntersectionInfo *resultInfo, float lowerBound, float upperBound)
+{
+	bvhStats.rays++;
+	bool hit = false;
+	float t = upperBound;
+
+	auto testPrimitive = [&](int prim) {
+		IntersectionInfo aInfo;
+		bvhStats.primitivesTested++;
+		if (testIntersection(ray, shapeList[prim], &aInfo)) {
+			// equal t goes to the lower index, as in a linear scan
+			if (aInfo.t >= lowerBound && (aInfo.t < t ||
+					(hit && aInfo.t == t && prim < resultInfo->index))) {
+				hit = true;
+				t = aInfo.t;
+				resultInfo->t = t;
+				resultInfo->shape = aInfo.shape;
+				resultInfo->index = prim;
+			}
+		}
+	};
+
+	for (int prim : bvh.unbounded)
+		testPrimitive(prim);
+
+	traverse(bvh, ray, lowerBound, &t, [&](const BVHNode &node) {
+		for (int i = 0; i < node.count(); i++)
+			testPrimitive(bvh.refs[node.a + i]);
+		return false;
+	});
+
+	if (bvhRayHook) bvhRayHook(ray, lowerBound, t);
+	return hit;
+}
+
+bool occludedBVH(const BVH &bvh, ShapeSpan shapeList, const Ray &ray,
+		float lowerBound, float upperBound)
+{
+	bvhStats.rays++;
+
+	// the answer only depends on the ray up to the occluder found
+	float searched = upperBound;
+	auto testPrimitive = [&](int prim) {
+		IntersectionInfo aInfo;
+		bvhStats.primitivesTested++;
+		if (testIntersection(ray, shapeList[prim], &aInfo) &&
+				aInfo.t >= lowerBound && aInfo.t < upperBound) {
+			searched = aInfo.t;
+			return true;
+		}
+		return false;
+	};
+
+	bool occluded = false;
+	for (int prim : bvh.unbounded)
+		if (testPrimitive(prim)) {
+			occluded = true;
+			break;
+		}
+
+	if (!occluded) {
+		traverse(bvh, ray, lowerBound, &upperBound, [&](const BVHNode &node) {
+			for (int i = 0; i < node.count(); i++)
+				if (testPrimitive(bvh.refs[node.a + i])) {
+					occluded = true;
+					return true;
+				}
+			return false;
+		});
+	}
+
+	if (bvhRayHook) bvhRayHook(ray, lowerBound, searched);
+	return occluded;
+}
@@ -0,0 +1,146 @@
+// ==========================================================================
+// Bounding Volume Hierarchy for the Ray Tracer
+//  - spatial split BVH (SBVH, Stich et al. 2009): object splits by SAH,
+//    plus spatial splits that clip references at the split plane when the
+//    object split children overlap too much (long thin triangles)
+//  - planes are unbounded and are kept in a separate list
+// ==========================================================================
+#ifndef BVH_H
+#define BVH_H
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+struct AABB
+{
+	glm::vec3 lower;
+	glm::vec3 upper;
+
+	AABB();
+	void grow(const glm::vec3 &p);
+	void grow(const AABB &box);
+	void clip(const AABB &box);
+	bool empty() const;
+	float area() const;
+};
+
+// deepest tree the builder makes, which bounds the traversal stack
+const int BVH_MAX_DEPTH = 60;
+
+// 32 bytes, two nodes per cache line
+//  - inner node: a and b are the indices of the two children, which are
+//    always stored after their parent
+//  - leaf: a is the first entry in refs, b is ~count (always negative)
+struct BVHNode
+{
+	glm::vec3 lower;
+	int a;
+	glm::vec3 upper;
+	int b;
+
+	bool isLeaf() const { return b < 0; }
+	int count() const   { return ~b; }
+};
+
+// node order in memory after the build
+//  - depth first: as built, the left child follows its parent
+//  - treelet: page sized treelets filled with the children most likely to
+//    be visited next, by surface area; siblings are kept side by side
+//  - probe: treelets filled by visit counts from a low resolution render
+enum BVHLayout
+{
+	BVH_LAYOUT_DEPTH_FIRST,
+	BVH_LAYOUT_TREELET,
+	BVH_LAYOUT_PROBE
+};
+
+struct BVHBuildOptions
+{
+	// extra references spatial splits may create, as a fraction of the
+	// primitive count; 0 gives a plain object split BVH
+	float splitBudget = 0.5f;
+
+	// only try spatial splits when the object split children overlap by
+	// more than this fraction of the root surface area
+	float overlapThreshold = 1e-5f;
+
+	int maxLeafSize = 4;
+	int spatialBins = 32;
+
+	BVHLayout layout = BVH_LAYOUT_TREELET;
+	int treeletSize = 128; // nodes, 128*32 bytes is one 4 KB page
+};
+
+// the node and reference arrays point either into the storage vectors or
+// into a memory mapped cache file (bvhcache.h), so a BVH can be moved but
+// not copied
+struct BVH
+{
+	const BVHNode *nodes = nullptr;
+	const int *refs = nullptr;   // primitive indices referenced by leaves
+	int nodeCount = 0;
+	int refCount = 0;
+	std::vector<int> unbounded;  // planes, tested against every ray
+
+	int primitiveCount = 0;
+	int spatialSplits = 0;
+
+	std::vector<BVHNode> nodeStorage;
+	std::vector<int> refStorage;
+	std::shared_ptr<const void> mapping;
+
+	BVH() {}
+	BVH(const BVH &) = delete;
+	BVH &operator=(const BVH &) = delete;
+	BVH(BVH &&) = default;
+	BVH &operator=(BVH &&) = default;
+};
+
+// counters gathered during traversal, reset by the caller
+struct TraversalStats
+{
+	unsigned long long rays = 0;
+	unsigned long long nodesVisited = 0;
+	unsigned long long primitivesTested = 0;
+
+	void add(const TraversalStats &other)
+	{
+		rays += other.rays;
+		nodesVisited += other.nodesVisited;
+		primitivesTested += other.primitivesTested;
+	}
+};
+
+// one per thread, so render threads never share a counter
+extern thread_local TraversalStats bvhStats;
+
+// when set, traversal counts visits per node here (for the probe layout)
+extern unsigned *bvhVisitCounts;
+
+// when set, called with the part of every ray this thread traces that its
+// answer depends on: up to the hit, the occluder or the upper bound
+typedef void (*RayHook)(const Ray &ray, float lowerBound, float upperBound);
+extern thread_local RayHook bvhRayHook;
+
+// box around a sphere or triangle, empty for planes
+AABB primitiveBounds(const Shape &shape);
+
+// builds the hierarchy; all layouts but the probe one are applied here
+void buildBVH(BVH *bvh, ShapeSpan shapeList, const BVHBuildOptions &options);
+
+// reorders the nodes of a built (not memory mapped) BVH into treelets;
+// weights are per node visit counts, or null to use surface area
+void layoutBVH(BVH *bvh, int treeletSize, const unsigned *weights);
+
+// closest hit with lowerBound <= t < upperBound
+bool intersectBVH(const BVH &bvh, ShapeSpan shapeList, const Ray &ray,
+		IntersectionInfo *resultInfo, float lowerBound, float upperBound);
+
+// any hit with lowerBound <= t < upperBound, for shadow rays
+bool occludedBVH(const BVH &bvh, ShapeSpan shapeList, const Ray &ray,
+		float lowerBound, float upperBound);
+
+#endif // BVH_H
@@ -0,0 +1,229 @@
+// ==========================================================================
+// On-disk Cache for the Bounding Volume Hierarchy
+//
+// File layout (native byte order, checked on load):
+//   CacheHeader
+//   BVHNode  nodes[nodeCount]
+//   int      refs[refCount]
+//   int      unbounded[unboundedCount]
+// ==========================================================================
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bvhcache.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t nodeSize;
+	uint32_t primitiveCount;
+	uint64_t sceneHash;
+	uint32_t spatialSplits;
+	uint32_t nodeCount;
+	uint32_t refCount;
+	uint32_t unboundedCount;
+};
+
+template <typename T>
+uint64_t hashValue(uint64_t hash, const T &value)
+{
+	return hashBytes(hash, &value, sizeof(T));
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool validateBVH(const BVH &bvh, int shapeCount)
+{
+	vector<int> depth(bvh.nodeCount, 0);
+	for (int i = 0; i < bvh.nodeCount; i++) {
+		const BVHNode &node = bvh.nodes[i];
+		if (node.isLeaf()) {
+			if (node.a < 0 || node.count() > bvh.refCount - node.a)
+				return false;
+		} else {
+			if (node.a <= i || node.b <= i || node.a >= bvh.nodeCount || node.b >= bvh.nodeCount)
+				return false;
+			depth[node.a] = depth[node.b] = depth[i] + 1;
+			if (depth[i] + 1 > BVH_MAX_DEPTH)
+				return false;
+		}
+	}
+	for (int i = 0; i < bvh.refCount; i++)
+		if (bvh.refs[i] < 0 || bvh.refs[i] >= shapeCount)
+			return false;
+	for (int prim : bvh.unbounded)
+		if (prim < 0 || prim >= shapeCount)
+			return false;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+
+uint64_t hashSceneGeometry(ShapeSpan shapeList, const BVHBuildOptions &options)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = hashValue(hash, BVH_CACHE_VERSION);
+	hash = hashValue(hash, options.splitBudget);
+	hash = hashValue(hash, options.overlapThreshold);
+	hash = hashValue(hash, options.maxLeafSize);
+	hash = hashValue(hash, options.spatialBins);
+	hash = hashValue(hash, options.layout);
+	hash = hashValue(hash, options.treeletSize);
+
+	uint64_t count = shapeList.size();
+	hash = hashValue(hash, count);
+	for (const Shape &shape : shapeList) {
+		hash = hashValue(hash, shape.type);
+		hash = hashValue(hash, shape.addition);
+		uint64_t points = shape.data.size();
+		hash = hashValue(hash, points);
+		if (points > 0)
+			hash = hashBytes(hash, &shape.data[0], points*sizeof(shape.data[0]));
+	}
+	return hash;
+}
+
+string bvhCachePath(const string &directory, uint64_t sceneHash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)sceneHash);
+	return directory + "/" + name;
+}
+
+// --------------------------------------------------------------------------
+
+bool loadBVHCache(BVH *bvh, const string &path, uint64_t sceneHash, ShapeSpan shapeList)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t size = info.st_size;
+	void *address = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) return false;
+
+	shared_ptr<const void> mapping(address, [size](const void *p) {
+		munmap(const_cast<void *>(p), size);
+	});
+
+	CacheHeader header;
+	memcpy(&header, address, sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+		header.version != BVH_CACHE_VERSION ||
+		header.byteOrder != BYTE_ORDER_MARK ||
+		header.nodeSize != sizeof(BVHNode) ||
+		header.sceneHash != sceneHash) {
+		cout << "BVH cache: ignoring " << path << " (format or scene mismatch)" << endl;
+		return false;
+	}
+
+	size_t expected = sizeof(CacheHeader) + header.nodeCount*sizeof(BVHNode) +
+		(size_t(header.refCount) + header.unboundedCount)*sizeof(int);
+	if (size != expected) {
+		cout << "BVH cache: ignoring " << path << " (truncated)" << endl;
+		return false;
+	}
+
+	const char *base = static_cast<const char *>(address);
+	const BVHNode *nodes = reinterpret_cast<const BVHNode *>(base + sizeof(CacheHeader));
+	const int *refs = reinterpret_cast<const int *>(nodes + header.nodeCount);
+	const int *unbounded = refs + header.refCount;
+
+	BVH loaded;
+	loaded.nodes = nodes;
+	loaded.nodeCount = header.nodeCount;
+	loaded.refs = refs;
+	loaded.refCount = header.refCount;
+	loaded.unbounded.assign(unbounded, unbounded + header.unboundedCount);
+	loaded.primitiveCount = header.primitiveCount;
+	loaded.spatialSplits = header.spatialSplits;
+	loaded.mapping = mapping;
+
+	if (!validateBVH(loaded, shapeList.size())) {
+		cout << "BVH cache: ignoring " << path << " (failed validation)" << endl;
+		return false;
+	}
+
+	*bvh = std::move(loaded);
+	return true;
+}
+
+bool saveBVHCache(const BVH &bvh, const string &directory, uint64_t sceneHash)
+{
+	if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+		cout << "BVH cache: could not create directory " << directory << endl;
+		return false;
+	}
+
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = BVH_CACHE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nodeSize = sizeof(BVHNode);
+	header.primitiveCount = bvh.primitiveCount;
+	header.sceneHash = sceneHash;
+	header.spatialSplits = bvh.spatialSplits;
+	header.nodeCount = bvh.nodeCount;
+	header.refCount = bvh.refCount;
+	header.unboundedCount = bvh.unbounded.size();
+
+	string path = bvhCachePath(directory, sceneHash);
+	string temporary = path + ".tmp." + to_string(getpid());
+	FILE *f = fopen(temporary.c_str(), "wb");
+	if (!f) {
+		cout << "BVH cache: could not write " << temporary << endl;
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (bvh.nodeCount > 0)
+		ok = ok && fwrite(bvh.nodes, sizeof(BVHNode), bvh.nodeCount, f) == size_t(bvh.nodeCount);
+	if (bvh.refCount > 0)
+		ok = ok && fwrite(bvh.refs, sizeof(int), bvh.refCount, f) == size_t(bvh.refCount);
+	if (!bvh.unbounded.empty())
+		ok = ok && fwrite(&bvh.unbounded[0], sizeof(int), bvh.unbounded.size(), f) == bvh.unbounded.size();
+	ok = (fclose(f) == 0) && ok;
+
+	if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+		cout << "BVH cache: could not write " << path << endl;
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
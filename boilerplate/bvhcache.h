@@ -0,0 +1,42 @@
+// ==========================================================================
+// On-disk Cache for the Bounding Volume Hierarchy
+//  - the cache file is named after a hash of the scene geometry and the
+//    build options, so any change to either gives a new file
+//  - on a hit the file is memory mapped and its nodes are traversed in
+//    place; nothing is copied or rebuilt
+// ==========================================================================
+#ifndef BVHCACHE_H
+#define BVHCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+
+// bump whenever the file layout or the BVH build changes meaning
+const uint32_t BVH_CACHE_VERSION = 1;
+
+// hash of everything that affects the built hierarchy: shape types and
+// geometry (not materials) and the build options
+uint64_t hashSceneGeometry(ShapeSpan shapeList, const BVHBuildOptions &options);
+
+// 64-bit FNV-1a, start with 14695981039346656037
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size);
+
+// checks that every index in a mapped BVH stays in range and that the tree
+// is no deeper than the traversal stack allows
+bool validateBVH(const BVH &bvh, int shapeCount);
+
+std::string bvhCachePath(const std::string &directory, uint64_t sceneHash);
+
+// maps a cache file into bvh; returns false if the file is missing, was
+// written for another scene or format, or fails validation
+bool loadBVHCache(BVH *bvh, const std::string &path, uint64_t sceneHash, ShapeSpan shapeList);
+
+// writes the file through a temporary name and a rename, so concurrent
+// renders never see a partial file; creates the directory if needed
+bool saveBVHCache(const BVH &bvh, const std::string &directory, uint64_t sceneHash);
+
+#endif // BVHCACHE_H
@@ -0,0 +1,249 @@
+// ==========================================================================
+// Render Checkpoints
+//
+// File layout (native byte order):
+//   FileHeader
+//   then records, each a RecordHeader and size bytes of data
+// A record's checksum is the FNV-1a hash of its header, with the checksum
+// zero, and its data. The writer's thread fills checksums in before it
+// writes, so the renderer's part of adding a record is a copy.
+// ==========================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "adaptive.h"
+#include "bvhcache.h"
+
+using namespace std;
+
+static_assert(is_trivially_copyable<PixelEstimate>::value, "estimates are written to checkpoints as they are");
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'H', 'E', 'C', 'K', 'P'};
+const uint32_t RECORD_MARKER = 0x454c4954; // "TILE"
+
+// records gathered past this are written without waiting for the
+// interval, so what they hold in memory stays bounded
+const size_t FLUSH_BYTES = 64 << 20;
+
+struct FileHeader
+{
+	char magic[8];
+	uint32_t version, kind;
+	int32_t width, height, tileSize, pixelBytes;
+	uint64_t settingsHash;
+};
+
+struct RecordHeader
+{
+	uint32_t marker;
+	int32_t x, y, width, height;
+	uint32_t size;
+	uint64_t checksum;
+};
+
+uint64_t recordChecksum(RecordHeader header, const void *data)
+{
+	header.checksum = 0;
+	uint64_t hash = hashBytes(14695981039346656037ull, &header, sizeof(header));
+	return hashBytes(hash, data, header.size);
+}
+
+FileHeader makeFileHeader(const CheckpointLayout &layout)
+{
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.kind = layout.kind;
+	header.width = layout.width;
+	header.height = layout.height;
+	header.tileSize = layout.tileSize;
+	header.pixelBytes = checkpointPixelBytes(layout.kind);
+	header.settingsHash = layout.settingsHash;
+	return header;
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+	const char *bytes = (const char *)data;
+	while (size > 0) {
+		ssize_t written = ::write(fd, bytes, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+size_t checkpointPixelBytes(CheckpointKind kind)
+{
+	return kind == CHECKPOINT_ESTIMATES ? sizeof(PixelEstimate) : 3*sizeof(float);
+}
+
+CheckpointStatus loadCheckpoint(const string &path, const CheckpointLayout &layout,
+		const function<void(const Tile &tile, const void *data)> &record, long long *validBytes)
+{
+	*validBytes = 0;
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) return CHECKPOINT_MISSING;
+	FileHeader header, expected = makeFileHeader(layout);
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(&header, &expected, sizeof(header)) != 0) {
+		fclose(file);
+		return CHECKPOINT_MISMATCH;
+	}
+
+	int tileSize = layout.tileSize;
+	int tilesDown = (layout.height + tileSize - 1)/tileSize;
+	size_t pixelBytes = checkpointPixelBytes(layout.kind);
+	// floats, so the data is aligned for the colours and estimates it holds
+	vector<float> data((size_t(tileSize)*tileSize*pixelBytes + 3)/4);
+	long long valid = sizeof(header);
+	RecordHeader recordHeader;
+	while (fread(&recordHeader, sizeof(recordHeader), 1, file) == 1) {
+		Tile tile;
+		tile.x = recordHeader.x;
+		tile.y = recordHeader.y;
+		tile.width = recordHeader.width;
+		tile.height = recordHeader.height;
+		// one of makeTiles' tiles, and as big as such a tile's record is
+		bool sensible = recordHeader.marker == RECORD_MARKER &&
+			tile.x >= 0 && tile.x < layout.width && tile.x % tileSize == 0 &&
+			tile.y >= 0 && tile.y < layout.height && tile.y % tileSize == 0 &&
+			tile.width == std::min(tileSize, layout.width - tile.x) &&
+			tile.height == std::min(tileSize, layout.height - tile.y) &&
+			recordHeader.size == size_t(tile.width)*tile.height*pixelBytes;
+		if (!sensible || fread(data.data(), 1, recordHeader.size, file) != recordHeader.size ||
+				recordChecksum(recordHeader, data.data()) != recordHeader.checksum)
+			break;
+		tile.index = tile.x/tileSize*tilesDown + tile.y/tileSize;
+		record(tile, data.data());
+		valid += sizeof(recordHeader) + recordHeader.size;
+	}
+	fclose(file);
+	*validBytes = valid;
+	return CHECKPOINT_LOADED;
+}
+
+// --------------------------------------------------------------------------
+
+CheckpointWriter::CheckpointWriter(double interval)
+	: m_interval(interval)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	finish();
+}
+
+bool CheckpointWriter::open(const string &path, const CheckpointLayout &layout, long long keepBytes)
+{
+	if (keepBytes > 0) {
+		m_fd = ::open(path.c_str(), O_WRONLY);
+		if (m_fd >= 0 && (ftruncate(m_fd, keepBytes) != 0 || lseek(m_fd, 0, SEEK_END) < 0)) {
+			close(m_fd);
+			m_fd = -1;
+		}
+	} else {
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		FileHeader header = makeFileHeader(layout);
+		if (m_fd >= 0 && !writeAll(m_fd, &header, sizeof(header))) {
+			close(m_fd);
+			m_fd = -1;
+		}
+	}
+	if (m_fd < 0) return false;
+	m_thread = thread(&CheckpointWriter::run, this);
+	return true;
+}
+
+void CheckpointWriter::run()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;) {
+		m_changed.wait_for(lock, chrono::duration<double>(m_interval), [&]() {
+			return m_stopping || m_pending.size() >= FLUSH_BYTES;
+		});
+		if (m_pending.empty()) {
+			if (m_stopping) return;
+			continue;
+		}
+		vector<char> batch;
+		batch.swap(m_pending);
+		lock.unlock();
+
+		for (size_t at = 0; at < batch.size(); ) {
+			RecordHeader header;
+			memcpy(&header, &batch[at], sizeof(header));
+			header.checksum = recordChecksum(header, &batch[at + sizeof(header)]);
+			memcpy(&batch[at], &header, sizeof(header));
+			at += sizeof(header) + header.size;
+		}
+		// a kill in the middle of this leaves a torn record, which loading
+		// drops along with anything after it
+		bool written = writeAll(m_fd, batch.data(), batch.size()) && fdatasync(m_fd) == 0;
+		int error = errno;
+
+		lock.lock();
+		if (!written) {
+			cout << "Checkpoint: write failed (" << strerror(error) << "), checkpoints stopped" << endl;
+			m_failed = true;
+			m_pending.clear();
+			return;
+		}
+		m_writes++;
+		m_bytes += batch.size();
+	}
+}
+
+void CheckpointWriter::add(const Tile &tile, const void *data, size_t size)
+{
+	RecordHeader header;
+	header.marker = RECORD_MARKER;
+	header.x = tile.x;
+	header.y = tile.y;
+	header.width = tile.width;
+	header.height = tile.height;
+	header.size = size;
+	header.checksum = 0;
+	lock_guard<mutex> lock(m_mutex);
+	if (m_fd < 0 || m_failed || m_stopping) return;
+	const char *bytes = (const char *)&header;
+	m_pending.insert(m_pending.end(), bytes, bytes + sizeof(header));
+	m_pending.insert(m_pending.end(), (const char *)data, (const char *)data + size);
+	m_records++;
+	if (m_pending.size() >= FLUSH_BYTES) m_changed.notify_all();
+}
+
+bool CheckpointWriter::finish()
+{
+	if (m_thread.joinable()) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stopping = true;
+			m_changed.notify_all();
+		}
+		m_thread.join();
+		close(m_fd);
+		m_fd = -1;
+		cout << "Checkpoint: " << m_records << " records, " << m_bytes/1048576.0 << " MB in "
+			<< m_writes << " writes" << endl;
+	}
+	return !m_failed;
+}
@@ -0,0 +1,95 @@
+// ==========================================================================
+// Render Checkpoints
+//  - finished tiles are appended to a file as records, so a render that is
+//    killed can be resumed without doing again the work it had done; for
+//    adaptive renders a record is a tile's per pixel estimates after a
+//    pass over it, and a later record of a tile replaces an earlier one
+//  - the renderer only copies a record into memory. A thread of the
+//    checkpoint's own writes what has gathered every interval, in one
+//    write, and syncs it, so workers never wait on the disk
+//  - the file starts with the render's size, tile size and a hash of its
+//    scene and settings, so it is never resumed into another render;
+//    every record has a checksum, and a record torn by a kill mid-write
+//    ends the file there when it is loaded
+// ==========================================================================
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiles.h"
+
+// bump whenever the file layout or what a record holds changes
+const uint32_t CHECKPOINT_VERSION = 1;
+
+enum CheckpointKind
+{
+	CHECKPOINT_COLORS = 1,   // a tile's colours, in columns as renderImage delivers them
+	CHECKPOINT_ESTIMATES = 2 // a tile's PixelEstimates, by row
+};
+
+// what is kept of a render: its size and tiles, what its records hold,
+// and a hash of everything else that changes them
+struct CheckpointLayout
+{
+	int width = 0, height = 0, tileSize = 0;
+	CheckpointKind kind = CHECKPOINT_COLORS;
+	uint64_t settingsHash = 0;
+};
+
+enum CheckpointStatus
+{
+	CHECKPOINT_MISSING,  // no file
+	CHECKPOINT_MISMATCH, // not a checkpoint, or one of another render
+	CHECKPOINT_LOADED
+};
+
+// the bytes a record holds a pixel in
+size_t checkpointPixelBytes(CheckpointKind kind);
+
+// reads the records of a checkpoint of layout, calling record with each
+// one's tile, as makeTiles numbers it, and data, in the order they were
+// written. Reading stops at the first record that is torn or makes no
+// sense; *validBytes is where the records before it end
+CheckpointStatus loadCheckpoint(const std::string &path, const CheckpointLayout &layout,
+		const std::function<void(const Tile &tile, const void *data)> &record, long long *validBytes);
+
+class CheckpointWriter
+{
+	int m_fd = -1;
+	double m_interval;           // seconds between writes
+	std::vector<char> m_pending; // records not yet written
+	bool m_stopping = false;
+	bool m_failed = false;
+	long long m_records = 0, m_bytes = 0;
+	int m_writes = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	std::thread m_thread;
+
+	void run();
+
+public:
+	// interval is in seconds
+	explicit CheckpointWriter(double interval);
+	~CheckpointWriter();
+
+	// starts a checkpoint of layout at path, replacing any file there; with
+	// keepBytes, the valid part of a loaded checkpoint is kept instead and
+	// records are appended after it
+	bool open(const std::string &path, const CheckpointLayout &layout, long long keepBytes);
+
+	// copies a tile's record to be written; never waits for the disk
+	void add(const Tile &tile, const void *data, size_t size);
+
+	// writes what is pending and stops; false if any write failed
+	bool finish();
+};
+
+#endif // CHECKPOINT_H
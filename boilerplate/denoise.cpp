@@ -0,0 +1,197 @@
+// ==========================================================================
+// Edge-Avoiding A-Trous Denoiser
+//
+// The image and its guides are copied into planes of floats, one per
+// channel, with a border as wide as the widest tap, so four neighbouring
+// pixels' taps are four neighbouring floats and no tap needs a bounds
+// check. The border's depth is a sentinel no pixel is close to, which
+// gives its taps no weight. All the terms of a tap's weight are summed
+// into one exponent, one exp per tap.
+// ==========================================================================
+
+#include <algorithm>
+#include <cmath>
+
+#include "denoise.h"
+#include "float4.h"
+#include "tiles.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+const float MISS_DEPTH = 1e6f;    // pixels that hit nothing
+const float BORDER_DEPTH = 1e30f; // pixels outside the image
+const int MAX_PASSES = 8;
+const int BAND_HEIGHT = 8;
+
+// the B3 spline, 1/16 (1 4 6 4 1)
+const float KERNEL[3] = {3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f};
+
+// e^-x for x >= 0, to about 1e-4 relative; 2^-100 past about e^-69, a
+// weight that is no weight but keeps clear of denormals, which are slow
+inline Float4 expNegative(Float4 x)
+{
+	Float4 t = max(splat(0.0f) - x*splat(1.44269504f), splat(-100.0f));
+	Float4 n = floor(t);
+	Float4 f = t - n;
+	// 2^f on [0, 1), its Taylor series
+	Float4 p = splat(0.00133336f);
+	p = p*f + splat(0.00961813f);
+	p = p*f + splat(0.05550411f);
+	p = p*f + splat(0.24022651f);
+	p = p*f + splat(0.69314718f);
+	p = p*f + splat(1.0f);
+	return p*pow2(n);
+}
+
+// an image and its guides as planes with a border of pad pixels; stride
+// is a multiple of four
+struct Planes
+{
+	int width, height, pad, stride;
+	vector<float> color[2][3]; // filtered from one into the other each pass
+	vector<float> albedo[3], normal[3], depth;
+
+	int index(int x, int y) const { return (y + pad)*stride + x + pad; }
+};
+
+void filterBand(Planes &planes, int source, int y0, int y1, int step, const DenoiseOptions &options,
+		float inverseColor, float inverseNormal, float inverseAlbedo)
+{
+	const vector<float> *in = planes.color[source];
+	vector<float> *out = planes.color[1 - source];
+	for (int y = y0; y < y1; y++) {
+		// the last group of a row may run into the border, which is there
+		// to be written to
+		for (int x = 0; x < planes.width; x += 4) {
+			int p = planes.index(x, y);
+			Float4 cr = load(&in[0][p]), cg = load(&in[1][p]), cb = load(&in[2][p]);
+			Float4 ar = load(&planes.albedo[0][p]), ag = load(&planes.albedo[1][p]), ab = load(&planes.albedo[2][p]);
+			Float4 nx = load(&planes.normal[0][p]), ny = load(&planes.normal[1][p]), nz = load(&planes.normal[2][p]);
+			Float4 z = load(&planes.depth[p]);
+			Float4 inverseDepth = splat(1.0f)/(z*splat(options.depthSigma*step));
+			Float4 sumR = splat(0.0f), sumG = splat(0.0f), sumB = splat(0.0f), sumWeight = splat(0.0f);
+			for (int dy = -2; dy <= 2; dy++) {
+				for (int dx = -2; dx <= 2; dx++) {
+					int q = p + dy*step*planes.stride + dx*step;
+					Float4 qr = load(&in[0][q]), qg = load(&in[1][q]), qb = load(&in[2][q]);
+					Float4 d0 = qr - cr, d1 = qg - cg, d2 = qb - cb;
+					Float4 energy = (d0*d0 + d1*d1 + d2*d2)*splat(inverseColor);
+					d0 = load(&planes.normal[0][q]) - nx;
+					d1 = load(&planes.normal[1][q]) - ny;
+					d2 = load(&planes.normal[2][q]) - nz;
+					energy = energy + (d0*d0 + d1*d1 + d2*d2)*splat(inverseNormal);
+					d0 = load(&planes.albedo[0][q]) - ar;
+					d1 = load(&planes.albedo[1][q]) - ag;
+					d2 = load(&planes.albedo[2][q]) - ab;
+					energy = energy + (d0*d0 + d1*d1 + d2*d2)*splat(inverseAlbedo);
+					energy = energy + abs(load(&planes.depth[q]) - z)*inverseDepth;
+					Float4 weight = splat(KERNEL[std::abs(dx)]*KERNEL[std::abs(dy)])*expNegative(energy);
+					sumR = sumR + weight*qr;
+					sumG = sumG + weight*qg;
+					sumB = sumB + weight*qb;
+					sumWeight = sumWeight + weight;
+				}
+			}
+			// the centre tap alone weighs 9/64, so the sum is never 0
+			store(&out[0][p], sumR/sumWeight);
+			store(&out[1][p], sumG/sumWeight);
+			store(&out[2][p], sumB/sumWeight);
+		}
+	}
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+void GuideAccumulator::add(const PixelGuide &guide)
+{
+	sum.albedo += guide.albedo;
+	sum.normal += guide.normal;
+	sum.depth += guide.depth;
+	if (samples == 0) sum.shape = guide.shape;
+	samples++;
+	if (guide.depth > 0.0f) hits++;
+}
+
+PixelGuide GuideAccumulator::average() const
+{
+	PixelGuide guide;
+	if (samples > 0) {
+		guide.albedo = sum.albedo/float(samples);
+		guide.normal = sum.normal/float(samples);
+	}
+	if (hits > 0) guide.depth = sum.depth/hits;
+	guide.shape = sum.shape;
+	return guide;
+}
+
+void denoiseImage(vector<vec3> *color, const vector<PixelGuide> &guides,
+		int width, int height, const DenoiseOptions &options, int workers)
+{
+	int passes = std::min(std::max(options.passes, 0), MAX_PASSES);
+	if (passes == 0 || width <= 0 || height <= 0) return;
+
+	Planes planes;
+	planes.width = width;
+	planes.height = height;
+	planes.pad = 2 << (passes - 1);
+	planes.stride = (width + 2*planes.pad + 3) & ~3;
+	size_t size = size_t(planes.stride)*(height + 2*planes.pad) + 4;
+	for (int c = 0; c < 3; c++) {
+		planes.color[0][c].assign(size, 0.0f);
+		planes.color[1][c].assign(size, 0.0f);
+		planes.albedo[c].assign(size, 0.0f);
+		planes.normal[c].assign(size, 0.0f);
+	}
+	planes.depth.assign(size, BORDER_DEPTH);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int p = planes.index(x, y);
+			const vec3 &c = (*color)[y*width + x];
+			const PixelGuide &guide = guides[y*width + x];
+			for (int k = 0; k < 3; k++) {
+				planes.color[0][k][p] = c[k];
+				planes.albedo[k][p] = guide.albedo[k];
+				planes.normal[k][p] = guide.normal[k];
+			}
+			planes.depth[p] = guide.depth > 0.0f ? guide.depth : MISS_DEPTH;
+		}
+	}
+
+	vector<Tile> bands;
+	for (int y = 0; y < height; y += BAND_HEIGHT) {
+		Tile band;
+		band.index = bands.size();
+		band.x = 0;
+		band.y = y;
+		band.width = width;
+		band.height = std::min(BAND_HEIGHT, height - y);
+		bands.push_back(band);
+	}
+
+	int source = 0;
+	float colorSigma = options.colorSigma;
+	for (int pass = 0; pass < passes; pass++) {
+		int step = 1 << pass;
+		float inverseColor = 1.0f/(colorSigma*colorSigma);
+		float inverseNormal = 1.0f/(options.normalSigma*options.normalSigma*step*step);
+		float inverseAlbedo = 1.0f/(options.albedoSigma*options.albedoSigma);
+		renderTiles(bands, workers, [&](const Tile &band, int worker) {
+			filterBand(planes, source, band.y, band.y + band.height, step, options,
+				inverseColor, inverseNormal, inverseAlbedo);
+		}, nullptr);
+		source = 1 - source;
+		colorSigma *= 0.5f;
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int p = planes.index(x, y);
+			(*color)[y*width + x] = vec3(planes.color[source][0][p], planes.color[source][1][p], planes.color[source][2][p]);
+		}
+	}
+}
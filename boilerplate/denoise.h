@@ -0,0 +1,53 @@
+// ==========================================================================
+// Edge-Avoiding A-Trous Denoiser
+//  - a few passes of a 5x5 B3 spline filter whose taps are spread twice as
+//    far apart each pass (Dammertz et al. 2010), so a wide filter still
+//    costs 25 taps a pass
+//  - each tap is weighted by how much its pixel looks like the centre one:
+//    its colour, and the albedo, normal and depth of what its camera ray
+//    hit, which the sampling noise does not touch; edges survive and the
+//    noise between them is averaged away
+//  - bands of rows are spread over the tile scheduler's workers, four
+//    pixels at a time with SSE where the compiler has it
+// ==========================================================================
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// what the camera ray of a pixel hit; depth 0 and shape -1 if it hit
+// nothing. Also what the renderer's AOVs are made from
+struct PixelGuide
+{
+	glm::vec3 albedo = glm::vec3(0.0f);
+	glm::vec3 normal = glm::vec3(0.0f);
+	float depth = 0.0f; // distance from the camera
+	int shape = -1;     // index into the shape list
+};
+
+// averages the guides of a pixel's samples; depth over the samples that
+// hit something, and the shape is the first sample's
+struct GuideAccumulator
+{
+	PixelGuide sum;
+	int samples = 0, hits = 0;
+
+	void add(const PixelGuide &guide);
+	PixelGuide average() const;
+};
+
+struct DenoiseOptions
+{
+	int passes = 5;           // the last one's taps are 2^passes pixels out
+	float colorSigma = 0.5f;  // halved every pass
+	float normalSigma = 0.3f; // grows with the tap spacing
+	float depthSigma = 0.05f; // relative to the centre's depth, and grows too
+	float albedoSigma = 0.1f;
+};
+
+// filters color (width*height pixels by row) in place
+void denoiseImage(std::vector<glm::vec3> *color, const std::vector<PixelGuide> &guides,
+		int width, int height, const DenoiseOptions &options, int workers);
+
+#endif // DENOISE_H
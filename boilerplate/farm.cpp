@@ -0,0 +1,171 @@
+// ==========================================================================
+// Distributed Tile Rendering
+//
+// Each worker gets a thread in the coordinator that loops: take a tile,
+// send "render W H region X Y TW TH", read the daemon's tiles for that
+// region back. The region's own tiles arrive in any order; the frame tile
+// is finished when its last one is in. Scheduling state is shared under
+// one mutex and a condition variable wakes threads waiting for work.
+// ==========================================================================
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "farm.h"
+#include "socketio.h"
+
+using namespace std;
+
+namespace {
+
+struct FarmState
+{
+	mutex lock;
+	condition_variable changed;
+	vector<Tile> tiles;
+	deque<int> pending;      // never handed out, or given back by a failure
+	vector<int> inFlight;    // copies of each tile being rendered
+	vector<bool> done;
+	int doneCount = 0;
+	vector<Connection *> busy; // per worker, set while it renders a tile
+};
+
+// the next tile for a worker: a pending one, else a second copy of one
+// in flight elsewhere; -1 when there is nothing to take and the worker
+// should wait
+int takeTile(FarmState &state, bool *duplicate)
+{
+	*duplicate = false;
+	if (!state.pending.empty()) {
+		int tile = state.pending.front();
+		state.pending.pop_front();
+		return tile;
+	}
+	for (int t = 0; t < (int)state.tiles.size(); t++) {
+		if (!state.done[t] && state.inFlight[t] == 1) {
+			*duplicate = true;
+			return t;
+		}
+	}
+	return -1;
+}
+
+// once the frame is complete, stragglers still rendering a tile somebody
+// else already returned are cut off rather than waited for
+void interruptStragglers(FarmState &state)
+{
+	if (state.doneCount < (int)state.tiles.size()) return;
+	for (Connection *connection : state.busy)
+		if (connection) connection->interrupt();
+}
+
+// asks the worker for one frame tile and reads its region back
+bool renderTile(Connection &worker, const Tile &tile, int width, int height,
+		const string &options, vector<unsigned char> *rgb)
+{
+	char request[256];
+	snprintf(request, sizeof(request), "render %d %d region %d %d %d %d", width, height,
+		tile.x, tile.y, tile.width, tile.height);
+	string line;
+	if (!worker.writeLine(request + options) || !worker.readLine(&line)) return false;
+	int parts;
+	if (sscanf(line.c_str(), "image %*d %*d %d", &parts) != 1) return false;
+
+	rgb->assign(tile.width*tile.height*3, 0);
+	vector<unsigned char> bytes;
+	for (int p = 0; p < parts; p++) {
+		int x, y, w, h;
+		if (!worker.readLine(&line) || sscanf(line.c_str(), "tile %d %d %d %d", &x, &y, &w, &h) != 4) return false;
+		if (x < tile.x || y < tile.y || x + w > tile.x + tile.width || y + h > tile.y + tile.height) return false;
+		bytes.resize(w*h*3);
+		if (!worker.readBytes(&bytes[0], bytes.size())) return false;
+		for (int row = 0; row < h; row++)
+			copy(&bytes[row*w*3], &bytes[(row + 1)*w*3],
+				&(*rgb)[((y - tile.y + row)*tile.width + x - tile.x)*3]);
+	}
+	return worker.readLine(&line) && line.compare(0, 4, "done") == 0;
+}
+
+} // namespace
+
+bool renderOnFarm(const vector<string> &addresses, int width, int height,
+		const FarmOptions &options,
+		const function<void(const Tile &tile, const unsigned char *rgb)> &deliver,
+		FarmStats *stats)
+{
+	FarmState state;
+	state.tiles = makeTiles(width, height, options.tileSize);
+	for (int t = 0; t < (int)state.tiles.size(); t++)
+		state.pending.push_back(t);
+	state.inFlight.assign(state.tiles.size(), 0);
+	state.done.assign(state.tiles.size(), false);
+	state.busy.assign(addresses.size(), nullptr);
+	*stats = FarmStats();
+	stats->tiles = state.tiles.size();
+	stats->tilesPerWorker.assign(addresses.size(), 0);
+	string renderOptions = options.render.empty() ? "" : " " + options.render;
+
+	auto work = [&](int w) {
+		Connection worker;
+		bool alive = connectAddress(addresses[w].c_str(), &worker);
+		if (alive) worker.setTimeout(options.timeout);
+		vector<unsigned char> rgb;
+		int tile = -1;
+		while (alive) {
+			{
+				unique_lock<mutex> lock(state.lock);
+				bool duplicate;
+				for (;;) {
+					if (state.doneCount == (int)state.tiles.size()) break;
+					tile = takeTile(state, &duplicate);
+					if (tile >= 0) break;
+					state.changed.wait(lock);
+				}
+				if (tile < 0) break;
+				state.inFlight[tile]++;
+				state.busy[w] = &worker;
+				if (duplicate) stats->duplicates++;
+			}
+
+			alive = renderTile(worker, state.tiles[tile], width, height, renderOptions, &rgb);
+
+			lock_guard<mutex> lock(state.lock);
+			state.inFlight[tile]--;
+			state.busy[w] = nullptr;
+			if (state.done[tile] && !alive) {
+				// cut off after the tile came back from elsewhere
+				alive = true;
+				break;
+			}
+			if (alive && !state.done[tile]) {
+				state.done[tile] = true;
+				state.doneCount++;
+				stats->tilesPerWorker[w]++;
+				deliver(state.tiles[tile], &rgb[0]);
+				interruptStragglers(state);
+			} else if (!alive && !state.done[tile] && state.inFlight[tile] == 0) {
+				state.pending.push_front(tile);
+				stats->reissued++;
+			}
+			tile = -1;
+			state.changed.notify_all();
+		}
+
+		lock_guard<mutex> lock(state.lock);
+		if (!alive) {
+			stats->failedWorkers++;
+			fprintf(stderr, "worker %s failed\n", addresses[w].c_str());
+		}
+		worker.close();
+	};
+
+	vector<thread> threads;
+	for (int w = 0; w < (int)addresses.size(); w++)
+		threads.push_back(thread(work, w));
+	for (thread &t : threads)
+		t.join();
+	return state.doneCount == (int)state.tiles.size();
+}
@@ -0,0 +1,49 @@
+// ==========================================================================
+// Distributed Tile Rendering
+//  - a coordinator cuts the frame into large tiles and hands them to
+//    worker processes, render daemons (--serve) on this or other machines,
+//    one tile at a time per worker, so faster workers take more
+//  - a worker that disconnects or does not answer in time is dropped and
+//    its tile goes back in the queue
+//  - once the queue is empty, idle workers take a second copy of tiles
+//    still being rendered elsewhere, so one slow worker cannot hold up the
+//    end of the frame; the first copy back is kept
+// ==========================================================================
+#ifndef FARM_H
+#define FARM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "tiles.h"
+
+// the largest width or height a render daemon takes a request for
+const int FARM_MAX_SIZE = 16384;
+
+struct FarmOptions
+{
+	int tileSize = 64;     // pixels, best a multiple of the workers' tile size
+	int timeout = 30000;   // milliseconds a worker may take over one tile
+	std::string render;    // extra options for the render requests, such as
+	                       // "camera X Y Z focal F" (see the README)
+};
+
+struct FarmStats
+{
+	int tiles = 0;
+	int reissued = 0;      // tiles queued again after their worker failed
+	int duplicates = 0;    // second copies handed to idle workers
+	int failedWorkers = 0;
+	std::vector<int> tilesPerWorker; // tiles each worker delivered first
+};
+
+// renders a width by height image on the workers at addresses (see
+// socketio.h), calling deliver once for every tile with its RGB bytes, rows
+// bottom up; false if the workers all failed before the frame was done
+bool renderOnFarm(const std::vector<std::string> &addresses, int width, int height,
+		const FarmOptions &options,
+		const std::function<void(const Tile &tile, const unsigned char *rgb)> &deliver,
+		FarmStats *stats);
+
+#endif // FARM_H
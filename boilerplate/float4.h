@@ -0,0 +1,104 @@
+// ==========================================================================
+// Four Floats
+//  - SSE2 where the compiler has it, an array of four floats otherwise,
+//    with the operations the image passes (denoising, quantizing) need;
+//    both give the same results for the same inputs
+// ==========================================================================
+#ifndef FLOAT4_H
+#define FLOAT4_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+
+struct Float4
+{
+	__m128 v;
+};
+
+inline Float4 splat(float x) { return {_mm_set1_ps(x)}; }
+inline Float4 load(const float *p) { return {_mm_loadu_ps(p)}; }
+inline void store(float *p, Float4 a) { _mm_storeu_ps(p, a.v); }
+inline Float4 operator+(Float4 a, Float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Float4 operator-(Float4 a, Float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Float4 operator*(Float4 a, Float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Float4 operator/(Float4 a, Float4 b) { return {_mm_div_ps(a.v, b.v)}; }
+// b where a is NaN
+inline Float4 max(Float4 a, Float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline Float4 min(Float4 a, Float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline Float4 abs(Float4 a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+
+inline Float4 floor(Float4 a)
+{
+	__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	__m128 above = _mm_and_ps(_mm_cmpgt_ps(truncated, a.v), _mm_set1_ps(1.0f));
+	return {_mm_sub_ps(truncated, above)};
+}
+
+// 2^n for whole numbers n in [-126, 127]
+inline Float4 pow2(Float4 n)
+{
+	__m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127)), 23);
+	return {_mm_castsi128_ps(bits)};
+}
+
+// truncated towards zero
+inline void storeInts(int32_t *p, Float4 a) { _mm_storeu_si128((__m128i *)p, _mm_cvttps_epi32(a.v)); }
+
+// sixteen values in [0, 256), truncated, as bytes
+inline void storeBytes(unsigned char *p, Float4 a, Float4 b, Float4 c, Float4 d)
+{
+	__m128i low = _mm_packs_epi32(_mm_cvttps_epi32(a.v), _mm_cvttps_epi32(b.v));
+	__m128i high = _mm_packs_epi32(_mm_cvttps_epi32(c.v), _mm_cvttps_epi32(d.v));
+	_mm_storeu_si128((__m128i *)p, _mm_packus_epi16(low, high));
+}
+
+#else
+
+struct Float4
+{
+	float v[4];
+};
+
+inline Float4 splat(float x) { return {{x, x, x, x}}; }
+inline Float4 load(const float *p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline void store(float *p, Float4 a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+
+#define FLOAT4_OPERATOR(op) \
+	inline Float4 operator op(Float4 a, Float4 b) \
+	{ \
+		Float4 r; \
+		for (int i = 0; i < 4; i++) r.v[i] = a.v[i] op b.v[i]; \
+		return r; \
+	}
+FLOAT4_OPERATOR(+)
+FLOAT4_OPERATOR(-)
+FLOAT4_OPERATOR(*)
+FLOAT4_OPERATOR(/)
+#undef FLOAT4_OPERATOR
+
+// as SSE: b unless a > b, and a < b
+inline Float4 max(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+inline Float4 min(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+inline Float4 abs(Float4 a) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = std::fabs(a.v[i]); return r; }
+inline Float4 floor(Float4 a) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = std::floor(a.v[i]); return r; }
+inline Float4 pow2(Float4 n) { Float4 r; for (int i = 0; i < 4; i++) r.v[i] = ldexp(1.0f, int(n.v[i])); return r; }
+inline void storeInts(int32_t *p, Float4 a) { for (int i = 0; i < 4; i++) p[i] = int32_t(a.v[i]); }
+
+inline void storeBytes(unsigned char *p, Float4 a, Float4 b, Float4 c, Float4 d)
+{
+	const Float4 *quarters[4] = {&a, &b, &c, &d};
+	for (int q = 0; q < 4; q++)
+		for (int i = 0; i < 4; i++)
+			p[4*q + i] = (unsigned char)quarters[q]->v[i];
+}
+
+#endif
+
+#endif // FLOAT4_H
@@ -0,0 +1,136 @@
+// ==========================================================================
+// Ray Footprints for Incremental Re-rendering
+//
+// Rays are walked through the grid cell by cell (Amanatides and Woo 1987)
+// after being clipped to it. Rays outside the grid are not recorded, which
+// is safe because an edit reaching outside it marks every tile.
+// ==========================================================================
+
+#include <algorithm>
+#include <cmath>
+
+#include "footprint.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+thread_local const FootprintGrid *recordGrid = nullptr;
+thread_local Footprint *recordTarget = nullptr;
+
+void markRay(const Ray &ray, float lowerBound, float upperBound)
+{
+	const FootprintGrid &grid = *recordGrid;
+	const vec3 &o = ray.origin, &d = ray.dirVector;
+	float t0 = lowerBound, t1 = upperBound;
+	for (int axis = 0; axis < 3; axis++) {
+		if (d[axis] == 0.0f) {
+			if (o[axis] < grid.bounds.lower[axis] || o[axis] > grid.bounds.upper[axis]) return;
+			continue;
+		}
+		float a = (grid.bounds.lower[axis] - o[axis])/d[axis];
+		float b = (grid.bounds.upper[axis] - o[axis])/d[axis];
+		t0 = std::max(t0, std::min(a, b));
+		t1 = std::min(t1, std::max(a, b));
+	}
+	if (t0 > t1) return;
+
+	int n = grid.resolution;
+	vec3 start = o + t0*d;
+	int cell[3], step[3];
+	float tMax[3], tDelta[3];
+	for (int axis = 0; axis < 3; axis++) {
+		float offset = (start[axis] - grid.bounds.lower[axis])/grid.cellSize[axis];
+		cell[axis] = std::min(std::max(int(offset), 0), n - 1);
+		if (d[axis] > 0.0f) {
+			step[axis] = 1;
+			tMax[axis] = t0 + ((cell[axis] + 1) - offset)*grid.cellSize[axis]/d[axis];
+			tDelta[axis] = grid.cellSize[axis]/d[axis];
+		} else if (d[axis] < 0.0f) {
+			step[axis] = -1;
+			tMax[axis] = t0 + (cell[axis] - offset)*grid.cellSize[axis]/d[axis];
+			tDelta[axis] = -grid.cellSize[axis]/d[axis];
+		} else {
+			step[axis] = 0;
+			tMax[axis] = INFINITY;
+			tDelta[axis] = INFINITY;
+		}
+	}
+
+	// walked with the state in locals, as the cells written could
+	// otherwise alias it
+	uint64_t *bits = recordTarget->cells.data();
+	int x = cell[0], y = cell[1], z = cell[2];
+	float tx = tMax[0], ty = tMax[1], tz = tMax[2];
+	for (;;) {
+		int index = (x*n + y)*n + z;
+		bits[index >> 6] |= uint64_t(1) << (index & 63);
+		if (tx < ty && tx < tz) {
+			if (tx > t1) return;
+			x += step[0];
+			if (x < 0 || x >= n) return;
+			tx += tDelta[0];
+		} else if (ty < tz) {
+			if (ty > t1) return;
+			y += step[1];
+			if (y < 0 || y >= n) return;
+			ty += tDelta[1];
+		} else {
+			if (tz > t1) return;
+			z += step[2];
+			if (z < 0 || z >= n) return;
+			tz += tDelta[2];
+		}
+	}
+}
+
+} // namespace
+
+void initFootprintGrid(FootprintGrid *grid, const AABB &sceneBounds, int resolution)
+{
+	// half the scene's size again on every side
+	vec3 extent = sceneBounds.empty() ? vec3(1.0f) : max(sceneBounds.upper - sceneBounds.lower, vec3(1e-3f));
+	vec3 centre = sceneBounds.empty() ? vec3(0.0f) : 0.5f*(sceneBounds.lower + sceneBounds.upper);
+	grid->bounds = AABB();
+	grid->bounds.grow(centre - extent);
+	grid->bounds.grow(centre + extent);
+	grid->resolution = resolution;
+	grid->cellSize = 2.0f*extent/float(resolution);
+}
+
+void recordFootprint(const FootprintGrid *grid, Footprint *footprint)
+{
+	recordGrid = footprint ? grid : nullptr;
+	recordTarget = footprint;
+	if (footprint) {
+		int cells = grid->resolution*grid->resolution*grid->resolution;
+		footprint->cells.assign((cells + 63)/64, 0);
+	}
+	bvhRayHook = footprint ? markRay : nullptr;
+}
+
+bool footprintOverlaps(const FootprintGrid &grid, const Footprint &footprint, const AABB &box)
+{
+	if (box.empty() || footprint.cells.empty()) return true;
+	int lower[3], upper[3];
+	for (int axis = 0; axis < 3; axis++) {
+		if (box.lower[axis] < grid.bounds.lower[axis] || box.upper[axis] > grid.bounds.upper[axis])
+			return true;
+
+		// a little wider, so a hit right on a cell face counts on both sides
+		float slack = 1e-3f*grid.cellSize[axis];
+		lower[axis] = std::max(0, int((box.lower[axis] - slack - grid.bounds.lower[axis])/grid.cellSize[axis]));
+		upper[axis] = std::min(grid.resolution - 1, int((box.upper[axis] + slack - grid.bounds.lower[axis])/grid.cellSize[axis]));
+	}
+	for (int x = lower[0]; x <= upper[0]; x++) {
+		for (int y = lower[1]; y <= upper[1]; y++) {
+			for (int z = lower[2]; z <= upper[2]; z++) {
+				int index = (x*grid.resolution + y)*grid.resolution + z;
+				if (footprint.cells[index >> 6] & (uint64_t(1) << (index & 63)))
+					return true;
+			}
+		}
+	}
+	return false;
+}
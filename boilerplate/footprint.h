@@ -0,0 +1,44 @@
+// ==========================================================================
+// Ray Footprints for Incremental Re-rendering
+//  - a coarse grid over the scene; while a tile renders, every ray it
+//    traces (camera, shadow and reflection rays alike) marks the cells that
+//    the part of it its answer depends on passes through
+//  - moving a shape can only change a ray that passes through where the
+//    shape was or where it now is, so after an edit only the tiles whose
+//    footprint overlaps the shape's old or new bounds are rendered again
+// ==========================================================================
+#ifndef FOOTPRINT_H
+#define FOOTPRINT_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "bvh.h"
+
+struct FootprintGrid
+{
+	AABB bounds;
+	int resolution = 0; // cells along each axis
+	glm::vec3 cellSize;
+};
+
+// a grid around sceneBounds with some room for shapes to move into
+void initFootprintGrid(FootprintGrid *grid, const AABB &sceneBounds, int resolution);
+
+// one bit per grid cell
+struct Footprint
+{
+	std::vector<uint64_t> cells;
+};
+
+// marks the cells rays traced on this thread pass through in footprint,
+// from now until called with a null footprint
+void recordFootprint(const FootprintGrid *grid, Footprint *footprint);
+
+// whether a ray in footprint may have passed through box; always true for
+// an empty box (a plane) or one that reaches outside the grid
+bool footprintOverlaps(const FootprintGrid &grid, const Footprint &footprint, const AABB &box);
+
+#endif // FOOTPRINT_H
@@ -0,0 +1,66 @@
+// ==========================================================================
+// G-Buffer for Relighting Without Re-tracing
+// ==========================================================================
+
+#include "gbuffer.h"
+#include "sampler.h"
+
+using namespace std;
+using namespace glm;
+
+void initGBuffer(GBuffer *gbuffer, int width, int height, int tileSize)
+{
+	gbuffer->width = width;
+	gbuffer->height = height;
+	gbuffer->tiles = makeTiles(width, height, tileSize);
+	gbuffer->data.assign(gbuffer->tiles.size(), GBufferTile());
+}
+
+void traceGBufferTile(GBuffer *gbuffer, int tile, TracePixel trace)
+{
+	const Tile &t = gbuffer->tiles[tile];
+	GBufferTile &data = gbuffer->data[tile];
+	data.start.clear();
+	data.hits.clear();
+	for (int x = 0; x < t.width; x++) {
+		for (int y = 0; y < t.height; y++) {
+			data.start.push_back(data.hits.size());
+			trace(t.x + x, t.y + y, gbuffer->width, gbuffer->height, &data.hits);
+		}
+	}
+	data.start.push_back(data.hits.size());
+}
+
+void shadeGBufferTile(const GBuffer &gbuffer, int tile, ShapeSpan shapes,
+		ShadeHit shade, PixelRandom pixelRandom, vec3 *colors)
+{
+	const Tile &t = gbuffer.tiles[tile];
+	const GBufferTile &data = gbuffer.data[tile];
+	vector<vec3> local;
+	float point[SAMPLE_DIMENSIONS];
+	for (int x = 0; x < t.width; x++) {
+		for (int y = 0; y < t.height; y++) {
+			int k = x*t.height + y;
+			int first = data.start[k], end = data.start[k + 1];
+			Random random = pixelRandom(t.x + x, t.y + y, gbuffer.width, gbuffer.height, point);
+
+			// shaded nearest first, as a traced render draws its random
+			// numbers, then folded back to front as its recursion adds
+			local.resize(end - first);
+			for (int h = first; h < end; h++)
+				local[h - first] = shade(data.hits[h], &random);
+			vec3 color(0.0f);
+			for (int h = end - 1; h >= first; h--)
+				color = h == end - 1 ? local[h - first] : local[h - first] + shapes[data.hits[h].shape].specularColor*color;
+			colors[k] = color;
+		}
+	}
+}
+
+size_t gbufferMemory(const GBuffer &gbuffer)
+{
+	size_t bytes = 0;
+	for (const GBufferTile &data : gbuffer.data)
+		bytes += data.start.size()*sizeof(int) + data.hits.size()*sizeof(GBufferHit);
+	return bytes;
+}
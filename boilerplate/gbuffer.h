@@ -0,0 +1,71 @@
+// ==========================================================================
+// G-Buffer for Relighting Without Re-tracing
+//  - keeps, for every pixel, its first hit and the chain of mirror
+//    reflections that follows it: position, normal, incoming direction and
+//    the shape (and so material) that was hit
+//  - none of that depends on the lights, so after a light edit an image
+//    is shaded straight from the stored hits; only shading and shadow rays
+//    are paid for again
+//  - stored by tile, so the tile scheduler's workers fill and shade their
+//    own tiles without sharing anything
+// ==========================================================================
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "random.h"
+#include "tiles.h"
+
+struct GBufferHit
+{
+	HitPoint hit;
+	int shape; // index into the shape list
+};
+
+// pixel (x, y) of the tile, k = x*tile.height + y, has the hits
+// hits[start[k] .. start[k + 1]), nearest first; none if its ray missed
+struct GBufferTile
+{
+	std::vector<int> start;
+	std::vector<GBufferHit> hits;
+};
+
+struct GBuffer
+{
+	int width = 0, height = 0;
+	std::vector<Tile> tiles;
+	std::vector<GBufferTile> data; // one per tile
+};
+
+// appends the first hit of pixel (i, j) and its reflections; supplied by
+// the renderer
+typedef void (*TracePixel)(int i, int j, int width, int height, std::vector<GBufferHit> *chain);
+
+// the colour a hit adds before its reflection is added in (ambient plus
+// direct light); supplied by the renderer
+typedef glm::vec3 (*ShadeHit)(const GBufferHit &hit, Random *random);
+
+// the random numbers of pixel (i, j)'s path, as a traced render draws
+// them; point, SAMPLE_DIMENSIONS floats, holds the sampler's point they
+// start from and must outlive them. Supplied by the renderer
+typedef Random (*PixelRandom)(int i, int j, int width, int height, float *point);
+
+// sizes gbuffer for an image cut into tiles; the tiles are then traced by
+// traceGBufferTile, from any thread
+void initGBuffer(GBuffer *gbuffer, int width, int height, int tileSize);
+
+void traceGBufferTile(GBuffer *gbuffer, int tile, TracePixel trace);
+
+// the tile's colours, stored by column like the renderer's tiles; each
+// pixel draws its numbers from pixelRandom, so a traced render and this
+// give the same image
+void shadeGBufferTile(const GBuffer &gbuffer, int tile, ShapeSpan shapes,
+		ShadeHit shade, PixelRandom pixelRandom, glm::vec3 *colors);
+
+// bytes held by the stored hits
+size_t gbufferMemory(const GBuffer &gbuffer);
+
+#endif // GBUFFER_H
@@ -16,10 +16,14 @@
 // Date:    2016-2018
 // ==========================================================================
 
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <glm/common.hpp>
 
 #include "imagebuffer.h"
+#include "tiffwriter.h"
 
 // --------------------------------------------------------------------------
 // Set these defines to choose which image library to use for saving image
@@ -43,6 +47,60 @@
 using namespace std;
 using namespace glm;
 
+// --------------------------------------------------------------------------
+// Writers that need no image library: float images for values beyond
+// [0,1], and an uncompressed one for pipelines that encode again anyway
+
+namespace {
+
+// the file name's extension in lower case, without the dot
+string FileExtension(const string &fileName)
+{
+    size_t dot = fileName.find_last_of('.');
+    if (dot == string::npos || fileName.find('/', dot) != string::npos)
+        return "";
+    string extension = fileName.substr(dot + 1);
+    for (char &c : extension)
+        c = tolower(c);
+    return extension;
+}
+
+// PFM: a text header, a negative scale for little endian (the floats are
+// written as they are in memory), then rows from the bottom up, the order
+// they are kept in; one channel planes keep their value in x
+bool WritePFM(const string &fileName, int width, int height, int channels, const vec3 *data)
+{
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+    fprintf(file, "%s\n%d %d\n-1.0\n", channels == 1 ? "Pf" : "PF", width, height);
+    vector<float> row(width * channels);
+    bool written = true;
+    for (int y = 0; y < height && written; ++y)
+    {
+        const vec3 *values = &data[y * width];
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < channels; ++c)
+                row[x * channels + c] = values[x][c];
+        written = fwrite(row.data(), sizeof(float), row.size(), file) == row.size();
+    }
+    return fclose(file) == 0 && written;
+}
+
+// binary PPM: a text header and the bytes as they are
+bool WritePPM(const string &fileName, int width, int height, const unsigned char *pixels)
+{
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    size_t size = size_t(width) * height * 3;
+    bool written = fwrite(pixels, 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+} // namespace
+
 // --------------------------------------------------------------------------
 
 ImageBuffer::ImageBuffer()
@@ -70,18 +128,7 @@ bool ImageBuffer::Initialize()
     // retrieve the current viewport size
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
-
-    // allocate image data
-    m_imageData.resize(m_width * m_height);
-    for (int i = 0, k = 0; i < m_height; ++i)
-        for (int j = 0; j < m_width; ++j, ++k)
-        {
-            int p = (i >> 4) + (j >> 4);
-            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
-            m_imageData[k] = vec3(c);
-        }
+    Initialize(viewport[2], viewport[3]);
 
     // allocate texture object
     if (!m_textureName)
@@ -108,6 +155,27 @@ bool ImageBuffer::Initialize()
     return status == GL_FRAMEBUFFER_COMPLETE;
 }
 
+bool ImageBuffer::Initialize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+
+    // allocate image data
+    m_imageData.resize(m_width * m_height);
+    for (int i = 0, k = 0; i < m_height; ++i)
+        for (int j = 0; j < m_width; ++j, ++k)
+        {
+            int p = (i >> 4) + (j >> 4);
+            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
+            m_imageData[k] = vec3(c);
+        }
+    for (Plane &plane : m_planes)
+        plane.data.assign(m_width * m_height, vec3(0.f));
+    ResetModified();
+
+    return true;
+}
+
 void ImageBuffer::Destroy()
 {
     if (m_framebufferObject) {
@@ -165,6 +233,31 @@ void ImageBuffer::Render()
 
 // --------------------------------------------------------------------------
 
+void ImageBuffer::MoveFrameTo(ImageBuffer &frame, bool keep)
+{
+    frame.m_width = m_width;
+    frame.m_height = m_height;
+    frame.m_pngOptions = m_pngOptions;
+    frame.m_toneMap = m_toneMap;
+    if (keep)
+        frame.m_imageData = m_imageData;
+    else
+    {
+        frame.m_imageData.swap(m_imageData);
+        m_imageData.assign(m_width * m_height, vec3(0.f));
+        ResetModified();
+    }
+    frame.ResetModified();
+}
+
+// --------------------------------------------------------------------------
+
+bool ImageBuffer::IsFloatFile(const string &imageFileName)
+{
+    string extension = FileExtension(imageFileName);
+    return extension == "pfm" || extension == "hdr";
+}
+
 bool ImageBuffer::SaveToFile(const string &imageFileName)
 {
     if (m_width == 0 || m_height == 0)
@@ -174,34 +267,66 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
     }
     cout << "ImageBuffer saving image to " << imageFileName << "..." << endl;
 
-#ifdef USE_STB_IMAGE
-    const unsigned numComponents = 3; //RGB
-    unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
-
-    for (int y = 0; y < m_height; ++y)
-        for (int x = 0; x < m_width; ++x)
+    // the format follows the extension: .pfm and .hdr keep the colours as
+    // they are, unclamped; .ppm is 8 bit and not compressed; .tif is tiled,
+    // deflated at the PNG level
+    string extension = FileExtension(imageFileName);
+    if (extension == "pfm" || extension == "ppm" || extension == "tif" || extension == "tiff")
+    {
+        bool written;
+        if (extension == "pfm")
+            written = WritePFM(imageFileName, m_width, m_height, 3, m_imageData.data());
+        else if (extension == "tif" || extension == "tiff")
         {
-            glm::vec3& color = m_imageData[y * m_width + x];
-            int i = (m_height - 1 - y) * m_width + x;
-            i *= numComponents;
+            TiffOptions options;
+            options.level = m_pngOptions.level;
+            options.workers = m_pngOptions.workers;
+            written = writeTiledTIFF(imageFileName, m_width, m_height, m_toneMap, options,
+                [&](const Tile &tile, vec3 *colors) {
+                    for (int y = 0; y < tile.height; ++y)
+                        memcpy(&colors[y * tile.width], &m_imageData[(tile.y + y) * m_width + tile.x],
+                               tile.width * sizeof(vec3));
+                    return true;
+                });
+        }
+        else
+        {
+            vector<unsigned char> pixels(m_width * m_height * 3);
+            quantizeImage(m_imageData.data(), m_width, m_height, m_toneMap, pixels.data());
+            written = WritePPM(imageFileName, m_width, m_height, pixels.data());
+        }
+        if (!written)
+            cout << "ImageBuffer failed to write image " << imageFileName << endl;
+        return written;
+    }
 
-            pixels[i]     = (unsigned char) (255 * clamp(color.r, 0.f, 1.f));	// red
-            pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
-            pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
+#ifdef USE_STB_IMAGE
+    if (extension == "hdr")
+    {
+        // Radiance files are written from the top row down
+        vector<float> rows(m_width * m_height * 3);
+        for (int y = 0; y < m_height; ++y)
+            memcpy(&rows[(m_height - 1 - y) * m_width * 3], &m_imageData[y * m_width], m_width * sizeof(vec3));
+        if (!stbi_write_hdr(imageFileName.c_str(), m_width, m_height, 3, rows.data()))
+        {
+            cout << "STB failed to write image " << imageFileName << endl;
+            return false;
         }
+        return true;
+    }
+
+    // anything else is a PNG, compressed on several threads rather than by
+    // STB on one
+    const unsigned numComponents = 3; //RGB
+    vector<unsigned char> pixels(m_width * m_height * numComponents);
+    quantizeImage(m_imageData.data(), m_width, m_height, m_toneMap, pixels.data());
 
     // Save the image to disk
-    int stride = 0;
-    if (!stbi_write_png(imageFileName.data(), m_width, m_height, numComponents, pixels, stride))
+    if (!writePNG(imageFileName, m_width, m_height, pixels.data(), m_pngOptions))
     {
-        // Fail! delete and exit
-        cout << "STB failed to write image " << imageFileName << endl;
-        delete[] pixels;
+        cout << "ImageBuffer failed to write image " << imageFileName << endl;
         return false;
     }
-
-    //success, delete and exit
-    delete[] pixels;
     return true;
 #endif
 
@@ -273,3 +398,43 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
 }
 
 // --------------------------------------------------------------------------
+
+int ImageBuffer::AddPlane(const string &name, int channels)
+{
+    int plane = FindPlane(name);
+    if (plane >= 0)
+        return plane;
+    Plane added;
+    added.name = name;
+    added.channels = channels == 1 ? 1 : 3;
+    added.data.assign(m_width * m_height, vec3(0.f));
+    m_planes.push_back(added);
+    return int(m_planes.size()) - 1;
+}
+
+int ImageBuffer::FindPlane(const string &name) const
+{
+    for (int i = 0; i < int(m_planes.size()); ++i)
+        if (m_planes[i].name == name)
+            return i;
+    return -1;
+}
+
+void ImageBuffer::SetPlanePixel(int plane, int x, int y, vec3 value)
+{
+    m_planes[plane].data[y * m_width + x] = value;
+}
+
+bool ImageBuffer::SavePlane(int plane, const string &imageFileName)
+{
+    const Plane &saved = m_planes[plane];
+    cout << "ImageBuffer saving " << saved.name << " to " << imageFileName << "..." << endl;
+    if (!WritePFM(imageFileName, m_width, m_height, saved.channels, saved.data.data()))
+    {
+        cout << "ImageBuffer failed to write image " << imageFileName << endl;
+        return false;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
@@ -18,6 +18,9 @@
 #include <string>
 #include <glm/vec3.hpp>
 
+#include "pngwriter.h"
+#include "tonemap.h"
+
 #ifndef GLFW_VERSION_MAJOR
 #define GLFW_INCLUDE_GLCOREARB
 #define GL_GLEXT_PROTOTYPES
@@ -39,6 +42,20 @@ class ImageBuffer
     int     m_width, m_height;
     std::vector<glm::vec3> m_imageData;
 
+    // named auxiliary planes (depth, normals, ...) beside the colours
+    struct Plane
+    {
+        std::string name;
+        int channels; // 1 or 3; a one channel plane keeps its value in x
+        std::vector<glm::vec3> data;
+    };
+    std::vector<Plane> m_planes;
+
+    // how PNG files are compressed, and how colours become bytes for them
+    // and other 8 bit files
+    PngOptions m_pngOptions;
+    ToneMapOptions m_toneMap;
+
     // state variables to keep track of modified region
     bool    m_modified;
     int     m_modifiedLower, m_modifiedUpper;
@@ -57,6 +74,10 @@ public:
     // buffer that matches the size of your viewport
     bool Initialize();
 
+    // allocates an image of the given size without any OpenGL objects, for
+    // rendering without a window; Render() then does nothing
+    bool Initialize(int width, int height);
+
     // call this if you need to delete the framebuffer object and texture
     void Destroy();
 
@@ -70,6 +91,37 @@ public:
 
     // call this at the end of your render to save the image to file
     bool SaveToFile(const std::string &imageFileName);
+
+    // gives this image's pixels to frame, an image without OpenGL objects,
+    // and leaves this one black, to go on to the next frame while frame is
+    // saved; with keep, frame gets a copy instead. Planes are not given
+    void MoveFrameTo(ImageBuffer &frame, bool keep);
+
+    // the compression level and threads used to save PNG files
+    void SetPngOptions(const PngOptions &options) { m_pngOptions = options; }
+
+    // the exposure, tone curve and transfer function of 8 bit files; float
+    // files keep the colours as they are
+    void SetToneMap(const ToneMapOptions &options) { m_toneMap = options; }
+
+    // true if SaveToFile writes the file name's format as floats
+    static bool IsFloatFile(const std::string &imageFileName);
+
+    // adds a plane of the image's size, zeroed, and returns its number;
+    // a plane of that name is returned as it is
+    int AddPlane(const std::string &name, int channels);
+
+    // the plane's number, or -1 if there is no plane of that name
+    int FindPlane(const std::string &name) const;
+
+    int PlaneCount() const { return int(m_planes.size()); }
+    const std::string &PlaneName(int plane) const { return m_planes[plane].name; }
+
+    // like SetPixel, but values are not limited to [0,1]
+    void SetPlanePixel(int plane, int x, int y, glm::vec3 value);
+
+    // saves a plane as a PFM float image, greyscale if it has one channel
+    bool SavePlane(int plane, const std::string &imageFileName);
 };
 
 // --------------------------------------------------------------------------
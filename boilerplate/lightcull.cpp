@@ -0,0 +1,108 @@
+// ==========================================================================
+// Light Culling for Lights with a Finite Radius
+// ==========================================================================
+
+#include <algorithm>
+
+#include "lightcull.h"
+
+using namespace std;
+using namespace glm;
+
+// a sphere reaches a box when the nearest point of the box is inside it
+static bool reaches(const Light &light, const AABB &box)
+{
+	if (light.radius <= 0.0f) return true;
+	vec3 offset = clamp(light.origin, box.lower, box.upper) - light.origin;
+	return dot(offset, offset) < light.radius*light.radius;
+}
+
+void cullLights(const vector<Light> &lights, const AABB &bounds, vector<int> *list)
+{
+	list->clear();
+	if (bounds.empty()) return;
+	for (int i = 0; i < (int)lights.size(); i++)
+		if (reaches(lights[i], bounds))
+			list->push_back(i);
+}
+
+// --------------------------------------------------------------------------
+
+// most cells along any axis
+static const int GRID_MAX_RESOLUTION = 64;
+
+void buildLightGrid(LightGrid *grid, const vector<Light> &lights)
+{
+	*grid = LightGrid();
+	float largestRadius = 0.0f;
+	for (int i = 0; i < (int)lights.size(); i++) {
+		const Light &light = lights[i];
+		if (light.radius <= 0.0f) {
+			grid->unlimited.push_back(i);
+			continue;
+		}
+		grid->bounds.grow(light.origin - vec3(light.radius));
+		grid->bounds.grow(light.origin + vec3(light.radius));
+		largestRadius = std::max(largestRadius, light.radius);
+	}
+	if (grid->bounds.empty()) return;
+
+	// cells about as wide as the largest light, so each light touches few
+	vec3 extent = grid->bounds.upper - grid->bounds.lower;
+	float longest = std::max(extent.x, std::max(extent.y, extent.z));
+	grid->cellSize = std::max(largestRadius, longest/GRID_MAX_RESOLUTION);
+	for (int axis = 0; axis < 3; axis++)
+		grid->resolution[axis] = std::min(GRID_MAX_RESOLUTION, std::max(1, int(ceil(extent[axis]/grid->cellSize))));
+	int cells = grid->resolution[0]*grid->resolution[1]*grid->resolution[2];
+
+	// counting sort of (cell, light) pairs into the cell lists
+	vector<vector<int>> cellLists(cells);
+	for (int i = 0; i < (int)lights.size(); i++) {
+		const Light &light = lights[i];
+		if (light.radius <= 0.0f) continue;
+		int lower[3], upper[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float offset = light.origin[axis] - grid->bounds.lower[axis];
+			lower[axis] = std::max(0, int((offset - light.radius)/grid->cellSize));
+			upper[axis] = std::min(grid->resolution[axis] - 1, int((offset + light.radius)/grid->cellSize));
+		}
+		for (int x = lower[0]; x <= upper[0]; x++) {
+			for (int y = lower[1]; y <= upper[1]; y++) {
+				for (int z = lower[2]; z <= upper[2]; z++) {
+					AABB cell;
+					cell.lower = grid->bounds.lower + vec3(x, y, z)*grid->cellSize;
+					cell.upper = cell.lower + vec3(grid->cellSize);
+					if (reaches(light, cell))
+						cellLists[(x*grid->resolution[1] + y)*grid->resolution[2] + z].push_back(i);
+				}
+			}
+		}
+	}
+
+	grid->cellStart.resize(cells + 1);
+	for (int c = 0; c < cells; c++) {
+		grid->cellStart[c] = grid->cellLights.size();
+		grid->cellLights.insert(grid->cellLights.end(), cellLists[c].begin(), cellLists[c].end());
+		grid->cellLights.insert(grid->cellLights.end(), grid->unlimited.begin(), grid->unlimited.end());
+	}
+	grid->cellStart[cells] = grid->cellLights.size();
+}
+
+void lightsAt(const LightGrid &grid, const vec3 &p, const int **lights, int *count)
+{
+	int cell[3];
+	bool inside = !grid.cellStart.empty();
+	for (int axis = 0; axis < 3 && inside; axis++) {
+		float offset = (p[axis] - grid.bounds.lower[axis])/grid.cellSize;
+		cell[axis] = int(offset);
+		inside = offset >= 0.0f && cell[axis] < grid.resolution[axis];
+	}
+	if (!inside) {
+		*lights = grid.unlimited.empty() ? nullptr : &grid.unlimited[0];
+		*count = grid.unlimited.size();
+		return;
+	}
+	int c = (cell[0]*grid.resolution[1] + cell[1])*grid.resolution[2] + cell[2];
+	*lights = grid.cellLights.empty() ? nullptr : &grid.cellLights[grid.cellStart[c]];
+	*count = grid.cellStart[c + 1] - grid.cellStart[c];
+}
@@ -0,0 +1,39 @@
+// ==========================================================================
+// Light Culling for Lights with a Finite Radius
+//  - a CPU take on clustered forward shading: before a tile is shaded, its
+//    primary hits are bounded by a box and only the lights whose sphere of
+//    influence reaches that box are kept for the tile
+//  - hits off the primary rays (reflections) look their lights up in a
+//    uniform world space grid instead
+//  - lights without a radius reach everything and are always kept
+// ==========================================================================
+#ifndef LIGHTCULL_H
+#define LIGHTCULL_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "bvh.h"
+
+// indices of the lights that may light some point in bounds
+void cullLights(const std::vector<Light> &lights, const AABB &bounds, std::vector<int> *list);
+
+// cells hold the lights whose sphere overlaps them, followed by every light
+// without a radius; cell c has cellLights[cellStart[c] .. cellStart[c + 1])
+struct LightGrid
+{
+	AABB bounds;
+	int resolution[3] = {0, 0, 0};
+	float cellSize = 1.0f;
+	std::vector<int> cellStart;
+	std::vector<int> cellLights;
+	std::vector<int> unlimited; // all there is outside the grid
+};
+
+void buildLightGrid(LightGrid *grid, const std::vector<Light> &lights);
+
+// the lights that may reach p
+void lightsAt(const LightGrid &grid, const glm::vec3 &p, const int **lights, int *count);
+
+#endif // LIGHTCULL_H
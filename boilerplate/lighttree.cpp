@@ -0,0 +1,295 @@
+// ==========================================================================
+// Light Tree for Scenes with Many Point Lights
+//
+// The cut follows "Lightcuts: A Scalable Approach to Illumination" (Walter
+// et al. 2005), with the shading model of this renderer: a light of colour I
+// adds I*(kd*max(0, n.l) + ks*phong(n.h)) when visible. Over a cluster, n.l
+// is bounded from the cluster bounds, phong(n.h) from a cone around the
+// directions to the cluster and visibility by one, so a cluster can be off
+// by at most colour*(kd*cosBound + ks*phongBound).
+// ==========================================================================
+
+#include <algorithm>
+#include <cfloat>
+
+#include "lighttree.h"
+#include "arealight.h"
+
+using namespace std;
+using namespace glm;
+
+thread_local LightCutStats lightStats;
+
+// --------------------------------------------------------------------------
+// Construction
+
+namespace {
+
+float intensity(const vec3 &color)
+{
+	return color.x + color.y + color.z;
+}
+
+// fills in node index from the lights order[begin, end)
+void buildNode(LightTree *tree, vector<int> &order, int begin, int end, int index)
+{
+	if (end - begin == 1) {
+		const Light &light = tree->lights[order[begin]];
+		LightNode &leaf = tree->nodes[index];
+		leaf.bounds = lightBounds(light);
+		leaf.color = light.color;
+		leaf.radius = light.radius > 0.0f ? light.radius : FLT_MAX;
+		leaf.representative = order[begin];
+		leaf.child = -1;
+		return;
+	}
+
+	// median split along the longest axis of the light positions
+	AABB bounds;
+	for (int i = begin; i < end; i++)
+		bounds.grow(tree->lights[order[i]].origin);
+	vec3 extent = bounds.upper - bounds.lower;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	int middle = (begin + end)/2;
+	nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b) {
+		return tree->lights[a].origin[axis] < tree->lights[b].origin[axis];
+	});
+
+	int child = tree->nodes.size();
+	tree->nodes.resize(child + 2);
+	buildNode(tree, order, begin, middle, child);
+	buildNode(tree, order, middle, end, child + 1);
+
+	// the representative is one of the children's, picked in proportion to
+	// intensity (seeded by the node, so builds are repeatable)
+	const LightNode &left = tree->nodes[child];
+	const LightNode &right = tree->nodes[child + 1];
+	LightNode &node = tree->nodes[index];
+	node.bounds = left.bounds;
+	node.bounds.grow(right.bounds);
+	node.color = left.color + right.color;
+	node.radius = std::max(left.radius, right.radius);
+	node.child = child;
+	Random random(index, 0);
+	float total = intensity(node.color);
+	node.representative = random.nextFloat()*total < intensity(left.color) || total <= 0.0f
+		? left.representative : right.representative;
+}
+
+} // namespace
+
+void buildLightTree(LightTree *tree, const vector<Light> &lights)
+{
+	tree->lights = lights;
+	tree->nodes.clear();
+	if (lights.empty()) return;
+	vector<int> order(lights.size());
+	for (size_t i = 0; i < lights.size(); i++) order[i] = i;
+	tree->nodes.resize(1);
+	buildNode(tree, order, 0, lights.size(), 0);
+}
+
+int sampleLight(const LightTree &tree, int node, Random *random, float *probability)
+{
+	float clusterIntensity = intensity(tree.nodes[node].color);
+	if (clusterIntensity <= 0.0f) return -1;
+	while (!tree.nodes[node].isLeaf()) {
+		int child = tree.nodes[node].child;
+		float a = intensity(tree.nodes[child].color);
+		float b = intensity(tree.nodes[child + 1].color);
+		node = random->nextFloat()*(a + b) < a ? child : child + 1;
+	}
+	*probability = intensity(tree.nodes[node].color)/clusterIntensity;
+	return tree.nodes[node].representative;
+}
+
+// --------------------------------------------------------------------------
+// Shading
+
+namespace {
+
+float maxComponent(const vec3 &v)
+{
+	return std::max(v.x, std::max(v.y, v.z));
+}
+
+// cone around the directions from a point into a box, by its axis and the
+// sine and cosine of its half angle; not valid when the point is inside or
+// too close to the box for a cone to be useful
+struct Cone
+{
+	bool valid;
+	vec3 axis;
+	float sinAngle;
+	float cosAngle;
+};
+
+Cone directionCone(const AABB &box, const vec3 &p)
+{
+	Cone cone;
+	vec3 toCenter = (box.lower + box.upper)*0.5f - p;
+	float radius = 0.5f*length(box.upper - box.lower);
+	float distance = length(toCenter);
+	cone.valid = distance > radius*1.001f;
+	if (cone.valid) {
+		cone.axis = toCenter/distance;
+		cone.sinAngle = radius/distance;
+		cone.cosAngle = sqrt(1.0f - cone.sinAngle*cone.sinAngle);
+	}
+	return cone;
+}
+
+// cos(max(0, a - b)) for angles a, b in [0, pi] given by their cosines
+float cosineOfGap(float cosA, float sinB, float cosB)
+{
+	if (cosA >= cosB) return 1.0f;
+	float sinA = sqrt(std::max(0.0f, 1.0f - cosA*cosA));
+	return cosA*cosB + sinA*sinB;
+}
+
+// upper bound of max(0, n.l) over light positions in box, seen from p: the
+// tighter of the box corner furthest along n and the direction cone
+float cosineBound(const AABB &box, const vec3 &p, const vec3 &n, const Cone &cone)
+{
+	vec3 corner(n.x > 0.0f ? box.upper.x : box.lower.x,
+		n.y > 0.0f ? box.upper.y : box.lower.y,
+		n.z > 0.0f ? box.upper.z : box.lower.z);
+	float reach = dot(n, corner - p);
+	if (reach <= 0.0f) return 0.0f;
+	float distance = length(clamp(p, box.lower, box.upper) - p);
+	if (distance <= 0.0f) return 1.0f;
+	float bound = std::min(1.0f, reach/distance);
+	if (cone.valid)
+		bound = std::min(bound, cosineOfGap(dot(cone.axis, n), cone.sinAngle, cone.cosAngle) + 1e-4f);
+	return bound;
+}
+
+// upper bound of phong(n.h) over the cone of light directions: the half
+// vector is at least half the angle between the light and the mirror
+// direction away from the normal
+float specularBound(const HitPoint &hit, const Shape &shape, const Cone &cone)
+{
+	vec3 v = -hit.direction;
+	float nv = dot(hit.normal, v);
+	if (nv <= 0.0f || !cone.valid)
+		return 1.0f;
+	vec3 mirror = 2.0f*nv*hit.normal - v;
+	float cosGap = cosineOfGap(dot(cone.axis, mirror), cone.sinAngle, cone.cosAngle);
+	float cosHalfGap = sqrt(std::max(0.0f, 0.5f*(1.0f + cosGap)));
+	return std::min(1.0f, evalPhong(shape.phong, cosHalfGap)*1.0001f + 1e-6f);
+}
+
+// most any colour channel of the cluster can add at hit; nothing if every
+// light in it is out of range
+float clusterBound(const LightNode &node, const HitPoint &hit, const Shape &shape)
+{
+	if (node.radius < FLT_MAX) {
+		vec3 offset = clamp(hit.position, node.bounds.lower, node.bounds.upper) - hit.position;
+		if (dot(offset, offset) >= node.radius*node.radius)
+			return 0.0f;
+	}
+	Cone cone = directionCone(node.bounds, hit.position);
+	float cosine = cosineBound(node.bounds, hit.position, hit.normal, cone);
+	float specular = shape.specularHighLight == vec3(0.0f) ? 0.0f : specularBound(hit, shape, cone);
+	return maxComponent(node.color*(shape.color*cosine + shape.specularHighLight*specular));
+}
+
+struct CutEntry
+{
+	int node;
+	float bound;       // error bound; 0 for single lights, which are exact
+	vec3 response;     // of the representative
+	vec3 estimate;
+};
+
+bool lowerBound(const CutEntry &a, const CutEntry &b)
+{
+	return a.bound < b.bound;
+}
+
+vec3 evaluate(const LightTree &tree, int light, const HitPoint &hit, const Shape &shape,
+		LightResponse response, Random *random)
+{
+	lightStats.lightsEvaluated++;
+	return response(hit, shape, tree.lights[light], random);
+}
+
+CutEntry makeEntry(const LightTree &tree, int index, const HitPoint &hit, const Shape &shape)
+{
+	const LightNode &node = tree.nodes[index];
+	CutEntry entry;
+	entry.node = index;
+	entry.bound = node.isLeaf() ? 0.0f : clusterBound(node, hit, shape);
+	return entry;
+}
+
+// one light below node, weighted by the inverse of its probability
+vec3 sampleCluster(const LightTree &tree, int index, const HitPoint &hit, const Shape &shape,
+		LightResponse response, Random *random)
+{
+	float probability;
+	int light = sampleLight(tree, index, random, &probability);
+	if (light < 0) return vec3(0.0f);
+	return tree.lights[light].color*evaluate(tree, light, hit, shape, response, random)/probability;
+}
+
+} // namespace
+
+vec3 shadeLightCut(const LightTree &tree, const HitPoint &hit, const Shape &shape, const vec3 &ambient,
+		LightResponse response, const LightCutOptions &options, Random *random)
+{
+	lightStats.hits++;
+	if (tree.nodes.empty()) return vec3(0.0f);
+
+	// a max heap on the error bound, kept between calls to save allocations
+	static thread_local vector<CutEntry> cut;
+	cut.clear();
+	vec3 total(0.0f);
+
+	if (options.mode == LIGHT_CUT_STOCHASTIC) {
+		// the cut comes from the bounds alone, nothing is evaluated yet
+		cut.push_back(makeEntry(tree, 0, hit, shape));
+		while ((int)cut.size() < options.samples && cut.front().bound > 0.0f) {
+			pop_heap(cut.begin(), cut.end(), lowerBound);
+			int child = tree.nodes[cut.back().node].child;
+			cut.back() = makeEntry(tree, child, hit, shape);
+			push_heap(cut.begin(), cut.end(), lowerBound);
+			cut.push_back(makeEntry(tree, child + 1, hit, shape));
+			push_heap(cut.begin(), cut.end(), lowerBound);
+		}
+		for (const CutEntry &entry : cut)
+			total += sampleCluster(tree, entry.node, hit, shape, response, random);
+		return total;
+	}
+
+	CutEntry root = makeEntry(tree, 0, hit, shape);
+	root.response = evaluate(tree, tree.nodes[0].representative, hit, shape, response, random);
+	root.estimate = tree.nodes[0].color*root.response;
+	cut.push_back(root);
+	total = root.estimate;
+	while ((int)cut.size() < options.maxCut && cut.front().bound > 0.0f &&
+		cut.front().bound > options.errorRatio*maxComponent(ambient + total)) {
+		pop_heap(cut.begin(), cut.end(), lowerBound);
+		CutEntry parent = cut.back();
+		cut.pop_back();
+		total -= parent.estimate;
+
+		// one child shares the parent's representative and its evaluation
+		int parentLight = tree.nodes[parent.node].representative;
+		for (int child = tree.nodes[parent.node].child, k = 0; k < 2; k++, child++) {
+			CutEntry entry = makeEntry(tree, child, hit, shape);
+			int light = tree.nodes[child].representative;
+			entry.response = light == parentLight ? parent.response : evaluate(tree, light, hit, shape, response, random);
+			entry.estimate = tree.nodes[child].color*entry.response;
+			total += entry.estimate;
+			cut.push_back(entry);
+			push_heap(cut.begin(), cut.end(), lowerBound);
+		}
+	}
+
+	// summed afresh, the running total has picked up rounding
+	total = vec3(0.0f);
+	for (const CutEntry &entry : cut)
+		total += entry.estimate;
+	return total;
+}
@@ -0,0 +1,94 @@
+// ==========================================================================
+// Light Tree for Scenes with Many Point Lights
+//  - binary tree over the lights; every node keeps the bounds and summed
+//    colour of the lights below it and one representative light
+//  - deterministic mode (lightcuts, Walter et al. 2005): each hit picks a
+//    cut through the tree, refining the cluster with the largest error
+//    bound until every bound is under a fraction of the estimate; clusters
+//    are shaded as their representative carrying the whole cluster colour
+//  - stochastic mode (stochastic lightcuts, Yuksel 2019): a cut of fixed
+//    size chosen from the bounds alone, with the light of each cluster drawn
+//    at every hit in proportion to intensity; unbiased, noise instead of
+//    error
+// ==========================================================================
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "bvh.h"
+#include "random.h"
+
+// inner nodes have their two children at child and child + 1; leaves hold
+// exactly one light and have child -1
+struct LightNode
+{
+	AABB bounds;
+	glm::vec3 color;     // sum over the lights below
+	float radius;        // largest radius of influence below, FLT_MAX if unlimited
+	int representative;  // index into LightTree::lights
+	int child;
+
+	bool isLeaf() const { return child < 0; }
+};
+
+struct LightTree
+{
+	std::vector<Light> lights;
+	std::vector<LightNode> nodes; // root first, empty if there are no lights
+};
+
+enum LightCutMode
+{
+	LIGHT_CUT_DETERMINISTIC,
+	LIGHT_CUT_STOCHASTIC
+};
+
+struct LightCutOptions
+{
+	LightCutMode mode = LIGHT_CUT_DETERMINISTIC;
+
+	// deterministic: refine while some cluster may be off by more than this
+	// fraction of the estimate (0 evaluates every light), up to maxCut
+	float errorRatio = 0.02f;
+	int maxCut = 1000;
+
+	// stochastic: clusters in the cut, one light sampled from each
+	int samples = 8;
+};
+
+// lights evaluated (and so shadow rays traced) by shadeLightCut
+struct LightCutStats
+{
+	unsigned long long hits = 0;
+	unsigned long long lightsEvaluated = 0;
+
+	void add(const LightCutStats &other)
+	{
+		hits += other.hits;
+		lightsEvaluated += other.lightsEvaluated;
+	}
+};
+
+// one per thread, like bvhStats
+extern thread_local LightCutStats lightStats;
+
+// what light adds at hit per unit of its colour, zero when it is shadowed;
+// supplied by the renderer, random is for sampling area lights
+typedef glm::vec3 (*LightResponse)(const HitPoint &hit, const Shape &shape, const Light &light, Random *random);
+
+void buildLightTree(LightTree *tree, const std::vector<Light> &lights);
+
+// a light below node drawn in proportion to intensity (r + g + b), with the
+// probability it was drawn with; -1 if the lights there are all black
+int sampleLight(const LightTree &tree, int node, Random *random, float *probability);
+
+// direct light at hit from every light in the tree; ambient is not added
+// in, but counts towards the estimate the error bound is relative to;
+// random picks lights in stochastic mode and is passed on to response
+glm::vec3 shadeLightCut(const LightTree &tree, const HitPoint &hit, const Shape &shape, const glm::vec3 &ambient,
+		LightResponse response, const LightCutOptions &options, Random *random);
+
+#endif // LIGHTTREE_H
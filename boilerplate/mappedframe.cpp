@@ -0,0 +1,131 @@
+// ==========================================================================
+// Mapped Frame
+//
+// A tile's slot holds its colours in columns of tileSize, whatever the
+// tile's own height, so a pixel's place follows from its coordinates
+// alone. makeTiles() numbers tiles up each column of tiles in turn, and
+// the slots follow that order, which makes a column of tiles one run of
+// the file.
+// ==========================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mappedframe.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+size_t slotColors(const MappedFrame &frame)
+{
+	return size_t(frame.tileSize)*frame.tileSize;
+}
+
+bool readAllAt(int fd, void *data, size_t size, off_t offset)
+{
+	char *bytes = (char *)data;
+	while (size > 0) {
+		ssize_t got = pread(fd, bytes, size, offset);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return false;
+		bytes += got;
+		size -= got;
+		offset += got;
+	}
+	return true;
+}
+
+// writes back the pages wholly inside [begin, end) of the mapping and
+// drops them from the process; the file keeps what they held
+void releaseRange(const MappedFrame &frame, size_t begin, size_t end)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	begin = (begin + page - 1)/page*page;
+	end = end/page*page;
+	if (begin >= end) return;
+	char *address = (char *)frame.colors + begin;
+	msync(address, end - begin, MS_ASYNC);
+	madvise(address, end - begin, MADV_DONTNEED);
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+bool openMappedFrame(MappedFrame *frame, const string &path, int width, int height, int tileSize)
+{
+	*frame = MappedFrame();
+	if (width <= 0 || height <= 0 || tileSize <= 0) return false;
+	int tilesAcross = (width + tileSize - 1)/tileSize;
+	int tilesDown = (height + tileSize - 1)/tileSize;
+	size_t bytes = size_t(tilesAcross)*tilesDown*tileSize*tileSize*sizeof(vec3);
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+	if (ftruncate(fd, bytes) != 0) {
+		close(fd);
+		return false;
+	}
+	void *address = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	frame->width = width;
+	frame->height = height;
+	frame->tileSize = tileSize;
+	frame->tilesDown = tilesDown;
+	frame->fd = fd;
+	frame->colors = (float *)address;
+	frame->bytes = bytes;
+	frame->columnStored.assign(tilesAcross, 0);
+	return true;
+}
+
+void closeMappedFrame(MappedFrame *frame)
+{
+	if (frame->colors) munmap(frame->colors, frame->bytes);
+	if (frame->fd >= 0) close(frame->fd);
+	*frame = MappedFrame();
+}
+
+void storeFrameTile(MappedFrame *frame, const Tile &tile, const vec3 *colors)
+{
+	int column = tile.x/frame->tileSize;
+	size_t slot = size_t(column)*frame->tilesDown + tile.y/frame->tileSize;
+	float *out = frame->colors + slot*slotColors(*frame)*3;
+	for (int x = 0; x < tile.width; x++)
+		memcpy(out + size_t(x)*frame->tileSize*3, &colors[x*tile.height], tile.height*sizeof(vec3));
+
+	if (++frame->columnStored[column] == frame->tilesDown) {
+		size_t columnBytes = frame->tilesDown*slotColors(*frame)*sizeof(vec3);
+		releaseRange(*frame, column*columnBytes, (column + 1)*columnBytes);
+	}
+}
+
+bool loadFrameRegion(const MappedFrame &frame, const Tile &region, vec3 *colors)
+{
+	int tileSize = frame.tileSize;
+	size_t slotBytes = slotColors(frame)*sizeof(vec3);
+	int lowest = region.y/tileSize, highest = (region.y + region.height - 1)/tileSize;
+	// the region's slots in one column of tiles are one run of the file
+	vector<vec3> run((highest - lowest + 1)*slotColors(frame));
+	for (int column = region.x/tileSize; column*tileSize < region.x + region.width; column++) {
+		size_t firstSlot = size_t(column)*frame.tilesDown + lowest;
+		if (!readAllAt(frame.fd, run.data(), run.size()*sizeof(vec3), firstSlot*slotBytes))
+			return false;
+		int x0 = std::max(region.x, column*tileSize), x1 = std::min(region.x + region.width, (column + 1)*tileSize);
+		for (int x = x0; x < x1; x++) {
+			for (int y = region.y; y < region.y + region.height; y++) {
+				size_t place = (y/tileSize - lowest)*slotColors(frame) + size_t(x - column*tileSize)*tileSize + y%tileSize;
+				colors[size_t(y - region.y)*region.width + x - region.x] = run[place];
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,48 @@
+// ==========================================================================
+// Mapped Frame
+//  - an out-of-core framebuffer: the colours of a frame too big to keep in
+//    memory live in a file that is mapped, each tile of makeTiles() in a
+//    slot of its own, stored as renderImage delivers it
+//  - once every tile of a column of tiles is stored, the column's pages are
+//    handed to the kernel to write back and are dropped from the process,
+//    so a render touches about one column of tiles' worth of memory
+//  - regions are read back with pread rather than through the mapping, so
+//    encoding the finished frame does not fault it all back in either
+// ==========================================================================
+#ifndef MAPPEDFRAME_H
+#define MAPPEDFRAME_H
+
+#include <string>
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "tiles.h"
+
+struct MappedFrame
+{
+	int width = 0, height = 0, tileSize = 0;
+	int tilesDown = 0;             // tiles in a column of tiles
+	int fd = -1;
+	float *colors = nullptr;       // the mapping, a slot of tileSize^2 colours a tile
+	size_t bytes = 0;
+	std::vector<int> columnStored; // tiles stored in each column of tiles
+};
+
+// creates the file at path, replacing any there, sized for a width*height
+// frame in tiles of tileSize, and maps it; the file is sparse, and black,
+// until tiles are stored
+bool openMappedFrame(MappedFrame *frame, const std::string &path, int width, int height, int tileSize);
+
+// unmaps the frame; the file is left as it is
+void closeMappedFrame(MappedFrame *frame);
+
+// stores one of makeTiles(width, height, tileSize), its colours in
+// columns as renderImage hands them over; not to be called for one column
+// of tiles from two threads at once
+void storeFrameTile(MappedFrame *frame, const Tile &tile, const glm::vec3 *colors);
+
+// reads the colours of any region of the frame, rows from the bottom; safe
+// from several threads at once
+bool loadFrameRegion(const MappedFrame &frame, const Tile &region, glm::vec3 *colors);
+
+#endif // MAPPEDFRAME_H
@@ -0,0 +1,77 @@
+// ==========================================================================
+// Hardware Cache Counters
+// ==========================================================================
+
+#include "perfcounters.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int openCounter(unsigned long long config)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.inherit = 1; // and the render threads started after this
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void closeCounters(CacheCounters *counters)
+{
+	if (counters->missFd >= 0) close(counters->missFd);
+	if (counters->referenceFd >= 0) close(counters->referenceFd);
+	counters->missFd = counters->referenceFd = -1;
+}
+
+} // namespace
+
+bool startCacheCounters(CacheCounters *counters)
+{
+	counters->missFd = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+	counters->referenceFd = openCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+	if (counters->missFd < 0 || counters->referenceFd < 0) {
+		closeCounters(counters);
+		return false;
+	}
+	ioctl(counters->missFd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(counters->referenceFd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(counters->missFd, PERF_EVENT_IOC_ENABLE, 0);
+	ioctl(counters->referenceFd, PERF_EVENT_IOC_ENABLE, 0);
+	return true;
+}
+
+bool stopCacheCounters(CacheCounters *counters, unsigned long long *misses, unsigned long long *references)
+{
+	if (counters->missFd < 0) return false;
+	ioctl(counters->missFd, PERF_EVENT_IOC_DISABLE, 0);
+	ioctl(counters->referenceFd, PERF_EVENT_IOC_DISABLE, 0);
+	bool ok = read(counters->missFd, misses, sizeof(*misses)) == sizeof(*misses) &&
+		read(counters->referenceFd, references, sizeof(*references)) == sizeof(*references);
+	closeCounters(counters);
+	return ok;
+}
+
+#else
+
+bool startCacheCounters(CacheCounters *counters)
+{
+	return false;
+}
+
+bool stopCacheCounters(CacheCounters *counters, unsigned long long *misses, unsigned long long *references)
+{
+	return false;
+}
+
+#endif
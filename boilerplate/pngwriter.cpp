@@ -0,0 +1,634 @@
+// ==========================================================================
+// Parallel PNG Writer
+//
+// Deflate (RFC 1951) packs its fields from the least significant bit up,
+// but Huffman codes from their most significant bit, so codes are bit
+// reversed once, when they are made, and are then written like any other
+// field. A band's LZ77 positions count from the start of its window, the
+// 32K before the band, which is hashed first and never emitted.
+// ==========================================================================
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "pngwriter.h"
+#include "tiles.h"
+
+using namespace std;
+
+namespace {
+
+const size_t BAND_BYTES = 128*1024; // filtered image bytes per band, at least a row
+const int WINDOW = 32768;
+const int HASH_BITS = 15;
+const int MIN_MATCH = 3, MAX_MATCH = 258;
+const int BLOCK_SYMBOLS = 16384; // literals and matches per Huffman coded block
+const uint32_t ADLER_BASE = 65521;
+
+// hash chain links followed per match, the match length that ends the
+// search early, and whether a match waits to see if the next byte starts
+// a longer one
+struct Level
+{
+	int chain, nice;
+	bool lazy;
+};
+
+const Level LEVELS[10] = {
+	{0, 0, false}, {4, 8, false}, {8, 16, false}, {32, 32, false}, {16, 16, true},
+	{32, 32, true}, {128, 128, true}, {256, 128, true}, {1024, MAX_MATCH, true}, {4096, MAX_MATCH, true}};
+
+const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const int DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// the order a dynamic block lists the lengths of its code length code in
+const int CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+struct Tables
+{
+	uint8_t lengthCode[MAX_MATCH + 1]; // match length to its code less 257
+	uint32_t crc[256];
+
+	Tables()
+	{
+		for (int code = 0; code < 29; code++)
+			for (int length = LENGTH_BASE[code]; length < LENGTH_BASE[code] + (1 << LENGTH_EXTRA[code]) && length <= MAX_MATCH; length++)
+				lengthCode[length] = code;
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			crc[n] = c;
+		}
+	}
+};
+
+const Tables tables;
+
+int distanceCode(int distance)
+{
+	int d = distance - 1;
+	if (d < 4) return d;
+	int bit = 31 - __builtin_clz(d);
+	return 2*bit + ((d >> (bit - 1)) & 1);
+}
+
+uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = tables.crc[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+uint32_t adler32(const unsigned char *data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	while (size > 0) {
+		// the most bytes before b can overflow
+		size_t n = std::min(size, size_t(5552));
+		size -= n;
+		while (n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+	return b << 16 | a;
+}
+
+// the Adler-32 of two pieces of data one after the other, from theirs
+uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondSize)
+{
+	uint32_t remainder = secondSize % ADLER_BASE;
+	uint32_t a1 = first & 0xffff, b1 = first >> 16;
+	uint32_t a2 = second & 0xffff, b2 = second >> 16;
+	// the second's sums started from a = 1 rather than a1
+	uint32_t a = (a1 + a2 + ADLER_BASE - 1) % ADLER_BASE;
+	uint32_t b = (b1 + b2 + remainder*a1 % ADLER_BASE + ADLER_BASE - remainder) % ADLER_BASE;
+	return b << 16 | a;
+}
+
+void putBigEndian(vector<unsigned char> *bytes, uint32_t value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		bytes->push_back(uint8_t(value >> shift));
+}
+
+// a PNG chunk is built with 8 bytes left at its start for its length and
+// type; this fills them in and adds the CRC
+void finishChunk(vector<unsigned char> *chunk, const char *type)
+{
+	uint32_t length = chunk->size() - 8;
+	for (int k = 0; k < 4; k++) {
+		(*chunk)[k] = uint8_t(length >> (24 - 8*k));
+		(*chunk)[4 + k] = type[k];
+	}
+	putBigEndian(chunk, crc32(0, chunk->data() + 4, chunk->size() - 4));
+}
+
+struct BitWriter
+{
+	vector<unsigned char> bytes;
+	uint64_t bits = 0;
+	int count = 0;
+
+	// length of at most 32 bits
+	void put(uint32_t value, int length)
+	{
+		bits |= uint64_t(value) << count;
+		count += length;
+		if (count >= 32) {
+			for (int k = 0; k < 4; k++) {
+				bytes.push_back(uint8_t(bits));
+				bits >>= 8;
+			}
+			count -= 32;
+		}
+	}
+
+	// pads to a byte and writes out what is held
+	void align()
+	{
+		for (count = (count + 7) & ~7; count > 0; count -= 8) {
+			bytes.push_back(uint8_t(bits));
+			bits >>= 8;
+		}
+		bits = 0;
+	}
+};
+
+// a literal byte (distance 0) or a match
+struct Symbol
+{
+	uint16_t value; // the byte, or the match length
+	uint16_t distance;
+};
+
+struct Huffman
+{
+	vector<uint8_t> lengths;
+	vector<uint16_t> codes; // bit reversed
+};
+
+// Huffman code lengths of at most maxBits for the frequencies; at least two
+// symbols get a code, so the code is complete. Depths past maxBits are cut
+// to it and the Kraft sum brought back to one by lengthening the deepest
+// codes that are still short enough (as miniz does), then the lengths are
+// handed out again, the shortest to the most frequent symbols
+void buildLengths(const vector<uint32_t> &frequencies, int maxBits, vector<uint8_t> *lengths)
+{
+	int size = frequencies.size();
+	lengths->assign(size, 0);
+	vector<int> used;
+	for (int s = 0; s < size; s++)
+		if (frequencies[s] > 0) used.push_back(s);
+	for (int s = 0; used.size() < 2; s++)
+		if (frequencies[s] == 0) used.push_back(s);
+	int leaves = used.size();
+
+	// nodes are the leaves, then the inner nodes in the order they are made
+	typedef pair<uint64_t, int> Weight; // weight, node
+	priority_queue<Weight, vector<Weight>, greater<Weight>> queue;
+	vector<int> parent(2*leaves - 1, -1);
+	for (int i = 0; i < leaves; i++)
+		queue.push(Weight(frequencies[used[i]], i));
+	for (int node = leaves; queue.size() > 1; node++) {
+		Weight a = queue.top();
+		queue.pop();
+		Weight b = queue.top();
+		queue.pop();
+		parent[a.second] = parent[b.second] = node;
+		queue.push(Weight(a.first + b.first, node));
+	}
+	// parents are made after their children, so their depth is known first
+	vector<int> depth(2*leaves - 1, 0);
+	for (int node = 2*leaves - 3; node >= 0; node--)
+		depth[node] = depth[parent[node]] + 1;
+
+	vector<int> count(maxBits + 1, 0);
+	for (int i = 0; i < leaves; i++)
+		count[std::min(depth[i], maxBits)]++;
+	uint32_t total = 0; // the Kraft sum in units of 2^-maxBits
+	for (int bits = 1; bits <= maxBits; bits++)
+		total += uint32_t(count[bits]) << (maxBits - bits);
+	for (; total > (1u << maxBits); total--) {
+		count[maxBits]--;
+		for (int bits = maxBits - 1; bits > 0; bits--) {
+			if (count[bits] > 0) {
+				count[bits]--;
+				count[bits + 1] += 2;
+				break;
+			}
+		}
+	}
+
+	stable_sort(used.begin(), used.end(), [&](int a, int b) { return frequencies[a] > frequencies[b]; });
+	int next = 0;
+	for (int bits = 1; bits <= maxBits; bits++)
+		for (int k = 0; k < count[bits]; k++)
+			(*lengths)[used[next++]] = bits;
+}
+
+// canonical codes for the lengths (RFC 1951 3.2.2)
+void buildCodes(Huffman *huffman)
+{
+	int count[16] = {0}, next[16] = {0};
+	for (uint8_t length : huffman->lengths)
+		count[length]++;
+	count[0] = 0;
+	for (int bits = 1, code = 0; bits < 16; bits++) {
+		code = (code + count[bits - 1]) << 1;
+		next[bits] = code;
+	}
+	huffman->codes.assign(huffman->lengths.size(), 0);
+	for (size_t s = 0; s < huffman->lengths.size(); s++) {
+		int length = huffman->lengths[s];
+		if (length == 0) continue;
+		int code = next[length]++, reversed = 0;
+		for (int k = 0; k < length; k++)
+			reversed |= ((code >> k) & 1) << (length - 1 - k);
+		huffman->codes[s] = reversed;
+	}
+}
+
+void buildHuffman(const vector<uint32_t> &frequencies, int maxBits, Huffman *huffman)
+{
+	buildLengths(frequencies, maxBits, &huffman->lengths);
+	buildCodes(huffman);
+}
+
+// stored blocks of the bytes; no bytes makes the empty block of a sync flush
+void writeStored(BitWriter *out, const unsigned char *raw, size_t size)
+{
+	do {
+		size_t n = std::min(size, size_t(65535));
+		out->put(0, 3); // not the last block, stored
+		out->align();
+		out->put(n | (n ^ 0xffff) << 16, 32);
+		out->bytes.insert(out->bytes.end(), raw, raw + n);
+		raw += n;
+		size -= n;
+	} while (size > 0);
+}
+
+// a code length symbol and the value of its extra bits
+struct LengthRun
+{
+	uint8_t symbol, extra;
+};
+
+const int RUN_EXTRA_BITS[19] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+
+// the symbols, which stand for the size bytes at raw, as a block with codes
+// of its own, or stored if that is smaller
+void writeBlock(BitWriter *out, const vector<Symbol> &symbols, const unsigned char *raw, size_t size)
+{
+	vector<uint32_t> literalFrequencies(286, 0), distanceFrequencies(30, 0);
+	for (const Symbol &symbol : symbols) {
+		if (symbol.distance == 0) {
+			literalFrequencies[symbol.value]++;
+		} else {
+			literalFrequencies[257 + tables.lengthCode[symbol.value]]++;
+			distanceFrequencies[distanceCode(symbol.distance)]++;
+		}
+	}
+	literalFrequencies[256] = 1; // end of block
+	Huffman literals, distances;
+	buildHuffman(literalFrequencies, 15, &literals);
+	buildHuffman(distanceFrequencies, 15, &distances);
+	int literalCount = 286, distanceCount = 30;
+	while (literalCount > 257 && literals.lengths[literalCount - 1] == 0) literalCount--;
+	while (distanceCount > 1 && distances.lengths[distanceCount - 1] == 0) distanceCount--;
+
+	// both codes' lengths, run length coded
+	vector<uint8_t> lengths(literals.lengths.begin(), literals.lengths.begin() + literalCount);
+	lengths.insert(lengths.end(), distances.lengths.begin(), distances.lengths.begin() + distanceCount);
+	vector<LengthRun> runs;
+	for (size_t i = 0; i < lengths.size();) {
+		uint8_t length = lengths[i];
+		size_t run = 1;
+		while (i + run < lengths.size() && lengths[i + run] == length) run++;
+		if (length == 0 && run >= 3) {
+			run = std::min(run, size_t(138));
+			runs.push_back(run >= 11 ? LengthRun{18, uint8_t(run - 11)} : LengthRun{17, uint8_t(run - 3)});
+			i += run;
+		} else if (length != 0 && run >= 4) {
+			// the length once, then repeated
+			run = std::min(run - 1, size_t(6));
+			runs.push_back(LengthRun{length, 0});
+			runs.push_back(LengthRun{16, uint8_t(run - 3)});
+			i += 1 + run;
+		} else {
+			runs.push_back(LengthRun{length, 0});
+			i++;
+		}
+	}
+	vector<uint32_t> runFrequencies(19, 0);
+	for (const LengthRun &run : runs)
+		runFrequencies[run.symbol]++;
+	Huffman runCodes;
+	buildHuffman(runFrequencies, 7, &runCodes);
+	int runCodeCount = 19;
+	while (runCodeCount > 4 && runCodes.lengths[CODE_LENGTH_ORDER[runCodeCount - 1]] == 0) runCodeCount--;
+
+	uint64_t bits = 3 + 5 + 5 + 4 + 3*runCodeCount;
+	for (const LengthRun &run : runs)
+		bits += runCodes.lengths[run.symbol] + RUN_EXTRA_BITS[run.symbol];
+	for (int s = 0; s < 286; s++)
+		bits += uint64_t(literalFrequencies[s])*(literals.lengths[s] + (s > 256 ? LENGTH_EXTRA[s - 257] : 0));
+	for (int d = 0; d < 30; d++)
+		bits += uint64_t(distanceFrequencies[d])*(distances.lengths[d] + DISTANCE_EXTRA[d]);
+	uint64_t storedBits = 8*size + 40*((size + 65534)/65535);
+	if (storedBits <= bits) {
+		writeStored(out, raw, size);
+		return;
+	}
+
+	out->put(2 << 1, 3); // not the last block, dynamic codes
+	out->put(literalCount - 257, 5);
+	out->put(distanceCount - 1, 5);
+	out->put(runCodeCount - 4, 4);
+	for (int i = 0; i < runCodeCount; i++)
+		out->put(runCodes.lengths[CODE_LENGTH_ORDER[i]], 3);
+	for (const LengthRun &run : runs) {
+		out->put(runCodes.codes[run.symbol], runCodes.lengths[run.symbol]);
+		out->put(run.extra, RUN_EXTRA_BITS[run.symbol]);
+	}
+	for (const Symbol &symbol : symbols) {
+		if (symbol.distance == 0) {
+			out->put(literals.codes[symbol.value], literals.lengths[symbol.value]);
+			continue;
+		}
+		int code = tables.lengthCode[symbol.value];
+		out->put(literals.codes[257 + code], literals.lengths[257 + code]);
+		out->put(symbol.value - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+		code = distanceCode(symbol.distance);
+		out->put(distances.codes[code], distances.lengths[code]);
+		out->put(symbol.distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+	}
+	out->put(literals.codes[256], literals.lengths[256]);
+}
+
+// deflates data[begin, end) as the blocks of a stream that has data[0,
+// begin) before it, ending with a sync flush
+void deflateBand(const unsigned char *data, size_t begin, size_t end, const Level &level, BitWriter *out)
+{
+	if (level.chain == 0) {
+		writeStored(out, data + begin, end - begin);
+		writeStored(out, data + end, 0);
+		return;
+	}
+
+	size_t windowStart = begin > size_t(WINDOW) ? begin - WINDOW : 0;
+	const unsigned char *base = data + windowStart;
+	int start = begin - windowStart, stop = end - windowStart;
+	vector<int> head(1 << HASH_BITS, -1), previous(WINDOW, -1);
+	auto hash = [&](int p) {
+		uint32_t v = base[p] | base[p + 1] << 8 | base[p + 2] << 16;
+		return (v*2654435761u) >> (32 - HASH_BITS);
+	};
+	auto insert = [&](int p) {
+		if (p + MIN_MATCH > stop) return;
+		uint32_t h = hash(p);
+		previous[p & (WINDOW - 1)] = head[h];
+		head[h] = p;
+	};
+	// the longest match at p longer than shortest, 0 if there is none
+	auto findMatch = [&](int p, int shortest, int *distance) {
+		int limit = std::min(MAX_MATCH, stop - p);
+		if (limit <= shortest) return 0;
+		int best = shortest, chain = level.chain;
+		for (int candidate = head[hash(p)]; candidate >= 0 && p - candidate <= WINDOW && chain-- > 0;) {
+			if (base[candidate + best] == base[p + best]) {
+				int length = 0;
+				while (length < limit && base[candidate + length] == base[p + length]) length++;
+				if (length > best) {
+					best = length;
+					*distance = p - candidate;
+					if (length >= level.nice || length == limit) break;
+				}
+			}
+			int next = previous[candidate & (WINDOW - 1)];
+			if (next >= candidate) break;
+			candidate = next;
+		}
+		return best > shortest ? best : 0;
+	};
+
+	for (int p = 0; p < start; p++)
+		insert(p);
+
+	vector<Symbol> symbols;
+	symbols.reserve(BLOCK_SYMBOLS);
+	int blockStart = start;
+	auto flush = [&](int p) {
+		if (!symbols.empty()) writeBlock(out, symbols, base + blockStart, p - blockStart);
+		symbols.clear();
+		blockStart = p;
+	};
+	auto literal = [&](int p) { symbols.push_back(Symbol{base[p], 0}); };
+	auto match = [&](int length, int distance) { symbols.push_back(Symbol{uint16_t(length), uint16_t(distance)}); };
+
+	// a lazy match found at p - 1 waits for the search at p, which may find
+	// a longer one
+	bool pending = false;
+	int pendingLength = 0, pendingDistance = 0;
+	int p = start;
+	while (p < stop) {
+		if (!pending && symbols.size() >= size_t(BLOCK_SYMBOLS)) flush(p);
+		int distance = 0;
+		int length = findMatch(p, pending ? pendingLength : MIN_MATCH - 1, &distance);
+		insert(p);
+		if (pending) {
+			if (length > 0) {
+				literal(p - 1);
+				pendingLength = length;
+				pendingDistance = distance;
+				p++;
+			} else {
+				match(pendingLength, pendingDistance);
+				int next = p - 1 + pendingLength;
+				for (p++; p < next; p++) insert(p);
+				pending = false;
+			}
+		} else if (length > 0 && level.lazy && length < level.nice) {
+			pending = true;
+			pendingLength = length;
+			pendingDistance = distance;
+			p++;
+		} else if (length > 0) {
+			match(length, distance);
+			int next = p + length;
+			for (p++; p < next; p++) insert(p);
+		} else {
+			literal(p);
+			p++;
+		}
+	}
+	if (pending) match(pendingLength, pendingDistance);
+	flush(stop);
+	writeStored(out, data + end, 0);
+}
+
+// deflate with a 32K window, the level in two bits, and a check
+void putZlibHeader(vector<unsigned char> *bytes, int levelIndex)
+{
+	int header = 0x78 << 8 | (levelIndex < 2 ? 0 : levelIndex < 6 ? 1 : levelIndex == 6 ? 2 : 3) << 6;
+	header += 31 - header % 31;
+	bytes->push_back(uint8_t(header >> 8));
+	bytes->push_back(uint8_t(header));
+}
+
+// an empty last block with fixed codes, then the checksum
+void putZlibTrailer(vector<unsigned char> *bytes, uint32_t checksum)
+{
+	bytes->push_back(0x03);
+	bytes->push_back(0x00);
+	putBigEndian(bytes, checksum);
+}
+
+int paethPredictor(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+// filters the rows [y0, y1) of the image, rows from the top, into filtered,
+// each row after its filter type. The type chosen is the one whose bytes,
+// taken as signed, add up to the least, which tends to compress best;
+// without choosing, rows are not filtered
+void filterRows(const unsigned char *pixels, int width, int y0, int y1, bool choose, unsigned char *filtered)
+{
+	const int bpp = 3;
+	size_t rowBytes = size_t(width)*bpp;
+	vector<unsigned char> candidates(5*rowBytes), zero(rowBytes, 0);
+	for (int y = y0; y < y1; y++) {
+		const unsigned char *row = pixels + y*rowBytes;
+		const unsigned char *above = y > 0 ? row - rowBytes : zero.data();
+		unsigned char *out = filtered + y*(rowBytes + 1);
+		if (!choose) {
+			out[0] = 0;
+			memcpy(out + 1, row, rowBytes);
+			continue;
+		}
+		unsigned cost[5] = {0, 0, 0, 0, 0};
+		for (size_t i = 0; i < rowBytes; i++) {
+			int a = i >= size_t(bpp) ? row[i - bpp] : 0, b = above[i], c = i >= size_t(bpp) ? above[i - bpp] : 0;
+			int x = row[i];
+			uint8_t value[5] = {uint8_t(x), uint8_t(x - a), uint8_t(x - b), uint8_t(x - ((a + b) >> 1)),
+				uint8_t(x - paethPredictor(a, b, c))};
+			for (int f = 0; f < 5; f++) {
+				candidates[f*rowBytes + i] = value[f];
+				cost[f] += std::abs(int(int8_t(value[f])));
+			}
+		}
+		int best = int(min_element(cost, cost + 5) - cost);
+		out[0] = best;
+		memcpy(out + 1, &candidates[best*rowBytes], rowBytes);
+	}
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+bool writePNG(const string &fileName, int width, int height,
+		const unsigned char *pixels, const PngOptions &options)
+{
+	if (width <= 0 || height <= 0) return false;
+	int levelIndex = std::min(std::max(options.level, 0), 9);
+	const Level &level = LEVELS[levelIndex];
+	int workers = options.workers > 0 ? options.workers : defaultWorkerCount();
+
+	size_t rowBytes = size_t(width)*3 + 1;
+	vector<unsigned char> filtered(rowBytes*height);
+	// bands of rows; the tiles' y counts rows from the top here
+	int bandRows = int(std::max(size_t(1), BAND_BYTES/rowBytes));
+	vector<Tile> bands;
+	for (int y = 0; y < height; y += bandRows) {
+		Tile band;
+		band.index = bands.size();
+		band.x = 0;
+		band.y = y;
+		band.width = width;
+		band.height = std::min(bandRows, height - y);
+		bands.push_back(band);
+	}
+
+	// every band needs the filtered band before it, its dictionary, so
+	// all are filtered before any is deflated
+	renderTiles(bands, workers, [&](const Tile &band, int worker) {
+		filterRows(pixels, width, band.y, band.y + band.height, level.chain > 0, filtered.data());
+	}, nullptr);
+
+	// each band's IDAT chunk, the first one starting the zlib stream
+	vector<vector<unsigned char>> chunks(bands.size());
+	vector<uint32_t> checksums(bands.size());
+	renderTiles(bands, workers, [&](const Tile &band, int worker) {
+		size_t begin = band.y*rowBytes, end = (band.y + band.height)*rowBytes;
+		BitWriter out;
+		out.bytes.reserve((end - begin)/2 + 64);
+		out.bytes.resize(8);
+		if (band.index == 0)
+			putZlibHeader(&out.bytes, levelIndex);
+		deflateBand(filtered.data(), begin, end, level, &out);
+		finishChunk(&out.bytes, "IDAT");
+		chunks[band.index].swap(out.bytes);
+		checksums[band.index] = adler32(filtered.data() + begin, end - begin);
+	}, nullptr);
+
+	uint32_t checksum = checksums[0];
+	for (size_t b = 1; b < bands.size(); b++)
+		checksum = adler32Combine(checksum, checksums[b], bands[b].height*rowBytes);
+	vector<unsigned char> last(8);
+	putZlibTrailer(&last, checksum);
+	finishChunk(&last, "IDAT");
+
+	vector<unsigned char> header(8);
+	putBigEndian(&header, width);
+	putBigEndian(&header, height);
+	const unsigned char format[5] = {8, 2, 0, 0, 0}; // 8 bit RGB, deflate, adaptive filters, not interlaced
+	header.insert(header.end(), format, format + 5);
+	finishChunk(&header, "IHDR");
+	vector<unsigned char> trailer(8);
+	finishChunk(&trailer, "IEND");
+
+	FILE *file = fopen(fileName.c_str(), "wb");
+	if (!file) return false;
+	const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	bool written = fwrite(signature, 1, 8, file) == 8 &&
+		fwrite(header.data(), 1, header.size(), file) == header.size();
+	for (size_t b = 0; b < chunks.size() && written; b++)
+		written = fwrite(chunks[b].data(), 1, chunks[b].size(), file) == chunks[b].size();
+	written = written && fwrite(last.data(), 1, last.size(), file) == last.size() &&
+		fwrite(trailer.data(), 1, trailer.size(), file) == trailer.size();
+	return fclose(file) == 0 && written;
+}
+
+void zlibCompress(const unsigned char *data, size_t size, int level, vector<unsigned char> *out)
+{
+	int levelIndex = std::min(std::max(level, 0), 9);
+	BitWriter writer;
+	writer.bytes.swap(*out);
+	writer.bytes.clear();
+	writer.bytes.reserve(size/2 + 64);
+	putZlibHeader(&writer.bytes, levelIndex);
+	deflateBand(data, 0, size, LEVELS[levelIndex], &writer);
+	putZlibTrailer(&writer.bytes, adler32(data, size));
+	out->swap(writer.bytes);
+}
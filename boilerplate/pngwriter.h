@@ -0,0 +1,34 @@
+// ==========================================================================
+// Parallel PNG Writer
+//  - bands of rows are filtered, then deflated, on the tile scheduler's
+//    workers; each band is a deflate stream of its own that may still
+//    refer back into the 32K before it (as pigz does), so cutting the image
+//    up costs little compression
+//  - a band ends with a sync flush (an empty stored block), which leaves
+//    it on a byte boundary, so the bands are simply written one after the
+//    other, each as an IDAT chunk, and make one zlib stream; the Adler-32
+//    checksums of the bands are combined at the end
+//  - LZ77 with hash chains and, from level 4, lazy matching, and Huffman
+//    codes made for each block; blocks that would not shrink are stored
+// ==========================================================================
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <string>
+#include <vector>
+
+struct PngOptions
+{
+	int level = 6;   // 0 stores the image as it is, 1 is fastest, 9 smallest
+	int workers = 0; // 0 for the default worker count
+};
+
+// writes width*height 8 bit RGB pixels, rows from the top, as a PNG
+bool writePNG(const std::string &fileName, int width, int height,
+		const unsigned char *pixels, const PngOptions &options);
+
+// the same deflate on the calling thread, for other formats: size bytes
+// as one zlib stream, replacing what out held
+void zlibCompress(const unsigned char *data, size_t size, int level, std::vector<unsigned char> *out);
+
+#endif // PNGWRITER_H
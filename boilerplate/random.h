@@ -0,0 +1,49 @@
+// ==========================================================================
+// Small Random Number Generator
+//  - PCG32 (O'Neill 2014): 64 bits of state, 32 bit outputs
+//  - seeded per pixel, so a render is the same on every run
+//  - a sampler (sampler.h) can supply the first numbers nextFloat returns,
+//    so that the first few dimensions of a path are well distributed
+// ==========================================================================
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+struct Random
+{
+	uint64_t state = 0;
+	uint64_t increment = 1;
+	const float *leading = nullptr; // returned by nextFloat before its own
+	int leadingCount = 0;
+
+	Random() {}
+	Random(uint64_t seed, uint64_t stream)
+	{
+		increment = (stream << 1) | 1;
+		nextUInt();
+		state += seed;
+		nextUInt();
+	}
+
+	uint32_t nextUInt()
+	{
+		uint64_t old = state;
+		state = old*6364136223846793005ull + increment;
+		uint32_t shifted = uint32_t(((old >> 18) ^ old) >> 27);
+		uint32_t rotation = uint32_t(old >> 59);
+		return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+	}
+
+	// uniform in [0, 1)
+	float nextFloat()
+	{
+		if (leadingCount > 0) {
+			leadingCount--;
+			return *leading++;
+		}
+		return (nextUInt() >> 8)*(1.0f/16777216.0f);
+	}
+};
+
+#endif // RANDOM_H
@@ -0,0 +1,150 @@
+// ==========================================================================
+// Reservoir-based Resampled Direct Lighting
+//
+// The target function is the unshadowed contribution r + g + b of a light,
+// the source distribution is intensity, drawn with an alias table so the
+// cost of a candidate does not grow with the number of lights. The spatial
+// merge is the biased one of the paper: visibility is not checked
+// when a neighbour's light is reused, which similarSurfaces keeps in check.
+// ==========================================================================
+
+#include <cmath>
+
+#include "restir.h"
+#include "lighttree.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+void buildLightDistribution(LightDistribution *distribution, const vector<Light> &lights)
+{
+	int n = lights.size();
+	distribution->probability.assign(n, 0.0f);
+	distribution->threshold.assign(n, 1.0f);
+	distribution->alias.resize(n);
+	double total = 0.0;
+	for (const Light &light : lights)
+		total += light.color.x + light.color.y + light.color.z;
+	if (n == 0 || total <= 0.0) {
+		distribution->probability.clear();
+		return;
+	}
+
+	// Vose's construction: each light drawn less often than the average
+	// fills up its slot with one drawn more often
+	vector<double> scaled(n);
+	vector<int> small, large;
+	for (int i = 0; i < n; i++) {
+		const vec3 &c = lights[i].color;
+		distribution->probability[i] = float((c.x + c.y + c.z)/total);
+		scaled[i] = (c.x + c.y + c.z)/total*n;
+		distribution->alias[i] = i;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		distribution->threshold[s] = float(scaled[s]);
+		distribution->alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+}
+
+int sampleLightDistribution(const LightDistribution &distribution, Random *random, float *probability)
+{
+	int n = distribution.probability.size();
+	if (n == 0) return -1;
+	int slot = random->nextUInt() % n;
+	int light = random->nextFloat() < distribution.threshold[slot] ? slot : distribution.alias[slot];
+	*probability = distribution.probability[light];
+	return light;
+}
+
+// --------------------------------------------------------------------------
+
+bool Reservoir::update(int candidate, float candidateTarget, float w, Random *random)
+{
+	weightSum += w;
+	if (w > 0.0f && random->nextFloat()*weightSum < w) {
+		light = candidate;
+		target = candidateTarget;
+		return true;
+	}
+	return false;
+}
+
+void Reservoir::finish()
+{
+	weight = light >= 0 && target > 0.0f && count > 0.0f ? weightSum/(count*target) : 0.0f;
+}
+
+// --------------------------------------------------------------------------
+
+namespace {
+
+float targetFunction(const vector<Light> &lights, int light, const HitPoint &hit, const Shape &shape, SurfaceResponse response)
+{
+	const Light &l = lights[light];
+	vec3 toLight = l.origin - hit.position;
+	vec3 c = l.color*lightFalloff(l, dot(toLight, toLight))*response(hit, shape, toLight);
+	return c.x + c.y + c.z;
+}
+
+} // namespace
+
+Reservoir sampleReservoir(const vector<Light> &lights, const LightDistribution &distribution,
+		const HitPoint &hit, const Shape &shape,
+		SurfaceResponse response, const RestirOptions &options, Random *random)
+{
+	Reservoir reservoir;
+	for (int k = 0; k < options.candidates; k++) {
+		float probability;
+		int light = sampleLightDistribution(distribution, random, &probability);
+		if (light < 0) break;
+		float target = targetFunction(lights, light, hit, shape, response);
+		reservoir.update(light, target, target/probability, random);
+		reservoir.count += 1.0f;
+	}
+	reservoir.finish();
+	return reservoir;
+}
+
+Reservoir combineReservoirs(const vector<Light> &lights, const HitPoint &hit, const Shape &shape,
+		const Reservoir *const *reservoirs, int count, SurfaceResponse response, Random *random)
+{
+	Reservoir combined;
+	for (int k = 0; k < count; k++) {
+		const Reservoir &r = *reservoirs[k];
+		if (r.light >= 0) {
+			float target = targetFunction(lights, r.light, hit, shape, response);
+			combined.update(r.light, target, target*r.weight*r.count, random);
+		}
+		combined.count += r.count;
+	}
+	combined.finish();
+	return combined;
+}
+
+bool similarSurfaces(const HitPoint &a, float distanceA, const HitPoint &b, float distanceB)
+{
+	return dot(a.normal, b.normal) > 0.9f && fabs(distanceA - distanceB) < 0.1f*distanceA;
+}
+
+vec3 shadeReservoir(const vector<Light> &lights, const HitPoint &hit, const Shape &shape,
+		const Reservoir &reservoir, SurfaceResponse response, LightVisible visible, Random *random)
+{
+	lightStats.hits++;
+	if (reservoir.light < 0 || reservoir.weight <= 0.0f) return vec3(0.0f);
+	const Light &light = lights[reservoir.light];
+	lightStats.lightsEvaluated++;
+	float visibility = visible(hit, light, random);
+	if (visibility <= 0.0f) return vec3(0.0f);
+	vec3 toLight = light.origin - hit.position;
+	return light.color*lightFalloff(light, dot(toLight, toLight))*response(hit, shape, toLight)*(visibility*reservoir.weight);
+}
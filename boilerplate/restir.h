@@ -0,0 +1,81 @@
+// ==========================================================================
+// Reservoir-based Resampled Direct Lighting (ReSTIR, Bitterli et al. 2020)
+//  - every hit draws a few candidate lights in proportion to intensity
+//    (alias method, constant time) and keeps one by weighted reservoir
+//    sampling against its unshadowed contribution (resampled importance
+//    sampling)
+//  - primary hits then merge in the reservoirs of a few pixels nearby in
+//    the same tile whose surfaces are alike (spatial reuse)
+//  - only the light that survives is shadow tested, so there is one
+//    shadow ray per hit however many lights there are
+// ==========================================================================
+#ifndef RESTIR_H
+#define RESTIR_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "random.h"
+
+struct RestirOptions
+{
+	int candidates = 32; // lights drawn per hit
+	int neighbors = 4;   // reservoirs merged in per primary hit
+	int radius = 8;      // pixels, neighbours are picked within this and
+	                     // never from another tile
+};
+
+struct Reservoir
+{
+	int light = -1;         // chosen light, -1 for none
+	float target = 0.0f;    // target function of the chosen light
+	float weightSum = 0.0f;
+	float count = 0.0f;     // candidates seen (M)
+	float weight = 0.0f;    // contribution weight of the chosen light (W)
+
+	// streams in a candidate with resampling weight w; true if it was kept
+	bool update(int candidate, float candidateTarget, float w, Random *random);
+
+	// sets weight once all candidates are in
+	void finish();
+};
+
+// Walker's alias table over the lights, by intensity (r + g + b)
+struct LightDistribution
+{
+	std::vector<float> probability; // of drawing each light
+	std::vector<float> threshold;   // slot i gives light i below this
+	std::vector<int> alias;         // and alias[i] above it
+};
+
+void buildLightDistribution(LightDistribution *distribution, const std::vector<Light> &lights);
+
+// -1 if there are no lights or they are all black
+int sampleLightDistribution(const LightDistribution &distribution, Random *random, float *probability);
+
+// the unshadowed response to a light of unit colour, and the fraction of
+// the light that hit sees; both supplied by the renderer
+typedef glm::vec3 (*SurfaceResponse)(const HitPoint &hit, const Shape &shape, glm::vec3 toLight);
+typedef float (*LightVisible)(const HitPoint &hit, const Light &light, Random *random);
+
+// a reservoir over options.candidates lights drawn for hit
+Reservoir sampleReservoir(const std::vector<Light> &lights, const LightDistribution &distribution,
+		const HitPoint &hit, const Shape &shape,
+		SurfaceResponse response, const RestirOptions &options, Random *random);
+
+// merges reservoirs found at other hits into one for hit; the pixel's own
+// reservoir should be among them
+Reservoir combineReservoirs(const std::vector<Light> &lights, const HitPoint &hit, const Shape &shape,
+		const Reservoir *const *reservoirs, int count, SurfaceResponse response, Random *random);
+
+// whether a neighbour's reservoir is worth reusing: similar normal and
+// distance from the camera
+bool similarSurfaces(const HitPoint &a, float distanceA, const HitPoint &b, float distanceB);
+
+// direct light at hit from the reservoir's light, one shadow ray (a few
+// for area lights)
+glm::vec3 shadeReservoir(const std::vector<Light> &lights, const HitPoint &hit, const Shape &shape,
+		const Reservoir &reservoir, SurfaceResponse response, LightVisible visible, Random *random);
+
+#endif // RESTIR_H
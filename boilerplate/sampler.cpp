@@ -0,0 +1,308 @@
+// ==========================================================================
+// Pixel Samplers
+//
+// Dimensions are taken in pairs, each pair from a 2D point set of its own,
+// which keeps the 2D projections the renderer uses (pixel position, a
+// point on an area light) well stratified without high dimensional
+// direction numbers. Per pixel seeds come from a hash of the pixel, so
+// neighbouring pixels are decorrelated.
+// ==========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "sampler.h"
+#include "random.h"
+
+using namespace std;
+
+namespace {
+
+const int MASK_SIZE = 64; // blue noise mask, tiled over the image
+
+uint32_t mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t value)
+{
+	return mix(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+float toFloat(uint32_t x)
+{
+	return (x >> 8)*(1.0f/16777216.0f);
+}
+
+uint32_t reverseBits(uint32_t x)
+{
+	x = __builtin_bswap32(x);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Owen scrambling by hashing (Laine and Karras 2011, Burley 2020) of a
+// bit reversed value: every bit is flipped depending only on the bits
+// below it, which are the more significant ones once reversed again
+uint32_t laineKarras(uint32_t x, uint32_t seed)
+{
+	x += seed;
+	x ^= x*0x6c50b47cu;
+	x ^= x*0xb82f1e52u;
+	x ^= x*0xc7afe638u;
+	x ^= x*0x8d22f6e6u;
+	return x;
+}
+
+uint32_t owenScramble(uint32_t x, uint32_t seed)
+{
+	return reverseBits(laineKarras(reverseBits(x), seed));
+}
+
+// the second Sobol dimension (the first is reverseBits) is linear in the
+// bits of the index, so it is the xor of one table entry per index byte;
+// scrambled indices use all 32 bits. The tables hold it bit reversed,
+// ready for laineKarras
+struct SobolTables
+{
+	uint32_t bytes[4][256];
+
+	SobolTables()
+	{
+		uint32_t directions[32];
+		directions[0] = 1u << 31;
+		for (int b = 1; b < 32; b++)
+			directions[b] = directions[b - 1] ^ (directions[b - 1] >> 1);
+		for (int k = 0; k < 4; k++) {
+			for (int value = 0; value < 256; value++) {
+				uint32_t x = 0;
+				for (int b = 0; b < 8; b++)
+					if (value & (1 << b)) x ^= directions[8*k + b];
+				bytes[k][value] = reverseBits(x);
+			}
+		}
+	}
+};
+
+const SobolTables sobolTables;
+
+uint32_t sobolSecondReversed(uint32_t index)
+{
+	return sobolTables.bytes[0][index & 0xff] ^ sobolTables.bytes[1][(index >> 8) & 0xff] ^
+		sobolTables.bytes[2][(index >> 16) & 0xff] ^ sobolTables.bytes[3][index >> 24];
+}
+
+// element i of a random permutation of [0, length) chosen by seed
+// (Kensler 2013)
+uint32_t permute(uint32_t i, uint32_t length, uint32_t seed)
+{
+	uint32_t w = length - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do {
+		i ^= seed;
+		i *= 0xe170893du;
+		i ^= seed >> 16;
+		i ^= (i & w) >> 4;
+		i ^= seed >> 8;
+		i *= 0x0929eb3fu;
+		i ^= seed >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | seed >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303u;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= length);
+	return (i + seed) % length;
+}
+
+// an Owen scrambled Sobol (0, 2) point, the index shuffled too so that
+// pairs with different seeds are not correlated
+void sobolPair(uint32_t index, uint32_t seed, float *u, float *v)
+{
+	index = owenScramble(index, seed);
+	*u = toFloat(reverseBits(laineKarras(index, hashCombine(seed, 1))));
+	*v = toFloat(reverseBits(laineKarras(sobolSecondReversed(index), hashCombine(seed, 2))));
+}
+
+// a blue noise threshold mask made by void and cluster (Ulichney 1993):
+// ones are added one at a time where they are sparsest, as measured by a
+// Gaussian over the torus, and each pixel's value is its turn
+vector<float> makeBlueNoiseMask()
+{
+	const int n = MASK_SIZE, count = n*n;
+	const float sigma = 1.5f;
+	vector<float> kernel(count);
+	for (int dy = 0; dy < n; dy++) {
+		for (int dx = 0; dx < n; dx++) {
+			float x = float(std::min(dx, n - dx)), y = float(std::min(dy, n - dy));
+			kernel[dy*n + dx] = exp(-(x*x + y*y)/(2.0f*sigma*sigma));
+		}
+	}
+
+	vector<char> pattern(count, 0);
+	vector<float> energy(count, 0.0f);
+	auto toggle = [&](int p, bool on) {
+		pattern[p] = on;
+		float sign = on ? 1.0f : -1.0f;
+		int px = p % n, py = p / n;
+		for (int y = 0; y < n; y++) {
+			const float *row = &kernel[((y - py) & (n - 1))*n];
+			for (int x = 0; x < n; x++)
+				energy[y*n + x] += sign*row[(x - px) & (n - 1)];
+		}
+	};
+	// the tightest cluster of ones, or the largest void among the zeros
+	auto extreme = [&](bool ones) {
+		int best = -1;
+		for (int p = 0; p < count; p++)
+			if (pattern[p] == ones && (best < 0 || (ones ? energy[p] > energy[best] : energy[p] < energy[best])))
+				best = p;
+		return best;
+	};
+
+	// a random tenth of the pixels, spread out until moving the tightest
+	// cluster to the largest void would put it back where it was
+	Random random(1, 0);
+	int initialOnes = count/10;
+	for (int placed = 0; placed < initialOnes;) {
+		int p = random.nextUInt() % count;
+		if (!pattern[p]) {
+			toggle(p, true);
+			placed++;
+		}
+	}
+	for (;;) {
+		int cluster = extreme(true);
+		toggle(cluster, false);
+		int gap = extreme(false);
+		toggle(gap, true);
+		if (gap == cluster) break;
+	}
+
+	vector<int> rank(count);
+	vector<char> initialPattern = pattern;
+	vector<float> initialEnergy = energy;
+	for (int r = initialOnes - 1; r >= 0; r--) {
+		int cluster = extreme(true);
+		toggle(cluster, false);
+		rank[cluster] = r;
+	}
+	pattern = initialPattern;
+	energy = initialEnergy;
+	for (int r = initialOnes; r < count; r++) {
+		int gap = extreme(false);
+		toggle(gap, true);
+		rank[gap] = r;
+	}
+
+	vector<float> mask(count);
+	for (int p = 0; p < count; p++)
+		mask[p] = (rank[p] + 0.5f)/count;
+	return mask;
+}
+
+const vector<float> &blueNoiseMask()
+{
+	static const vector<float> mask = makeBlueNoiseMask();
+	return mask;
+}
+
+// the mask tile for one dimension; dimensions read it at different offsets
+// so that they are not correlated with each other
+float blueNoise(int x, int y, int dimension, uint32_t seed)
+{
+	const vector<float> &mask = blueNoiseMask();
+	x = (x + dimension*23 + seed) & (MASK_SIZE - 1);
+	y = (y + dimension*41 + (seed >> 6)) & (MASK_SIZE - 1);
+	return mask[y*MASK_SIZE + x];
+}
+
+float wrap(float x)
+{
+	return x < 1.0f ? x : x - 1.0f;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+void pixelSample(const SamplerOptions &options, int x, int y, int index, float *point, int dimensions)
+{
+	dimensions = std::min(dimensions + (dimensions & 1), SAMPLE_DIMENSIONS);
+	uint32_t pixel = hashCombine(hashCombine(mix(options.seed), uint32_t(x)), uint32_t(y));
+	switch (options.type) {
+	case SAMPLER_RANDOM: {
+		Random random(pixel, index);
+		for (int d = 0; d < dimensions; d++)
+			point[d] = random.nextFloat();
+		break;
+	}
+	case SAMPLER_STRATIFIED: {
+		// as square a grid of at least options.samples strata as there is
+		int columns = std::max(1, int(sqrt(float(options.samples)))), rows = (options.samples + columns - 1)/columns;
+		for (int d = 0; d < dimensions; d += 2) {
+			uint32_t seed = hashCombine(pixel, d);
+			uint32_t stratum = permute(uint32_t(index) % (columns*rows), columns*rows, seed);
+			uint32_t jitter = hashCombine(seed, index);
+			point[d] = (stratum % columns + toFloat(jitter))/columns;
+			point[d + 1] = (stratum / columns + toFloat(mix(jitter)))/rows;
+		}
+		break;
+	}
+	case SAMPLER_SOBOL:
+		for (int d = 0; d < dimensions; d += 2)
+			sobolPair(index, hashCombine(pixel, d), &point[d], &point[d + 1]);
+		break;
+	case SAMPLER_BLUE_NOISE:
+		for (int d = 0; d < dimensions; d += 2) {
+			sobolPair(index, hashCombine(mix(options.seed), d), &point[d], &point[d + 1]);
+			point[d] = wrap(point[d] + blueNoise(x, y, d, options.seed));
+			point[d + 1] = wrap(point[d + 1] + blueNoise(x, y, d + 1, options.seed));
+		}
+		break;
+	default:
+		for (int d = 0; d < dimensions; d++)
+			point[d] = 0.0f;
+	}
+}
+
+const char *samplerName(SamplerType type)
+{
+	switch (type) {
+	case SAMPLER_RANDOM: return "random";
+	case SAMPLER_STRATIFIED: return "stratified";
+	case SAMPLER_SOBOL: return "sobol";
+	case SAMPLER_BLUE_NOISE: return "blue-noise";
+	default: return "fixed";
+	}
+}
+
+bool parseSamplerType(const string &name, SamplerType *type)
+{
+	for (int t = SAMPLER_FIXED; t <= SAMPLER_BLUE_NOISE; t++) {
+		if (name == samplerName(SamplerType(t))) {
+			*type = SamplerType(t);
+			return true;
+		}
+	}
+	return false;
+}
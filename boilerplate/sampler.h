@@ -0,0 +1,52 @@
+// ==========================================================================
+// Pixel Samplers
+//  - each sample of a pixel is a point in [0, 1)^SAMPLE_DIMENSIONS: the
+//    first two place the camera ray inside the pixel, the rest are handed
+//    to the sample's Random and so are the first numbers its path draws
+//    (area light positions, light choices)
+//  - random: independent uniform numbers
+//  - stratified: jittered strata of a grid per pair of dimensions, shuffled
+//    independently for each pair
+//  - sobol: the first two Sobol dimensions, Owen scrambled (Burley 2020),
+//    with each further pair a shuffled copy of them
+//  - blue noise: the same sequence in every pixel, offset per pixel by a
+//    blue noise mask (Georgiev and Fajardo 2016), so the error left at a
+//    low sample count has no low frequencies
+//  - every sampler but blue noise draws from a sequence of its own in each
+//    pixel
+// ==========================================================================
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <string>
+
+enum SamplerType
+{
+	SAMPLER_FIXED,      // one ray through the pixel corner, no sampler
+	SAMPLER_RANDOM,
+	SAMPLER_STRATIFIED,
+	SAMPLER_SOBOL,
+	SAMPLER_BLUE_NOISE
+};
+
+const int SAMPLE_DIMENSIONS = 8;
+
+struct SamplerOptions
+{
+	SamplerType type = SAMPLER_FIXED;
+	int samples = 1; // per pixel; sobol and blue noise are best at powers of two
+	uint32_t seed = 0; // renders with different seeds are independent
+};
+
+// fills the first dimensions (rounded up to even, at most
+// SAMPLE_DIMENSIONS) of point with sample index of the pixel at (x, y), of
+// options.samples
+void pixelSample(const SamplerOptions &options, int x, int y, int index, float *point,
+		int dimensions = SAMPLE_DIMENSIONS);
+
+// name as given on the command line, and back; false if unknown
+const char *samplerName(SamplerType type);
+bool parseSamplerType(const std::string &name, SamplerType *type);
+
+#endif // SAMPLER_H
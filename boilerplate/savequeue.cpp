@@ -0,0 +1,86 @@
+// ==========================================================================
+// Background Image Saving
+// ==========================================================================
+
+#include <chrono>
+#include <iostream>
+
+#include "savequeue.h"
+
+using namespace std;
+
+SaveQueue::SaveQueue(int maxPending)
+	: m_maxPending(maxPending)
+{
+	if (m_maxPending > 0)
+		m_thread = thread(&SaveQueue::run, this);
+}
+
+SaveQueue::~SaveQueue()
+{
+	finish();
+}
+
+void SaveQueue::run()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;) {
+		m_changed.wait(lock, [&]() { return !m_jobs.empty() || m_stopping; });
+		if (m_jobs.empty()) return;
+		// the job stays queued while it is written, so that it counts
+		// towards maxPending; only this thread takes jobs off
+		Job &job = m_jobs.front();
+		lock.unlock();
+		bool saved = job.frame->SaveToFile(job.fileName);
+		lock.lock();
+		if (!saved) m_failures.push_back(job.fileName);
+		m_saved++;
+		m_jobs.pop_front();
+		m_changed.notify_all();
+	}
+}
+
+void SaveQueue::save(ImageBuffer &image, const string &fileName, bool keep)
+{
+	if (m_maxPending <= 0) {
+		if (!image.SaveToFile(fileName)) m_failures.push_back(fileName);
+		m_saved++;
+		return;
+	}
+
+	// wait for room before the frame is moved, so no more than maxPending
+	// frames are held beside the one being rendered
+	auto waitStart = chrono::steady_clock::now();
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_changed.wait(lock, [&]() { return (int)m_jobs.size() < m_maxPending; });
+	}
+	m_waited += chrono::duration<double, milli>(chrono::steady_clock::now() - waitStart).count();
+
+	Job job;
+	job.frame.reset(new ImageBuffer());
+	job.fileName = fileName;
+	image.MoveFrameTo(*job.frame, keep);
+	lock_guard<mutex> lock(m_mutex);
+	m_jobs.push_back(move(job));
+	m_changed.notify_all();
+}
+
+bool SaveQueue::finish()
+{
+	if (m_thread.joinable()) {
+		auto waitStart = chrono::steady_clock::now();
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stopping = true;
+			m_changed.notify_all();
+		}
+		m_thread.join();
+		double waited = m_waited + chrono::duration<double, milli>(chrono::steady_clock::now() - waitStart).count();
+		cout << "Save queue: " << m_saved << " images written in the background, "
+			<< waited << " ms spent waiting for them" << endl;
+		for (const string &fileName : m_failures)
+			cout << "Save queue: failed to write " << fileName << endl;
+	}
+	return m_failures.empty();
+}
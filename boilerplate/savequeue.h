@@ -0,0 +1,58 @@
+// ==========================================================================
+// Background Image Saving
+//  - a finished frame's pixels are moved into an image of the queue's
+//    own, which a thread quantizes, encodes and writes while the renderer
+//    goes on to the next frame
+//  - at most a given number of frames are queued or being written; saving
+//    another waits for one of them, which bounds the memory they hold
+//  - failures are kept and reported when the queue is finished
+// ==========================================================================
+#ifndef SAVEQUEUE_H
+#define SAVEQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "imagebuffer.h"
+
+class SaveQueue
+{
+	struct Job
+	{
+		std::unique_ptr<ImageBuffer> frame;
+		std::string fileName;
+	};
+
+	int m_maxPending;
+	std::deque<Job> m_jobs; // the front one is being written
+	std::vector<std::string> m_failures;
+	bool m_stopping = false;
+	double m_waited = 0; // milliseconds save spent waiting for room
+	int m_saved = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	std::thread m_thread;
+
+	void run();
+
+public:
+	// maxPending 0 saves on the calling thread
+	explicit SaveQueue(int maxPending);
+	~SaveQueue();
+
+	// saves image to fileName in the background. Its pixels are moved out
+	// and it is left black for the next frame, unless keep is set, when
+	// they are copied instead, for frames that are drawn over the last one
+	void save(ImageBuffer &image, const std::string &fileName, bool keep);
+
+	// waits for every image queued to be written and reports those that
+	// were not; false if any were not. Nothing may be saved after this
+	bool finish();
+};
+
+#endif // SAVEQUEUE_H
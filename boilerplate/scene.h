@@ -0,0 +1,116 @@
+// ==========================================================================
+// Scene Description Types for the Ray Tracer
+//  - rays, lights and shapes as read from the scene files
+//  - shared by the tracer and the acceleration structure
+// ==========================================================================
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "phong.h"
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 dirVector;
+	float focalLength;
+};
+
+enum LightShape
+{
+	LIGHT_POINT,
+	LIGHT_RECTANGLE,
+	LIGHT_SPHERE
+};
+
+struct Light
+{
+	glm::vec3 origin;    // the centre of area lights
+	glm::vec3 color;
+	float radius = 0.0f; // of influence, 0 for a light that reaches everywhere
+	int shape = LIGHT_POINT;
+	glm::vec3 edge[2];   // rectangle: its two sides
+	float size = 0.0f;   // sphere: its radius
+};
+
+// how much of a light reaches a point distanceSquared away: all of it for
+// lights without a radius, else a smooth window that is 0 at the radius
+inline float lightFalloff(const Light &light, float distanceSquared)
+{
+	if (light.radius <= 0.0f) return 1.0f;
+	float x = distanceSquared/(light.radius*light.radius);
+	if (x >= 1.0f) return 0.0f;
+	return (1.0f - x)*(1.0f - x);
+}
+
+// the points of a shape, kept inside it so that a Shape is plain data and
+// a scene can be mapped from a shared segment (sharedscene.h)
+//  - sphere: centre; plane: normal, point; triangle: its three vertices
+struct ShapePoints
+{
+	glm::vec3 points[3];
+	int count = 0;
+
+	void push_back(const glm::vec3 &p) { if (count < 3) points[count++] = p; }
+	int size() const { return count; }
+	glm::vec3 &operator[](int i) { return points[i]; }
+	const glm::vec3 &operator[](int i) const { return points[i]; }
+	glm::vec3 *begin() { return points; }
+	glm::vec3 *end() { return points + count; }
+	const glm::vec3 *begin() const { return points; }
+	const glm::vec3 *end() const { return points + count; }
+};
+
+struct Shape
+{
+	int type; // 0 means sphere, 1 means plane; 2 means triangle
+	ShapePoints data;
+	float addition = .0f;
+	glm::vec3 color;
+	int id;
+	glm::vec3 specularColor;
+	glm::vec3 specularHighLight;
+	float PEx;
+	glm::vec3 normal; // unit geometric normal of planes and triangles
+	PhongExponent phong; // PEx, set up for fast evaluation
+};
+
+// the shapes of a scene wherever they are stored, a vector or a shared
+// segment; a view, so whatever it points into must outlive it
+struct ShapeSpan
+{
+	const Shape *shapes = nullptr;
+	int count = 0;
+
+	ShapeSpan() {}
+	ShapeSpan(const Shape *s, int n) : shapes(s), count(n) {}
+	ShapeSpan(const std::vector<Shape> &list) : shapes(list.data()), count(list.size()) {}
+
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	const Shape &operator[](int i) const { return shapes[i]; }
+	const Shape *begin() const { return shapes; }
+	const Shape *end() const { return shapes + count; }
+};
+
+struct IntersectionInfo
+{
+	float t;
+	const Shape *shape;
+	int index; // position of shape in the shape list
+};
+
+// what shading needs at a ray hit, all directions unit length
+struct HitPoint
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 direction; // of the incoming ray
+};
+
+// primitive intersection tests (boilerplate.cpp), t is not range checked
+bool testIntersection(const Ray &aRay, const Shape &aShape, IntersectionInfo *info);
+
+#endif // SCENE_H
@@ -0,0 +1,266 @@
+// ==========================================================================
+// Shared Scene Segment
+//
+// File layout (native byte order, checked on load), every array starting
+// on a 64 byte boundary:
+//   SegmentHeader
+//   Shape    shapes[shapeCount]
+//   Light    lights[lightCount]
+//   BVHNode  nodes[nodeCount]
+//   int      refs[refCount]
+//   int      unbounded[unboundedCount]
+// Shapes and lights are stored as they are in memory, which is why both
+// must stay plain data.
+// ==========================================================================
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sharedscene.h"
+#include "bvhcache.h"
+
+using namespace std;
+
+static_assert(is_trivially_copyable<Shape>::value, "shapes are mapped from shared scene segments");
+static_assert(is_trivially_copyable<Light>::value, "lights are mapped from shared scene segments");
+
+// --------------------------------------------------------------------------
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'S', 'C', 'E', 'N', 'E', 'S', 'E', 'G'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct SegmentHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t shapeSize;
+	uint32_t lightSize;
+	uint32_t nodeSize;
+	uint32_t primitiveCount;
+	uint64_t sceneHash;
+	uint32_t spatialSplits;
+	uint32_t shapeCount;
+	uint32_t lightCount;
+	uint32_t nodeCount;
+	uint32_t refCount;
+	uint32_t unboundedCount;
+};
+
+// where each array starts
+struct SegmentLayout
+{
+	size_t shapes, lights, nodes, refs, unbounded, size;
+};
+
+size_t align64(size_t offset)
+{
+	return (offset + 63) & ~size_t(63);
+}
+
+SegmentLayout layoutSegment(const SegmentHeader &header)
+{
+	SegmentLayout layout;
+	layout.shapes = align64(sizeof(SegmentHeader));
+	layout.lights = align64(layout.shapes + size_t(header.shapeCount)*sizeof(Shape));
+	layout.nodes = align64(layout.lights + size_t(header.lightCount)*sizeof(Light));
+	layout.refs = align64(layout.nodes + size_t(header.nodeCount)*sizeof(BVHNode));
+	layout.unbounded = align64(layout.refs + size_t(header.refCount)*sizeof(int));
+	layout.size = layout.unbounded + size_t(header.unboundedCount)*sizeof(int);
+	return layout;
+}
+
+template <typename T>
+uint64_t hashValue(uint64_t hash, const T &value)
+{
+	return hashBytes(hash, &value, sizeof(T));
+}
+
+// the point count readFile gives each shape type
+bool validShape(const Shape &shape)
+{
+	static const int points[] = {1, 2, 3};
+	return shape.type >= 0 && shape.type <= 2 && shape.data.size() == points[shape.type];
+}
+
+bool writeAt(FILE *f, size_t offset, const void *data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(f);
+	if (position < 0 || size_t(position) > offset) return false;
+	if (offset > size_t(position) && fwrite(zeros, 1, offset - position, f) != offset - position)
+		return false;
+	return size == 0 || fwrite(data, 1, size, f) == size;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+uint64_t hashSceneFile(const char *path, const BVHBuildOptions &options)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return 0;
+	uint64_t hash = 14695981039346656037ull;
+	hash = hashValue(hash, SHARED_SCENE_VERSION);
+	hash = hashValue(hash, options.splitBudget);
+	hash = hashValue(hash, options.overlapThreshold);
+	hash = hashValue(hash, options.maxLeafSize);
+	hash = hashValue(hash, options.spatialBins);
+	hash = hashValue(hash, options.layout);
+	hash = hashValue(hash, options.treeletSize);
+	// FNV-1a over 8 byte words rather than bytes, the file can be large
+	uint64_t buffer[8192];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		size_t words = read/sizeof(uint64_t);
+		for (size_t i = 0; i < words; i++) {
+			hash ^= buffer[i];
+			hash *= 1099511628211ull;
+		}
+		hash = hashBytes(hash, reinterpret_cast<char *>(buffer) + words*sizeof(uint64_t), read - words*sizeof(uint64_t));
+	}
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok && hash != 0 ? hash : 0;
+}
+
+string sharedScenePath(const string &directory, uint64_t sceneHash)
+{
+	char name[40];
+	snprintf(name, sizeof(name), "scene-%016llx.seg", (unsigned long long)sceneHash);
+	return directory + "/" + name;
+}
+
+// --------------------------------------------------------------------------
+
+bool loadSharedScene(SharedScene *scene, BVH *bvh, const string &path, uint64_t sceneHash)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SegmentHeader)) {
+		close(fd);
+		return false;
+	}
+	size_t size = info.st_size;
+	void *address = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) return false;
+
+	shared_ptr<const void> mapping(address, [size](const void *p) {
+		munmap(const_cast<void *>(p), size);
+	});
+
+	SegmentHeader header;
+	memcpy(&header, address, sizeof(header));
+	if (memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+		header.version != SHARED_SCENE_VERSION ||
+		header.byteOrder != BYTE_ORDER_MARK ||
+		header.shapeSize != sizeof(Shape) ||
+		header.lightSize != sizeof(Light) ||
+		header.nodeSize != sizeof(BVHNode) ||
+		header.sceneHash != sceneHash) {
+		cout << "Shared scene: ignoring " << path << " (format or scene mismatch)" << endl;
+		return false;
+	}
+
+	SegmentLayout layout = layoutSegment(header);
+	if (size != layout.size) {
+		cout << "Shared scene: ignoring " << path << " (truncated)" << endl;
+		return false;
+	}
+
+	const char *base = static_cast<const char *>(address);
+	SharedScene loadedScene;
+	loadedScene.shapes = ShapeSpan(reinterpret_cast<const Shape *>(base + layout.shapes), header.shapeCount);
+	loadedScene.lights = reinterpret_cast<const Light *>(base + layout.lights);
+	loadedScene.lightCount = header.lightCount;
+	loadedScene.mapping = mapping;
+
+	const int *unbounded = reinterpret_cast<const int *>(base + layout.unbounded);
+	BVH loaded;
+	loaded.nodes = reinterpret_cast<const BVHNode *>(base + layout.nodes);
+	loaded.nodeCount = header.nodeCount;
+	loaded.refs = reinterpret_cast<const int *>(base + layout.refs);
+	loaded.refCount = header.refCount;
+	loaded.unbounded.assign(unbounded, unbounded + header.unboundedCount);
+	loaded.primitiveCount = header.primitiveCount;
+	loaded.spatialSplits = header.spatialSplits;
+	loaded.mapping = mapping;
+
+	bool valid = validateBVH(loaded, header.shapeCount);
+	for (const Shape &shape : loadedScene.shapes)
+		valid = valid && validShape(shape);
+	for (int i = 0; i < loadedScene.lightCount; i++)
+		valid = valid && loadedScene.lights[i].shape >= LIGHT_POINT && loadedScene.lights[i].shape <= LIGHT_SPHERE;
+	if (!valid) {
+		cout << "Shared scene: ignoring " << path << " (failed validation)" << endl;
+		return false;
+	}
+
+	*scene = std::move(loadedScene);
+	*bvh = std::move(loaded);
+	return true;
+}
+
+bool saveSharedScene(ShapeSpan shapes, const vector<Light> &lights, const BVH &bvh,
+		const string &directory, uint64_t sceneHash)
+{
+	if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+		cout << "Shared scene: could not create directory " << directory << endl;
+		return false;
+	}
+
+	SegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+	header.version = SHARED_SCENE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.shapeSize = sizeof(Shape);
+	header.lightSize = sizeof(Light);
+	header.nodeSize = sizeof(BVHNode);
+	header.primitiveCount = bvh.primitiveCount;
+	header.sceneHash = sceneHash;
+	header.spatialSplits = bvh.spatialSplits;
+	header.shapeCount = shapes.size();
+	header.lightCount = lights.size();
+	header.nodeCount = bvh.nodeCount;
+	header.refCount = bvh.refCount;
+	header.unboundedCount = bvh.unbounded.size();
+	SegmentLayout layout = layoutSegment(header);
+
+	string path = sharedScenePath(directory, sceneHash);
+	string temporary = path + ".tmp." + to_string(getpid());
+	FILE *f = fopen(temporary.c_str(), "wb");
+	if (!f) {
+		cout << "Shared scene: could not write " << temporary << endl;
+		return false;
+	}
+
+	bool ok = writeAt(f, 0, &header, sizeof(header)) &&
+		writeAt(f, layout.shapes, shapes.begin(), shapes.size()*sizeof(Shape)) &&
+		writeAt(f, layout.lights, lights.data(), lights.size()*sizeof(Light)) &&
+		writeAt(f, layout.nodes, bvh.nodes, bvh.nodeCount*sizeof(BVHNode)) &&
+		writeAt(f, layout.refs, bvh.refs, bvh.refCount*sizeof(int)) &&
+		writeAt(f, layout.unbounded, bvh.unbounded.data(), bvh.unbounded.size()*sizeof(int));
+	ok = (fclose(f) == 0) && ok;
+
+	if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+		cout << "Shared scene: could not write " << path << endl;
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,49 @@
+// ==========================================================================
+// Shared Scene Segment
+//  - the shapes, lights and BVH of a scene in one file that every renderer
+//    process on the host maps read-only; kept in a memory file system such
+//    as /dev/shm it is shared memory, each extra process only maps pages
+//  - the first process to ask for a scene reads it, builds the BVH and
+//    publishes the segment; later ones map it and neither parse nor build
+//  - the file is named after a hash of the scene file's bytes and the
+//    build options, so editing either gives a new segment
+// ==========================================================================
+#ifndef SHAREDSCENE_H
+#define SHAREDSCENE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+
+// bump whenever the file layout, Shape or Light change
+const uint32_t SHARED_SCENE_VERSION = 1;
+
+// hash of the scene file and build options; 0 if the file cannot be read
+uint64_t hashSceneFile(const char *path, const BVHBuildOptions &options);
+
+std::string sharedScenePath(const std::string &directory, uint64_t sceneHash);
+
+// the shapes and lights point into the mapping, which the BVH loaded with
+// them shares, so they stay valid while either is around
+struct SharedScene
+{
+	ShapeSpan shapes;
+	const Light *lights = nullptr;
+	int lightCount = 0;
+	std::shared_ptr<const void> mapping;
+};
+
+// maps a segment and points bvh into it; returns false if the file is
+// missing, was written for another scene or format, or fails validation
+bool loadSharedScene(SharedScene *scene, BVH *bvh, const std::string &path, uint64_t sceneHash);
+
+// writes the segment through a temporary name and a rename, so processes
+// starting at the same time never map a partial one
+bool saveSharedScene(ShapeSpan shapes, const std::vector<Light> &lights, const BVH &bvh,
+		const std::string &directory, uint64_t sceneHash);
+
+#endif // SHAREDSCENE_H
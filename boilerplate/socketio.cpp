@@ -0,0 +1,232 @@
+// ==========================================================================
+// Socket Connections
+// ==========================================================================
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "socketio.h"
+
+using namespace std;
+
+namespace {
+
+bool makeAddress(const char *path, sockaddr_un *address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path)) return false;
+	strcpy(address->sun_path, path);
+	return true;
+}
+
+// reads more into the buffer; false at the end of the stream
+bool fill(Connection *connection)
+{
+	char chunk[65536];
+	ssize_t got;
+	do {
+		got = recv(connection->fd, chunk, sizeof(chunk), 0);
+	} while (got < 0 && errno == EINTR);
+	if (got <= 0) return false;
+	connection->buffer.append(chunk, got);
+	return true;
+}
+
+// splits HOST:PORT; false for socket paths
+bool splitHostPort(const char *address, string *host, string *port)
+{
+	string a = address;
+	size_t colon = a.rfind(':');
+	if (colon == string::npos || a.find('/') != string::npos) return false;
+	*host = a.substr(0, colon);
+	*port = a.substr(colon + 1);
+	return true;
+}
+
+// the TCP addresses for host and port, the caller frees them
+addrinfo *resolve(const string &host, const string &port, bool listening)
+{
+	addrinfo hints, *result = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) return nullptr;
+	return result;
+}
+
+// tiles are small and answered at once, so do not hold them back
+void noDelay(int fd)
+{
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+} // namespace
+
+bool Connection::readLine(string *line)
+{
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos)
+		if (!fill(this)) return false;
+	line->assign(buffer, 0, end);
+	buffer.erase(0, end + 1);
+	return true;
+}
+
+bool Connection::readBytes(void *data, size_t size)
+{
+	while (buffer.size() < size)
+		if (!fill(this)) return false;
+	memcpy(data, buffer.data(), size);
+	buffer.erase(0, size);
+	return true;
+}
+
+bool Connection::write(const void *data, size_t size)
+{
+	const char *bytes = (const char *)data;
+	while (size > 0) {
+		// no SIGPIPE if the other end has gone, just a failed write
+		ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool Connection::writeLine(const string &line)
+{
+	string terminated = line + "\n";
+	return write(terminated.data(), terminated.size());
+}
+
+void Connection::setTimeout(int milliseconds)
+{
+	timeval timeout;
+	timeout.tv_sec = milliseconds/1000;
+	timeout.tv_usec = (milliseconds%1000)*1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+void Connection::interrupt()
+{
+	if (fd >= 0) shutdown(fd, SHUT_RDWR);
+}
+
+void Connection::close()
+{
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+	buffer.clear();
+}
+
+int listenUnix(const char *path)
+{
+	sockaddr_un address;
+	if (!makeAddress(path, &address)) return -1;
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) return -1;
+	// anything else there makes bind fail with EADDRINUSE
+	removeSocketFile(path);
+	if (bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 8) < 0) {
+		int error = errno;
+		::close(listener);
+		errno = error;
+		return -1;
+	}
+	return listener;
+}
+
+void removeSocketFile(const char *path)
+{
+	struct stat status;
+	if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+		unlink(path);
+}
+
+bool acceptConnection(int listener, Connection *connection)
+{
+	int fd;
+	do {
+		fd = accept(listener, nullptr, nullptr);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0) return false;
+	noDelay(fd); // fails harmlessly on Unix sockets
+	connection->fd = fd;
+	connection->buffer.clear();
+	return true;
+}
+
+bool connectUnix(const char *path, Connection *connection)
+{
+	sockaddr_un address;
+	if (!makeAddress(path, &address)) return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	if (connect(fd, (sockaddr *)&address, sizeof(address)) < 0) {
+		::close(fd);
+		return false;
+	}
+	connection->fd = fd;
+	connection->buffer.clear();
+	return true;
+}
+
+int listenAddress(const char *address)
+{
+	string host, port;
+	if (!splitHostPort(address, &host, &port)) return listenUnix(address);
+	addrinfo *info = resolve(host, port, true);
+	if (!info) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+	int listener = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	int on = 1;
+	if (listener >= 0) setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (listener >= 0 && (bind(listener, info->ai_addr, info->ai_addrlen) < 0 || listen(listener, 8) < 0)) {
+		int error = errno;
+		::close(listener);
+		errno = error;
+		listener = -1;
+	}
+	freeaddrinfo(info);
+	return listener;
+}
+
+bool isSocketPath(const char *address)
+{
+	string host, port;
+	return !splitHostPort(address, &host, &port);
+}
+
+bool connectAddress(const char *address, Connection *connection)
+{
+	string host, port;
+	if (!splitHostPort(address, &host, &port)) return connectUnix(address, connection);
+	addrinfo *info = resolve(host, port, false);
+	if (!info) return false;
+	int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) < 0) {
+		::close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(info);
+	if (fd < 0) return false;
+	noDelay(fd);
+	connection->fd = fd;
+	connection->buffer.clear();
+	return true;
+}
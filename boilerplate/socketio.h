@@ -0,0 +1,55 @@
+// ==========================================================================
+// Socket Connections
+//  - the render daemon and its clients talk over a Unix domain socket (an
+//    address with a path) or TCP (HOST:PORT) with text command lines, and
+//    tiles sent back as raw bytes after a header line
+//  - reads are buffered, so lines and byte blocks can be mixed freely
+// ==========================================================================
+#ifndef SOCKETIO_H
+#define SOCKETIO_H
+
+#include <cstddef>
+#include <string>
+
+struct Connection
+{
+	int fd = -1;
+	std::string buffer; // read but not yet consumed
+
+	// false once the other end has closed or on an error
+	bool readLine(std::string *line);
+	bool readBytes(void *data, size_t size);
+	bool write(const void *data, size_t size);
+	bool writeLine(const std::string &line);
+
+	// reads that wait longer than this fail, 0 waits for ever
+	void setTimeout(int milliseconds);
+
+	// makes a read blocked in another thread fail; the descriptor stays
+	// open until close
+	void interrupt();
+
+	void close();
+};
+
+// a socket listening at path, replacing any socket file already there;
+// -1 on failure, with errno EADDRINUSE if another kind of file is there
+int listenUnix(const char *path);
+
+// removes the file at path if it is a socket, and leaves anything else
+void removeSocketFile(const char *path);
+
+// waits for the next client; false if listening failed
+bool acceptConnection(int listener, Connection *connection);
+
+bool connectUnix(const char *path, Connection *connection);
+
+// HOST:PORT listens on or connects over TCP, anything else is a socket path;
+// listening fails with -1 and errno set
+int listenAddress(const char *address);
+bool connectAddress(const char *address, Connection *connection);
+
+// true if address is a socket path rather than HOST:PORT
+bool isSocketPath(const char *address);
+
+#endif // SOCKETIO_H
@@ -0,0 +1,192 @@
+// ==========================================================================
+// Tiled TIFF Writer
+//
+// The tiles are encoded a row of them at a time, TIFF's rows counting from
+// the top, on the tile scheduler's workers, and written in order as each
+// row is done. The directory goes after the tiles, once their offsets are
+// known, and the header is patched to point at it. Tiles at the right and
+// bottom edges are padded to the full tile size, as TIFF requires.
+// ==========================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "tiffwriter.h"
+#include "pngwriter.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+// field types
+const uint16_t TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_LONG8 = 16;
+
+// field tags, in the ascending order a directory needs
+const uint16_t TAG_WIDTH = 256, TAG_HEIGHT = 257, TAG_BITS_PER_SAMPLE = 258, TAG_COMPRESSION = 259,
+	TAG_PHOTOMETRIC = 262, TAG_SAMPLES_PER_PIXEL = 277, TAG_PLANAR_CONFIGURATION = 284,
+	TAG_PREDICTOR = 317, TAG_TILE_WIDTH = 322, TAG_TILE_LENGTH = 323, TAG_TILE_OFFSETS = 324,
+	TAG_TILE_BYTE_COUNTS = 325;
+
+struct Field
+{
+	uint16_t tag, type;
+	vector<uint64_t> values;
+};
+
+int typeSize(uint16_t type)
+{
+	return type == TIFF_SHORT ? 2 : type == TIFF_LONG ? 4 : 8;
+}
+
+void putLittleEndian(vector<unsigned char> *bytes, uint64_t value, int size)
+{
+	for (int k = 0; k < size; k++)
+		bytes->push_back(uint8_t(value >> 8*k));
+}
+
+// the directory as it is written at offset: its entries, then the values
+// too long to fit in an entry
+vector<unsigned char> makeDirectory(const vector<Field> &fields, uint64_t offset, bool big)
+{
+	int countSize = big ? 8 : 2, offsetSize = big ? 8 : 4, entrySize = big ? 20 : 12;
+	uint64_t valuesOffset = offset + countSize + fields.size()*entrySize + offsetSize;
+	vector<unsigned char> directory, values;
+	putLittleEndian(&directory, fields.size(), countSize);
+	for (const Field &field : fields) {
+		putLittleEndian(&directory, field.tag, 2);
+		putLittleEndian(&directory, field.type, 2);
+		putLittleEndian(&directory, field.values.size(), offsetSize);
+		int size = typeSize(field.type);
+		if (int(field.values.size())*size <= offsetSize) {
+			for (uint64_t value : field.values)
+				putLittleEndian(&directory, value, size);
+			directory.resize(directory.size() + offsetSize - field.values.size()*size, 0);
+		} else {
+			// on a word boundary
+			if (values.size() & 1) values.push_back(0);
+			putLittleEndian(&directory, valuesOffset + values.size(), offsetSize);
+			for (uint64_t value : field.values)
+				putLittleEndian(&values, value, size);
+		}
+	}
+	putLittleEndian(&directory, 0, offsetSize); // no next directory
+	directory.insert(directory.end(), values.begin(), values.end());
+	return directory;
+}
+
+// predictor 2: each byte but those of a row's first pixel becomes its
+// difference from the same channel of the pixel to its left
+void differenceRows(unsigned char *pixels, int tileSize)
+{
+	int rowBytes = tileSize*3;
+	for (int y = 0; y < tileSize; y++) {
+		unsigned char *row = pixels + size_t(y)*rowBytes;
+		for (int i = rowBytes - 1; i >= 3; i--)
+			row[i] -= row[i - 3];
+	}
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+bool writeTiledTIFF(const string &fileName, int width, int height,
+		const ToneMapOptions &toneMap, const TiffOptions &options, const TiffTileSource &source)
+{
+	if (width <= 0 || height <= 0) return false;
+	int tileSize = std::max(16, (options.tileSize + 15) & ~15);
+	int workers = options.workers > 0 ? options.workers : defaultWorkerCount();
+	int across = (width + tileSize - 1)/tileSize, down = (height + tileSize - 1)/tileSize;
+	size_t tileBytes = size_t(tileSize)*tileSize*3;
+
+	// a tile that does not shrink is stored, 5 bytes a 64K block more than
+	// it is; if every tile did, would the offsets still fit in 32 bits?
+	uint64_t tileCount = uint64_t(across)*down;
+	uint64_t largest = tileCount*(tileBytes + tileBytes/8192 + 64) + tileCount*8 + 4096;
+	bool big = largest >= (uint64_t(1) << 32);
+
+	FILE *file = fopen(fileName.c_str(), "wb");
+	if (!file) return false;
+	vector<unsigned char> header = {'I', 'I'};
+	if (big) {
+		putLittleEndian(&header, 43, 2);
+		putLittleEndian(&header, 8, 2); // offset size
+		putLittleEndian(&header, 0, 2);
+		putLittleEndian(&header, 0, 8); // the directory's offset, filled in at the end
+	} else {
+		putLittleEndian(&header, 42, 2);
+		putLittleEndian(&header, 0, 4);
+	}
+	bool written = fwrite(header.data(), 1, header.size(), file) == header.size();
+	uint64_t position = header.size();
+
+	ToneMapOptions tileToneMap = toneMap;
+	tileToneMap.workers = 1;
+	vector<uint64_t> offsets(tileCount), counts(tileCount);
+	vector<vector<unsigned char>> encoded(across);
+	vector<Tile> row(across);
+	atomic<bool> sourced(true);
+	for (int ty = 0; ty < down && written; ty++) {
+		// the row's tiles in image coordinates, below the row before
+		int top = height - ty*tileSize;
+		for (int tx = 0; tx < across; tx++) {
+			Tile &tile = row[tx];
+			tile.index = tx;
+			tile.x = tx*tileSize;
+			tile.y = std::max(0, top - tileSize);
+			tile.width = std::min(tileSize, width - tile.x);
+			tile.height = top - tile.y;
+		}
+		renderTiles(row, workers, [&](const Tile &tile, int worker) {
+			vector<vec3> colors(tile.width*tile.height);
+			if (!source(tile, colors.data())) sourced = false;
+			vector<unsigned char> pixels(size_t(tile.width)*tile.height*3), padded(tileBytes, 0);
+			quantizeImage(colors.data(), tile.width, tile.height, tileToneMap, pixels.data());
+			for (int y = 0; y < tile.height; y++)
+				memcpy(&padded[size_t(y)*tileSize*3], &pixels[size_t(y)*tile.width*3], tile.width*3);
+			differenceRows(padded.data(), tileSize);
+			zlibCompress(padded.data(), tileBytes, options.level, &encoded[tile.index]);
+		}, nullptr);
+		written = written && sourced;
+		for (int tx = 0; tx < across && written; tx++) {
+			const vector<unsigned char> &bytes = encoded[tx];
+			offsets[size_t(ty)*across + tx] = position;
+			counts[size_t(ty)*across + tx] = bytes.size();
+			written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+			position += bytes.size();
+		}
+	}
+
+	// the directory, on a word boundary
+	if (position & 1) {
+		written = written && fputc(0, file) != EOF;
+		position++;
+	}
+	uint16_t offsetType = big ? TIFF_LONG8 : TIFF_LONG;
+	vector<Field> fields = {
+		{TAG_WIDTH, TIFF_LONG, {uint64_t(width)}},
+		{TAG_HEIGHT, TIFF_LONG, {uint64_t(height)}},
+		{TAG_BITS_PER_SAMPLE, TIFF_SHORT, {8, 8, 8}},
+		{TAG_COMPRESSION, TIFF_SHORT, {8}},          // deflate, in a zlib stream
+		{TAG_PHOTOMETRIC, TIFF_SHORT, {2}},          // RGB
+		{TAG_SAMPLES_PER_PIXEL, TIFF_SHORT, {3}},
+		{TAG_PLANAR_CONFIGURATION, TIFF_SHORT, {1}}, // channels interleaved
+		{TAG_PREDICTOR, TIFF_SHORT, {2}},            // horizontal differences
+		{TAG_TILE_WIDTH, TIFF_LONG, {uint64_t(tileSize)}},
+		{TAG_TILE_LENGTH, TIFF_LONG, {uint64_t(tileSize)}},
+		{TAG_TILE_OFFSETS, offsetType, offsets},
+		{TAG_TILE_BYTE_COUNTS, offsetType, counts}
+	};
+	vector<unsigned char> directory = makeDirectory(fields, position, big);
+	written = written && fwrite(directory.data(), 1, directory.size(), file) == directory.size();
+	vector<unsigned char> directoryOffset;
+	putLittleEndian(&directoryOffset, position, big ? 8 : 4);
+	written = written && fseeko(file, big ? 8 : 4, SEEK_SET) == 0 &&
+		fwrite(directoryOffset.data(), 1, directoryOffset.size(), file) == directoryOffset.size();
+	return fclose(file) == 0 && written;
+}
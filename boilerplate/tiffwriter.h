@@ -0,0 +1,38 @@
+// ==========================================================================
+// Tiled TIFF Writer
+//  - writes 8 bit RGB TIFF files in square tiles, each deflated on its own
+//    after horizontal differencing (predictor 2), the way viewers of very
+//    large images read them back, one tile at a time
+//  - the pixels are not handed over as one image: each tile's colours are
+//    asked for when a worker gets to it, so an image kept out of core is
+//    encoded through a row of tiles' worth of memory
+//  - files that could pass 4 GB are BigTIFF, the 64 bit variant
+// ==========================================================================
+#ifndef TIFFWRITER_H
+#define TIFFWRITER_H
+
+#include <functional>
+#include <string>
+#include <glm/vec3.hpp>
+
+#include "tiles.h"
+#include "tonemap.h"
+
+struct TiffOptions
+{
+	int tileSize = 256; // rounded up to a multiple of 16, as TIFF wants
+	int level = 6;      // deflate level, 0 to 9
+	int workers = 0;    // 0 for the default worker count
+};
+
+// fills colors with the tile's tile.width*tile.height colours, rows from
+// the bottom, or returns false if it cannot; tiles are given in image
+// coordinates, y up, and are called for from several workers at once
+typedef std::function<bool(const Tile &tile, glm::vec3 *colors)> TiffTileSource;
+
+// writes a width*height image whose colours come from source, quantized
+// with toneMap, as a tiled TIFF
+bool writeTiledTIFF(const std::string &fileName, int width, int height,
+		const ToneMapOptions &toneMap, const TiffOptions &options, const TiffTileSource &source);
+
+#endif // TIFFWRITER_H
@@ -0,0 +1,57 @@
+// ==========================================================================
+// Tile Scheduler
+// ==========================================================================
+
+#include <atomic>
+#include <thread>
+
+#include "tiles.h"
+
+using namespace std;
+
+vector<Tile> makeTiles(int width, int height, int tileSize)
+{
+	return makeRegionTiles(0, 0, width, height, tileSize);
+}
+
+vector<Tile> makeRegionTiles(int x0, int y0, int width, int height, int tileSize)
+{
+	vector<Tile> tiles;
+	for (int x = 0; x < width; x += tileSize) {
+		for (int y = 0; y < height; y += tileSize) {
+			Tile tile;
+			tile.index = tiles.size();
+			tile.x = x0 + x;
+			tile.y = y0 + y;
+			tile.width = min(tileSize, width - x);
+			tile.height = min(tileSize, height - y);
+			tiles.push_back(tile);
+		}
+	}
+	return tiles;
+}
+
+void renderTiles(const vector<Tile> &tiles, int workers,
+		const function<void(const Tile &tile, int worker)> &render,
+		const function<void(int worker)> &finish)
+{
+	atomic<int> next(0);
+	auto work = [&](int worker) {
+		for (int i = next++; i < (int)tiles.size(); i = next++)
+			render(tiles[i], worker);
+		if (finish) finish(worker);
+	};
+
+	vector<thread> threads;
+	for (int worker = 1; worker < workers; worker++)
+		threads.push_back(thread(work, worker));
+	work(0);
+	for (thread &t : threads)
+		t.join();
+}
+
+int defaultWorkerCount()
+{
+	int count = thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
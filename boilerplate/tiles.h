@@ -0,0 +1,37 @@
+// ==========================================================================
+// Tile Scheduler
+//  - the image is cut into square tiles, handed out to worker threads from
+//    a shared counter, so a worker that finishes early takes the next one
+//  - everything a tile needs (its pixels, its light list) is set up by the
+//    worker that renders it
+// ==========================================================================
+#ifndef TILES_H
+#define TILES_H
+
+#include <functional>
+#include <vector>
+
+struct Tile
+{
+	int index;
+	int x, y;          // lower left pixel
+	int width, height; // smaller than the tile size at the image edges
+};
+
+std::vector<Tile> makeTiles(int width, int height, int tileSize);
+
+// the tiles of the region (x, y, width, height) of an image, lined up with
+// the image's own tiles when x and y are multiples of tileSize
+std::vector<Tile> makeRegionTiles(int x, int y, int width, int height, int tileSize);
+
+// calls render once for every tile, from workers threads (the calling
+// thread is one of them); finish is called by each worker after its last
+// tile, and may be empty
+void renderTiles(const std::vector<Tile> &tiles, int workers,
+		const std::function<void(const Tile &tile, int worker)> &render,
+		const std::function<void(int worker)> &finish);
+
+// the number of workers to use by default, at least one
+int defaultWorkerCount();
+
+#endif // TILES_H
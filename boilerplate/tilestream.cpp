@@ -0,0 +1,165 @@
+// ==========================================================================
+// Tile Streams
+//
+// Every message is put together in one buffer and written with one
+// write, so a reader never waits on half of one for long. The words are
+// written as they are in memory, little endian on the machines this runs on.
+// ==========================================================================
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tilestream.h"
+
+using namespace std;
+
+namespace {
+
+// more than this many pixels in a tile or frame is not a tile stream
+const uint32_t MAX_SIDE = 1 << 16;
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+	const char *bytes = (const char *)data;
+	while (size > 0) {
+		ssize_t written = ::write(fd, bytes, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool readAll(int fd, void *data, size_t size)
+{
+	char *bytes = (char *)data;
+	while (size > 0) {
+		ssize_t got = ::read(fd, bytes, size);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return false;
+		bytes += got;
+		size -= got;
+	}
+	return true;
+}
+
+void putWord(vector<char> *message, uint32_t word)
+{
+	const char *bytes = (const char *)&word;
+	message->insert(message->end(), bytes, bytes + 4);
+}
+
+bool send(TileStream *stream, const vector<char> &message)
+{
+	if (stream->failed || stream->fd < 0) return false;
+	if (!writeAll(stream->fd, message.data(), message.size())) {
+		cout << "Tile stream: write failed (" << strerror(errno) << "), streaming stopped" << endl;
+		stream->failed = true;
+		return false;
+	}
+	stream->bytes += message.size();
+	return true;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+bool openTileStream(TileStream *stream, const char *path)
+{
+	// a reader that closes its end fails the write instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+	*stream = TileStream();
+	if (strcmp(path, "-") == 0) {
+		stream->fd = STDOUT_FILENO;
+	} else {
+		stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		stream->ownsFd = true;
+	}
+	if (stream->fd < 0) return false;
+	vector<char> header(TILE_STREAM_MAGIC, TILE_STREAM_MAGIC + 8);
+	return send(stream, header);
+}
+
+void closeTileStream(TileStream *stream)
+{
+	if (stream->ownsFd && stream->fd >= 0) close(stream->fd);
+	stream->fd = -1;
+}
+
+bool beginStreamFrame(TileStream *stream, int width, int height)
+{
+	vector<char> message;
+	putWord(&message, TILE_FRAME_BEGIN);
+	putWord(&message, width);
+	putWord(&message, height);
+	return send(stream, message);
+}
+
+bool endStreamFrame(TileStream *stream)
+{
+	vector<char> message;
+	putWord(&message, TILE_FRAME_END);
+	return send(stream, message);
+}
+
+bool streamTile(TileStream *stream, const Tile &tile, const float *colors)
+{
+	if (stream->failed) return false;
+	vector<char> message;
+	message.reserve(20 + tile.width*tile.height*12);
+	putWord(&message, TILE_DATA);
+	putWord(&message, tile.x);
+	putWord(&message, tile.y);
+	putWord(&message, tile.width);
+	putWord(&message, tile.height);
+	// columns, as rendered, to rows
+	message.resize(20 + tile.width*tile.height*12);
+	float *rows = (float *)&message[20];
+	for (int y = 0; y < tile.height; y++)
+		for (int x = 0; x < tile.width; x++)
+			memcpy(&rows[3*(y*tile.width + x)], &colors[3*(x*tile.height + y)], 12);
+	if (!send(stream, message)) return false;
+	stream->tiles++;
+	return true;
+}
+
+bool readStreamHeader(int fd)
+{
+	char magic[8];
+	return readAll(fd, magic, 8) && memcmp(magic, TILE_STREAM_MAGIC, 8) == 0;
+}
+
+bool readTileMessage(int fd, TileMessage *message)
+{
+	uint32_t type;
+	if (!readAll(fd, &type, 4)) return false;
+	message->type = type;
+	message->tile = Tile();
+	message->colors.clear();
+	if (type == TILE_FRAME_END) return true;
+	if (type == TILE_FRAME_BEGIN) {
+		uint32_t size[2];
+		if (!readAll(fd, size, 8) || size[0] > MAX_SIDE || size[1] > MAX_SIDE) return false;
+		message->tile.width = size[0];
+		message->tile.height = size[1];
+		return true;
+	}
+	if (type != TILE_DATA) return false;
+	uint32_t rect[4];
+	if (!readAll(fd, rect, 16)) return false;
+	for (int k = 0; k < 4; k++)
+		if (rect[k] > MAX_SIDE) return false;
+	message->tile.x = rect[0];
+	message->tile.y = rect[1];
+	message->tile.width = rect[2];
+	message->tile.height = rect[3];
+	message->colors.resize(size_t(rect[2])*rect[3]*3);
+	return readAll(fd, message->colors.data(), message->colors.size()*sizeof(float));
+}
@@ -0,0 +1,70 @@
+// ==========================================================================
+// Tile Streams
+//  - finished tiles are written to stdout, a FIFO or a file the moment
+//    they are delivered, each framed with its rectangle, so a reader can
+//    show or composite an image while it renders; no frame is held back
+//  - after an 8 byte magic, the stream is messages of 32 bit little endian
+//    words, a type and then:
+//      frame begin  width, height
+//      tile         x, y, width, height, then width*height RGB floats as
+//                   rendered, unclamped, rows from the bottom (y is up, as
+//                   in the image), each row from the left
+//      frame end    nothing
+//  - a frame starts from the pixels of the frame before (a move sends only
+//    the tiles it renders again), and a tile sent again within a frame
+//    replaces what came before (a denoised image is sent whole once it is
+//    filtered, after the tiles as rendered)
+// ==========================================================================
+#ifndef TILESTREAM_H
+#define TILESTREAM_H
+
+#include <vector>
+
+#include "tiles.h"
+
+const char TILE_STREAM_MAGIC[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '1'};
+
+enum TileMessageType
+{
+	TILE_FRAME_BEGIN = 1,
+	TILE_DATA = 2,
+	TILE_FRAME_END = 3
+};
+
+struct TileStream
+{
+	int fd = -1;
+	bool ownsFd = false;
+	bool failed = false; // a write failed; nothing more is written
+	long long tiles = 0, bytes = 0;
+};
+
+// opens path for streaming, "-" for stdout; a FIFO waits here for its
+// reader. A reader that goes away fails the stream rather than the process
+bool openTileStream(TileStream *stream, const char *path);
+void closeTileStream(TileStream *stream);
+
+// false once the stream has failed
+bool beginStreamFrame(TileStream *stream, int width, int height);
+bool endStreamFrame(TileStream *stream);
+
+// colors are 3 floats a pixel as renderImage hands them over, tile.width
+// columns of tile.height pixels each
+bool streamTile(TileStream *stream, const Tile &tile, const float *colors);
+
+// a message as read back; for a frame begin, tile.width and tile.height
+// are the frame's size
+struct TileMessage
+{
+	int type;
+	Tile tile;
+	std::vector<float> colors; // rows from the bottom, as sent
+};
+
+// false if fd does not start with the magic
+bool readStreamHeader(int fd);
+
+// false at the end of the stream, or on a message that makes no sense
+bool readTileMessage(int fd, TileMessage *message);
+
+#endif // TILESTREAM_H
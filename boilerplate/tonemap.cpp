@@ -0,0 +1,180 @@
+// ==========================================================================
+// Tone Mapping and Quantization
+//
+// The converters are instantiated for every curve with and without sRGB,
+// so the inner loop has no branches. A row's last floats, fewer than
+// sixteen, are converted from a zero padded copy by the same code.
+// ==========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "tonemap.h"
+#include "float4.h"
+#include "tiles.h"
+
+using namespace std;
+using namespace glm;
+
+namespace {
+
+const int BAND_ROWS = 16;
+const int SRGB_TABLE_SIZE = 1 << 14; // entries over [0, 1]
+
+// the sRGB byte of i/(SRGB_TABLE_SIZE - 1), rounded; the curve is
+// steepest at black, 12.92, where neighbouring entries are 0.2 of a byte
+// apart
+struct SrgbTable
+{
+	unsigned char bytes[SRGB_TABLE_SIZE];
+
+	SrgbTable()
+	{
+		for (int i = 0; i < SRGB_TABLE_SIZE; i++) {
+			float x = float(i)/(SRGB_TABLE_SIZE - 1);
+			float encoded = x <= 0.0031308f ? 12.92f*x : 1.055f*pow(x, 1.0f/2.4f) - 0.055f;
+			bytes[i] = (unsigned char)(255.0f*encoded + 0.5f);
+		}
+	}
+};
+
+const SrgbTable srgbTable;
+
+// Hable's curve, with his parameters
+inline Float4 hable(Float4 x)
+{
+	const float A = 0.15f, B = 0.50f, C = 0.10f, D = 0.20f, E = 0.02f, F = 0.30f;
+	return (x*(splat(A)*x + splat(C*B)) + splat(D*E))/(x*(splat(A)*x + splat(B)) + splat(D*F)) - splat(E/F);
+}
+
+struct Conversion
+{
+	float scale;       // 2^exposure, and any scale the curve expects
+	float filmicWhite; // 1 over the filmic curve at white
+};
+
+template <int CURVE>
+inline Float4 toneCurve(Float4 x, const Conversion &conversion)
+{
+	x = x*splat(conversion.scale);
+	if (CURVE == TONE_FILMIC) {
+		x = hable(x)*splat(conversion.filmicWhite);
+	} else if (CURVE == TONE_ACES) {
+		x = (x*(splat(2.51f)*x + splat(0.03f)))/(x*(splat(2.43f)*x + splat(0.59f)) + splat(0.14f));
+	}
+	// NaNs become 0
+	return min(max(x, splat(0.0f)), splat(1.0f));
+}
+
+template <int CURVE, bool SRGB>
+inline void convert16(const float *in, const Conversion &conversion, unsigned char *out)
+{
+	Float4 v[4];
+	for (int q = 0; q < 4; q++)
+		v[q] = toneCurve<CURVE>(load(in + 4*q), conversion);
+	if (!SRGB) {
+		Float4 scale = splat(255.0f);
+		storeBytes(out, v[0]*scale, v[1]*scale, v[2]*scale, v[3]*scale);
+		return;
+	}
+	int32_t index[16];
+	for (int q = 0; q < 4; q++)
+		storeInts(index + 4*q, v[q]*splat(float(SRGB_TABLE_SIZE - 1)) + splat(0.5f));
+	for (int k = 0; k < 16; k++)
+		out[k] = srgbTable.bytes[index[k]];
+}
+
+template <int CURVE, bool SRGB>
+void convertRun(const float *in, size_t count, const Conversion &conversion, unsigned char *out)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+		convert16<CURVE, SRGB>(in + i, conversion, out + i);
+	if (i < count) {
+		float tail[16] = {0.0f};
+		unsigned char bytes[16];
+		memcpy(tail, in + i, (count - i)*sizeof(float));
+		convert16<CURVE, SRGB>(tail, conversion, bytes);
+		memcpy(out + i, bytes, count - i);
+	}
+}
+
+typedef void (*RunConverter)(const float *in, size_t count, const Conversion &conversion, unsigned char *out);
+
+template <int CURVE>
+RunConverter converterFor(bool srgb)
+{
+	return srgb ? convertRun<CURVE, true> : convertRun<CURVE, false>;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------------
+
+const char *toneCurveName(ToneCurve curve)
+{
+	switch (curve) {
+	case TONE_FILMIC: return "filmic";
+	case TONE_ACES: return "aces";
+	default: return "clamp";
+	}
+}
+
+bool parseToneCurve(const string &name, ToneCurve *curve)
+{
+	for (int c = TONE_CLAMP; c <= TONE_ACES; c++) {
+		if (name == toneCurveName(ToneCurve(c))) {
+			*curve = ToneCurve(c);
+			return true;
+		}
+	}
+	return false;
+}
+
+void quantizeImage(const vec3 *colors, int width, int height,
+		const ToneMapOptions &options, unsigned char *pixels)
+{
+	if (width <= 0 || height <= 0) return;
+	Conversion conversion;
+	conversion.scale = exp2(options.exposure);
+	conversion.filmicWhite = 1.0f;
+	RunConverter convert;
+	switch (options.curve) {
+	case TONE_FILMIC: {
+		// Hable's exposure bias of 2
+		conversion.scale *= 2.0f;
+		float white[4];
+		store(white, hable(splat(11.2f)));
+		conversion.filmicWhite = 1.0f/white[0];
+		convert = converterFor<TONE_FILMIC>(options.srgb);
+		break;
+	}
+	case TONE_ACES:
+		// the fit is of colours at 0.6 of the exposure the curve expects
+		conversion.scale *= 0.6f;
+		convert = converterFor<TONE_ACES>(options.srgb);
+		break;
+	default:
+		convert = converterFor<TONE_CLAMP>(options.srgb);
+	}
+
+	vector<Tile> bands;
+	for (int y = 0; y < height; y += BAND_ROWS) {
+		Tile band;
+		band.index = bands.size();
+		band.x = 0;
+		band.y = y;
+		band.width = width;
+		band.height = std::min(BAND_ROWS, height - y);
+		bands.push_back(band);
+	}
+	int workers = options.workers > 0 ? options.workers : defaultWorkerCount();
+	size_t rowFloats = size_t(width)*3;
+	renderTiles(bands, workers, [&](const Tile &band, int worker) {
+		for (int y = band.y; y < band.y + band.height; y++)
+			convert(&colors[size_t(y)*width].x, rowFloats, conversion,
+				pixels + size_t(height - 1 - y)*rowFloats);
+	}, nullptr);
+}
@@ -0,0 +1,44 @@
+// ==========================================================================
+// Tone Mapping and Quantization
+//  - colours become 8 bit RGB through an exposure, a tone curve (a clamp,
+//    Hable's filmic curve or an ACES fit) and, optionally, the sRGB
+//    transfer function
+//  - the three channels of a row are one run of floats to the passes, all
+//    per channel, so rows are converted sixteen floats at a time with SSE
+//    where the compiler has it; bands of rows go to the tile scheduler's
+//    workers
+// ==========================================================================
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <string>
+#include <glm/glm.hpp>
+
+enum ToneCurve
+{
+	TONE_CLAMP,  // colours past 1 are clipped
+	TONE_FILMIC, // Hable's Uncharted 2 curve, white at 11.2
+	TONE_ACES    // Narkowicz's fit of the ACES reference rendering transform
+};
+
+struct ToneMapOptions
+{
+	float exposure = 0.0f; // stops; colours are scaled by 2^exposure
+	ToneCurve curve = TONE_CLAMP;
+	bool srgb = false;     // encode with the sRGB transfer function
+	int workers = 0;       // 0 for the default worker count
+};
+
+const char *toneCurveName(ToneCurve curve);
+
+// the curve of the given name, false if there is none
+bool parseToneCurve(const std::string &name, ToneCurve *curve);
+
+// converts width*height colours, rows from the bottom, into 8 bit RGB
+// pixels, rows from the top. With the default options a channel c becomes
+// (unsigned char)(255*clamp(c, 0, 1)); sRGB output is rounded to the
+// nearest byte, from a table fine enough to be off by at most one
+void quantizeImage(const glm::vec3 *colors, int width, int height,
+		const ToneMapOptions &options, unsigned char *pixels);
+
+#endif // TONEMAP_H
@@ -0,0 +1,14 @@
+# Plots the RMSE against samples per pixel written by --sampler-benchmark,
+# on log-log axes, one line per sampler:
+#   gnuplot -e "data='convergence.csv'" tools/convergence.gnuplot > convergence.png
+
+if (!exists("data")) data = 'convergence.csv'
+
+set terminal pngcairo size 800,600
+set datafile separator ','
+set key autotitle columnhead
+set logscale xy 2
+set xlabel 'samples per pixel'
+set ylabel 'RMSE (8 bit steps)'
+set grid
+plot for [column=2:5] data using 1:column with linespoints
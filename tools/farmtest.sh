@@ -0,0 +1,57 @@
+#!/bin/sh
+# Render farm fault test: renders a scene on two daemons, one of which
+# exits after a few tiles, and checks that the coordinator reissued its
+# tiles and still wrote the image a single process renders.
+#
+#	tools/farmtest.sh [BINARY] [SCENE] [FAIL_AFTER]
+#
+# BINARY defaults to ./boilerplate.out, SCENE to scene1.txt and FAIL_AFTER
+# to 5. Exits 0 if the test passed.
+
+BINARY=${1:-./boilerplate.out}
+SCENE=${2:-scene1.txt}
+FAIL_AFTER=${3:-5}
+
+DIR=$(mktemp -d /tmp/farmtest.XXXXXX) || exit 1
+PIDS=
+cleanup() {
+	for pid in $PIDS; do
+		kill $pid 2>/dev/null
+	done
+	wait 2>/dev/null
+	rm -rf "$DIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+fail() {
+	echo "farmtest: FAILED, $1"
+	exit 1
+}
+
+"$BINARY" --scene "$SCENE" --serve "$DIR/w1.sock" > "$DIR/w1.log" 2>&1 &
+PIDS="$PIDS $!"
+"$BINARY" --scene "$SCENE" --serve "$DIR/w2.sock" --fail-after "$FAIL_AFTER" > "$DIR/w2.log" 2>&1 &
+PIDS="$PIDS $!"
+
+# the daemons are ready once their sockets exist
+tries=0
+while [ ! -S "$DIR/w1.sock" ] || [ ! -S "$DIR/w2.sock" ]; do
+	tries=$((tries + 1))
+	[ $tries -gt 300 ] && fail "the daemons did not start, see $DIR/w*.log"
+	sleep 0.1
+done
+
+"$BINARY" --coordinate "$DIR/w1.sock,$DIR/w2.sock" --output "$DIR/farm.png" > "$DIR/farm.log" 2>&1 ||
+	{ cat "$DIR/farm.log"; fail "the coordinator exited with an error"; }
+cat "$DIR/farm.log"
+
+reissued=$(sed -n 's/^Farm: .* \([0-9][0-9]*\) reissued.*/\1/p' "$DIR/farm.log")
+[ -n "$reissued" ] || fail "no Farm: line in the coordinator's output"
+[ "$reissued" -gt 0 ] || fail "no tiles were reissued, the failing daemon did not fail"
+
+"$BINARY" --headless --scene "$SCENE" --output "$DIR/single.png" > "$DIR/single.log" 2>&1 ||
+	fail "the single process render exited with an error"
+cmp "$DIR/farm.png" "$DIR/single.png" || fail "the farm image differs from the single process one"
+
+echo "farmtest: passed, $reissued tiles reissued"
@@ -0,0 +1,153 @@
+// ==========================================================================
+// Render Daemon Client
+//  - sends the same render request to a daemon started with --serve a
+//    number of times and reports the latency to the first tile and to the
+//    whole image
+//  - optionally sends a lights or scene request first, and saves the last
+//    image received as a binary PPM
+// ==========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "socketio.h"
+
+using namespace std;
+
+// a request that is answered with a single line
+static bool simpleRequest(Connection &daemon, const string &request)
+{
+	string reply;
+	if (!daemon.writeLine(request) || !daemon.readLine(&reply)) return false;
+	cout << request << ": " << reply << endl;
+	return reply.compare(0, 2, "ok") == 0;
+}
+
+static void printLatencies(const char *name, vector<double> times)
+{
+	if (times.empty()) return;
+	sort(times.begin(), times.end());
+	cout << name << ": min " << times.front() << " ms, median " << times[times.size()/2]
+		<< " ms, max " << times.back() << " ms" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		cout << "usage: " << argv[0] << " ADDRESS [--requests N] [--size W H]"
+			<< " [--camera X Y Z] [--focal F] [--lights FILE] [--scene FILE]"
+			<< " [--save FILE.ppm] [--quit]" << endl;
+		return -1;
+	}
+	const char *address = argv[1];
+	int requests = 10, width = 512, height = 512;
+	string renderOptions, lightsFile, sceneFile, saveFile;
+	bool quit = false;
+	for (int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--requests" && i + 1 < argc) {
+			requests = max(1, atoi(argv[++i]));
+		} else if (arg == "--size" && i + 2 < argc) {
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		} else if (arg == "--camera" && i + 3 < argc) {
+			renderOptions += string(" camera ") + argv[i + 1] + " " + argv[i + 2] + " " + argv[i + 3];
+			i += 3;
+		} else if (arg == "--focal" && i + 1 < argc) {
+			renderOptions += string(" focal ") + argv[++i];
+		} else if (arg == "--lights" && i + 1 < argc) {
+			lightsFile = argv[++i];
+		} else if (arg == "--scene" && i + 1 < argc) {
+			sceneFile = argv[++i];
+		} else if (arg == "--save" && i + 1 < argc) {
+			saveFile = argv[++i];
+		} else if (arg == "--quit") {
+			quit = true;
+		} else {
+			cout << "unknown option " << arg << endl;
+			return -1;
+		}
+	}
+
+	Connection daemon;
+	if (!connectAddress(address, &daemon)) {
+		cout << "cannot connect to " << address << endl;
+		return -1;
+	}
+	if (!sceneFile.empty() && !simpleRequest(daemon, "scene " + sceneFile)) return -1;
+	if (!lightsFile.empty() && !simpleRequest(daemon, "lights " + lightsFile)) return -1;
+
+	string request = "render " + to_string(width) + " " + to_string(height) + renderOptions;
+	vector<double> firstTile, whole;
+	vector<unsigned char> image, bytes;
+	for (int r = 0; r < requests; r++) {
+		auto start = chrono::steady_clock::now();
+		string line;
+		if (!daemon.writeLine(request) || !daemon.readLine(&line)) {
+			cout << "daemon went away" << endl;
+			return -1;
+		}
+		int imageWidth, imageHeight, tiles;
+		if (sscanf(line.c_str(), "image %d %d %d", &imageWidth, &imageHeight, &tiles) != 3) {
+			cout << line << endl;
+			return -1;
+		}
+		if (imageWidth <= 0 || imageHeight <= 0 || tiles <= 0) {
+			cout << "bad image header " << line << endl;
+			return -1;
+		}
+		image.assign(size_t(imageWidth)*imageHeight*3, 0);
+		for (int t = 0; t < tiles; t++) {
+			int x, y, w, h;
+			if (!daemon.readLine(&line) || sscanf(line.c_str(), "tile %d %d %d %d", &x, &y, &w, &h) != 4) {
+				cout << "bad tile header " << line << endl;
+				return -1;
+			}
+			if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > imageWidth || y + h > imageHeight) {
+				cout << "tile " << x << "," << y << " " << w << "x" << h << " outside the "
+					<< imageWidth << "x" << imageHeight << " image" << endl;
+				return -1;
+			}
+			bytes.resize(size_t(w)*h*3);
+			if (!daemon.readBytes(&bytes[0], bytes.size())) {
+				cout << "daemon went away" << endl;
+				return -1;
+			}
+			if (t == 0)
+				firstTile.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+			for (int row = 0; row < h; row++)
+				copy(&bytes[size_t(row)*w*3], &bytes[size_t(row + 1)*w*3], &image[(size_t(y + row)*imageWidth + x)*3]);
+		}
+		if (!daemon.readLine(&line) || line.compare(0, 4, "done") != 0) {
+			cout << "expected done, got " << line << endl;
+			return -1;
+		}
+		whole.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		width = imageWidth;
+		height = imageHeight;
+	}
+	cout << requests << " requests for " << width << "x" << height << " images" << endl;
+	printLatencies("First tile", firstTile);
+	printLatencies("Whole image", whole);
+
+	if (!saveFile.empty()) {
+		// PPM rows run top down, the daemon's bottom up
+		FILE *file = fopen(saveFile.c_str(), "wb");
+		if (file) {
+			fprintf(file, "P6\n%d %d\n255\n", width, height);
+			for (int row = height - 1; row >= 0; row--)
+				fwrite(&image[size_t(row)*width*3], 1, width*3, file);
+			fclose(file);
+		}
+	}
+	if (quit)
+		daemon.writeLine("quit");
+	daemon.close();
+	return 0;
+}
@@ -0,0 +1,118 @@
+// ==========================================================================
+// Tile Stream Reader
+//  - the reference reader for the renderer's --stream output: reads the
+//    stream from a file or FIFO (stdin if none is given), checks every
+//    message against the frame it belongs to, and keeps each frame's
+//    pixels as the tiles come in
+//  - reports every frame's tiles and when its first and last arrived, and
+//    optionally saves every finished frame as a PFM
+// ==========================================================================
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tilestream.h"
+
+using namespace std;
+
+// PFM rows run bottom up, as the stream's do
+static bool savePFM(const string &fileName, int width, int height, const vector<float> &pixels)
+{
+	FILE *file = fopen(fileName.c_str(), "wb");
+	if (!file) return false;
+	fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+	bool written = fwrite(pixels.data(), sizeof(float), pixels.size(), file) == pixels.size();
+	return fclose(file) == 0 && written;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = 0;
+	string savePrefix;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--save" && i + 1 < argc) {
+			savePrefix = argv[++i];
+		} else if (arg[0] != '-' && !path) {
+			path = argv[i];
+		} else {
+			cout << "usage: " << argv[0] << " [STREAM] [--save PREFIX]" << endl;
+			return -1;
+		}
+	}
+	int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+	if (fd < 0) {
+		cout << "cannot open " << path << endl;
+		return -1;
+	}
+	if (!readStreamHeader(fd)) {
+		cout << "not a tile stream" << endl;
+		return -1;
+	}
+
+	auto start = chrono::steady_clock::now();
+	auto elapsed = [&]() { return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(); };
+	int width = 0, height = 0, frames = 0, tiles = 0;
+	long long covered = 0; // pixels sent in this frame, counted again if sent again
+	double firstTile = 0;
+	bool inFrame = false;
+	vector<float> pixels;
+	TileMessage message;
+	while (readTileMessage(fd, &message)) {
+		if (message.type == TILE_FRAME_BEGIN) {
+			if (inFrame) {
+				cout << "frame " << frames << " begins inside another" << endl;
+				return -1;
+			}
+			// a frame starts from the one before, unless its size changes
+			if (message.tile.width != width || message.tile.height != height) {
+				width = message.tile.width;
+				height = message.tile.height;
+				pixels.assign(size_t(width)*height*3, 0.0f);
+			}
+			inFrame = true;
+			tiles = 0;
+			covered = 0;
+			start = chrono::steady_clock::now();
+		} else if (message.type == TILE_DATA) {
+			const Tile &tile = message.tile;
+			if (!inFrame || tile.x + tile.width > width || tile.y + tile.height > height) {
+				cout << "tile " << tile.x << "," << tile.y << " " << tile.width << "x" << tile.height
+					<< " outside frame " << frames << endl;
+				return -1;
+			}
+			if (tiles++ == 0) firstTile = elapsed();
+			covered += tile.width*tile.height;
+			for (int row = 0; row < tile.height; row++)
+				memcpy(&pixels[3*(size_t(tile.y + row)*width + tile.x)], &message.colors[3*row*tile.width],
+					3*tile.width*sizeof(float));
+		} else {
+			if (!inFrame) {
+				cout << "frame end outside a frame" << endl;
+				return -1;
+			}
+			cout << "frame " << frames << ": " << width << "x" << height << ", " << tiles << " tiles, "
+				<< 100.0*covered/(double(width)*height) << "% of the pixels, first tile after "
+				<< firstTile << " ms, done after " << elapsed() << " ms" << endl;
+			if (!savePrefix.empty()) {
+				string fileName = savePrefix + "." + to_string(frames) + ".pfm";
+				if (!savePFM(fileName, width, height, pixels))
+					cout << "cannot write " << fileName << endl;
+			}
+			inFrame = false;
+			frames++;
+		}
+	}
+	if (inFrame) {
+		cout << "stream ended inside frame " << frames << endl;
+		return -1;
+	}
+	cout << frames << " frames" << endl;
+	return 0;
+}